@@ -0,0 +1,41 @@
+/*
+ * allocator.h - A malloc package behind a table of function pointers,
+ *     so that the drivers can run several packages on the same traces
+ */
+#ifndef __ALLOCATOR_H_
+#define __ALLOCATOR_H_
+
+#include <stddef.h>
+
+typedef struct {
+    char *name;                              /* e.g. "mm" or "libc" */
+    int (*init)(void);                       /* < 0 on failure */
+    void *(*malloc)(size_t size);
+    void (*free)(void *ptr);
+    void *(*realloc)(void *ptr, size_t size);
+    void *(*malloc_hint)(size_t size, int life); /* malloc with an 
+						    MM_LIFE_* hint, or NULL */
+    int (*check)(void);                      /* nonzero if consistent, 
+						or NULL */
+    int (*check_incr)(size_t budget);        /* the same for the next
+						budget blocks, or NULL */
+    void (*freeinfo)(size_t *nfree, size_t *maxfree); /* or NULL */
+    int uses_memlib;  /* set if the heap comes from mem_sbrk, so the 
+			 driver can measure utilization and must call 
+			 mem_reset_brk before init */
+} allocator_t;
+
+/* The package in mm.c, and the C library's malloc */
+extern allocator_t mm_allocator;
+extern allocator_t libc_allocator;
+
+/* 
+ * Every package linked into this program (mm, then the variants named
+ * in the Makefile's VARIANTS, then libc), terminated by NULL 
+ */
+extern allocator_t *allocators[];
+
+/* Look up a package in allocators[] by name; NULL if there is none */
+allocator_t *find_allocator(char *name);
+
+#endif /* __ALLOCATOR_H_ */
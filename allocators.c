@@ -0,0 +1,46 @@
+/*
+ * allocators.c - The registry of malloc packages linked into the driver
+ *
+ * MM_VARIANTS lists the builds of mm.c as MM_VARIANT(name) entries, one
+ * per object compiled with -DMM_PREFIX=name; the Makefile passes it on
+ * the command line. Without it, only mm itself is registered.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "allocator.h"
+
+#ifndef MM_VARIANTS
+#define MM_VARIANTS MM_VARIANT(mm)
+#endif
+
+#define MM_VARIANT(name) extern allocator_t name ## _allocator;
+MM_VARIANTS
+#undef MM_VARIANT
+
+static int libc_init(void)
+{
+    return 0;
+}
+
+allocator_t libc_allocator = {
+    "libc", libc_init, malloc, free, realloc, NULL, NULL, NULL, NULL, 0
+};
+
+#define MM_VARIANT(name) &name ## _allocator,
+allocator_t *allocators[] = {
+    MM_VARIANTS
+    &libc_allocator,
+    NULL
+};
+#undef MM_VARIANT
+
+allocator_t *find_allocator(char *name)
+{
+    int i;
+
+    for (i = 0; allocators[i] != NULL; i++)
+	if (strcmp(allocators[i]->name, name) == 0)
+	    return allocators[i];
+    return NULL;
+}
@@ -0,0 +1,195 @@
+/*
+ * bench.c - Statistically rigorous timing of a test function
+ *
+ * fcyc's K-best scheme reports the fastest of a few runs, which hides
+ * how much the runs varied. Here every measured iteration is kept. The
+ * median is the estimate, the spread of the median is estimated by 
+ * resampling the iterations with replacement (the bootstrap), and two
+ * sets of iterations are compared with the Mann-Whitney U test, which 
+ * makes no assumption about the shape of the distribution.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <sched.h>
+
+#include "bench.h"
+#include "clock.h"
+#include "fcyc.h"
+
+/* 
+ * Small deterministic generator (xorshift64*) for the bootstrap, so 
+ * the same samples always give the same interval
+ */
+static uint64_t rng_state;
+
+static double rng_uniform(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return (double)((rng_state * 0x2545F4914F6CDD1DULL) >> 11) / 
+	(double)(1ULL << 53);
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+/* median - Median of the n sorted values in v */
+static double median(double *v, int n)
+{
+    return (n % 2) ? v[n/2] : (v[n/2 - 1] + v[n/2]) / 2.0;
+}
+
+int bench_pin(int cpu)
+{
+    cpu_set_t set;
+
+    if (cpu < 0 && (cpu = sched_getcpu()) < 0)
+	return -1;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) < 0)
+	return -1;
+    return cpu;
+}
+
+void bench(bench_test_funct f, void *argp, int warmup, int iters, 
+	   int clear, bench_t *b)
+{
+    double *sorted, *resample, *medians;
+    double rate, mean, var;
+    int i, r;
+
+    memset(b, 0, sizeof(*b));
+    if (iters <= 0)
+	return;
+    b->n = iters;
+    b->samples = (double *)malloc(iters * sizeof(double));
+    sorted = (double *)malloc(iters * sizeof(double));
+    resample = (double *)malloc(iters * sizeof(double));
+    medians = (double *)malloc(BENCH_RESAMPLES * sizeof(double));
+    if (!b->samples || !sorted || !resample || !medians) {
+	fprintf(stderr, "bench: out of memory\n");
+	exit(1);
+    }
+
+    rate = mhz(0) * 1e6;
+    for (i = 0; i < warmup; i++)
+	f(argp);
+    for (i = 0; i < iters; i++) {
+	if (clear)
+	    fcyc_clear_cache();
+	start_counter();
+	f(argp);
+	b->samples[i] = get_counter() / rate;
+    }
+
+    memcpy(sorted, b->samples, iters * sizeof(double));
+    qsort(sorted, iters, sizeof(double), cmp_double);
+    b->median = median(sorted, iters);
+
+    mean = 0;
+    for (i = 0; i < iters; i++)
+	mean += sorted[i];
+    mean /= iters;
+    var = 0;
+    for (i = 0; i < iters; i++)
+	var += (sorted[i] - mean) * (sorted[i] - mean);
+    b->cv = (iters > 1 && mean > 0) ? sqrt(var / (iters - 1)) / mean : 0;
+    b->noisy = b->cv > BENCH_MAX_CV;
+
+    /* Percentile bootstrap of the median */
+    rng_state = 0x9E3779B97F4A7C15ULL;
+    for (r = 0; r < BENCH_RESAMPLES; r++) {
+	for (i = 0; i < iters; i++)
+	    resample[i] = sorted[(int)(rng_uniform() * iters)];
+	qsort(resample, iters, sizeof(double), cmp_double);
+	medians[r] = median(resample, iters);
+    }
+    qsort(medians, BENCH_RESAMPLES, sizeof(double), cmp_double);
+    b->ci_lo = medians[(int)(0.025 * BENCH_RESAMPLES)];
+    b->ci_hi = medians[(int)(0.975 * BENCH_RESAMPLES) - 1];
+
+    free(sorted);
+    free(resample);
+    free(medians);
+}
+
+void bench_free(bench_t *b)
+{
+    free(b->samples);
+    b->samples = NULL;
+    b->n = 0;
+}
+
+/* A value tagged with the sample it came from, for ranking */
+typedef struct {
+    double v;
+    int from_a;
+} ranked_t;
+
+static int cmp_ranked(const void *a, const void *b)
+{
+    return cmp_double(&((const ranked_t *)a)->v, &((const ranked_t *)b)->v);
+}
+
+/*
+ * bench_mannwhitney - Rank the pooled samples (ties get their average
+ *     rank), compute U for a, and use the normal approximation with tie
+ *     and continuity corrections, which is accurate once each sample 
+ *     has more than about ten values
+ */
+double bench_mannwhitney(double *a, int na, double *b, int nb)
+{
+    ranked_t *all;
+    double ra = 0, ties = 0, u, mu, sigma, z, t, rank;
+    int n = na + nb, i, j, k;
+
+    if (na == 0 || nb == 0)
+	return 1.0;
+    if ((all = (ranked_t *)malloc(n * sizeof(ranked_t))) == NULL) {
+	fprintf(stderr, "bench: out of memory\n");
+	exit(1);
+    }
+    for (i = 0; i < na; i++) {
+	all[i].v = a[i];
+	all[i].from_a = 1;
+    }
+    for (i = 0; i < nb; i++) {
+	all[na + i].v = b[i];
+	all[na + i].from_a = 0;
+    }
+    qsort(all, n, sizeof(ranked_t), cmp_ranked);
+
+    for (i = 0; i < n; i = j) {
+	for (j = i + 1; j < n && all[j].v == all[i].v; j++)
+	    ;
+	rank = (i + 1 + j) / 2.0;   /* average of ranks i+1 .. j */
+	for (k = i; k < j; k++)
+	    if (all[k].from_a)
+		ra += rank;
+	t = j - i;
+	ties += t * t * t - t;
+    }
+    free(all);
+
+    u = ra - na * (na + 1) / 2.0;
+    mu = na * (double)nb / 2.0;
+    sigma = sqrt(na * (double)nb / 12.0 * 
+		 ((n + 1) - ties / ((double)n * (n - 1))));
+    if (sigma == 0)
+	return 1.0;
+    z = (fabs(u - mu) - 0.5) / sigma;
+    if (z < 0)
+	z = 0;
+    return erfc(z / sqrt(2.0));
+}
@@ -0,0 +1,38 @@
+/*
+ * bench.h - Statistical benchmarking of a test function: many timed
+ *     iterations summarized by their median, a bootstrap confidence 
+ *     interval and the coefficient of variation
+ */
+typedef void (*bench_test_funct)(void *);
+
+#define BENCH_MAX_CV    0.05  /* runs with a larger CV are flagged NOISY */
+#define BENCH_ALPHA     0.05  /* significance level for comparisons */
+#define BENCH_RESAMPLES 1000  /* bootstrap resamples for the CI */
+
+/* Summary of one benchmark; samples are in seconds */
+typedef struct {
+    int n;            /* number of measured iterations (0 if not run) */
+    double *samples;  /* running time of each iteration, in run order */
+    double median;    /* median running time */
+    double ci_lo;     /* 95% bootstrap confidence interval ... */
+    double ci_hi;     /* ... of the median */
+    double cv;        /* coefficient of variation (stddev / mean) */
+    int noisy;        /* set if cv > BENCH_MAX_CV */
+} bench_t;
+
+/* Pin the calling thread to cpu (-1: the cpu it is running on now).
+   Returns the cpu, or -1 if it could not be pinned. */
+int bench_pin(int cpu);
+
+/* Run f(argp) warmup times untimed, then iters times timed, and 
+   summarize the timed runs in *b. If clear is set, the caches are 
+   evicted before each timed run. */
+void bench(bench_test_funct f, void *argp, int warmup, int iters, 
+	   int clear, bench_t *b);
+
+/* Free the samples held by *b */
+void bench_free(bench_t *b);
+
+/* Two-sided p-value of the Mann-Whitney U test that samples a[0..na) 
+   and b[0..nb) come from the same distribution */
+double bench_mannwhitney(double *a, int na, double *b, int nb);
@@ -1,5 +1,5 @@
 /* 
- * clock.c - Routines for using the cycle counters on x86, 
+ * clock.c - Routines for using the cycle counters on x86 (32 and 64 bit),
  *           Alpha, and Sparc boxes.
  * 
  * Copyright (c) 2002, R. Bryant and D. O'Hallaron, All rights reserved.
@@ -8,10 +8,30 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
 #include <unistd.h>
+#include <time.h>
+#include <fcntl.h>
 #include <sys/times.h>
 #include "clock.h"
 
+#define CALIB_ROUNDS 5           /* TSC calibration windows ... */
+#define CALIB_NS     2000000     /* ... of 2 ms each */
+#define CALIB_CACHE  "mdriver-tsc"  /* calibration cache, in the user's cache dir */
+
+/* 
+ * mono_ns - Nanoseconds of CLOCK_MONOTONIC_RAW, which is not slewed
+ *     by NTP. The fallback when there is no usable cycle counter.
+ */
+static uint64_t mono_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
 
 /******************************************************* 
  * Machine dependent functions 
@@ -21,55 +41,234 @@
  * You can verify this for yourself using gcc -v.
  *******************************************************/
 
-#if defined(__i386__)  
+#if defined(__i386__) || defined(__x86_64__)
 /*******************************************************
- * Pentium versions of start_counter() and get_counter()
+ * x86 versions of start_counter() and get_counter()
+ *
+ * The full 64-bit time stamp counter is read with rdtscp. rdtscp
+ * waits for all earlier instructions to finish, and the lfence after
+ * it keeps later instructions from starting before the counter is
+ * read, so the measured code cannot leak out of the interval.
+ *
+ * The TSC is only a clock if it is invariant: it ticks at a constant
+ * rate across frequency changes and sleep states. If the processor
+ * does not say so (or lacks rdtscp), we count nanoseconds of
+ * CLOCK_MONOTONIC_RAW instead and report a 1000 MHz "clock rate".
  *******************************************************/
+#include <cpuid.h>
 
+static uint64_t cyc_start = 0;
+static int use_tsc = -1;   /* -1 until init_counter has run */
 
-/* $begin x86cyclecounter */
-/* Initialize the cycle counter */
-static unsigned cyc_hi = 0;
-static unsigned cyc_lo = 0;
+/* Read the 64-bit time stamp counter */
+static inline uint64_t read_tsc(void)
+{
+    uint32_t hi, lo, aux;
+
+    asm volatile("rdtscp; lfence"
+		 : "=a" (lo), "=d" (hi), "=c" (aux)
+		 : /* No input */
+		 : "memory");
+    return ((uint64_t)hi << 32) | lo;
+}
+
+/* Decide between the TSC and CLOCK_MONOTONIC_RAW */
+static void init_counter(void)
+{
+    unsigned eax, ebx, ecx, edx;
+
+    use_tsc = 0;
+    if (__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) && eax >= 0x80000007) {
+	__get_cpuid(0x80000001, &eax, &ebx, &ecx, &edx);
+	if (edx & (1 << 27)) {                      /* rdtscp */
+	    __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+	    use_tsc = (edx & (1 << 8)) != 0;       /* invariant TSC */
+	}
+    }
+}
+
+static inline uint64_t read_counter(void)
+{
+    if (use_tsc < 0)
+	init_counter();
+    return use_tsc ? read_tsc() : mono_ns();
+}
+
+/*
+ * tsc_mhz_cpuid - TSC rate from CPUID leaf 0x15 (TSC to crystal clock
+ *     ratio and crystal frequency), or 0 if the processor doesn't say
+ */
+static double tsc_mhz_cpuid(void)
+{
+    unsigned eax, ebx, ecx, edx;
+
+    if (__get_cpuid_max(0, NULL) < 0x15)
+	return 0;
+    __cpuid(0x15, eax, ebx, ecx, edx);
+    if (eax == 0 || ebx == 0 || ecx == 0)
+	return 0;
+    return (double)ecx * ebx / eax / 1e6;
+}
+
+/*
+ * tsc_mhz_sysfs - TSC rate exported by the kernel, or 0
+ */
+static double tsc_mhz_sysfs(void)
+{
+    FILE *fp;
+    double khz = 0;
+
+    if ((fp = fopen("/sys/devices/system/cpu/cpu0/tsc_freq_khz", "r")) == NULL)
+	return 0;
+    if (fscanf(fp, "%lf", &khz) != 1)
+	khz = 0;
+    fclose(fp);
+    return khz / 1e3;
+}
+
+/*
+ * cpu_brand - Copy the processor brand string into buf (49 bytes),
+ *     which identifies the machine in the calibration cache
+ */
+static void cpu_brand(char *buf)
+{
+    unsigned regs[12];
+    int i;
+
+    memset(regs, 0, sizeof(regs));
+    for (i = 0; i < 3; i++)
+	__get_cpuid(0x80000002 + i, &regs[4*i], &regs[4*i+1], 
+		    &regs[4*i+2], &regs[4*i+3]);
+    memcpy(buf, regs, 48);
+    buf[48] = '\0';
+}
 
+/*
+ * tsc_mhz_calibrate - Measure the TSC rate against CLOCK_MONOTONIC_RAW 
+ *     over a few short windows and keep the median
+ */
+static double tsc_mhz_calibrate(void)
+{
+    double rate[CALIB_ROUNDS], tmp;
+    uint64_t t0, c0, t1, c1;
+    int i, j;
+
+    for (i = 0; i < CALIB_ROUNDS; i++) {
+	t0 = mono_ns();
+	c0 = read_tsc();
+	do {
+	    t1 = mono_ns();
+	} while (t1 - t0 < CALIB_NS);
+	c1 = read_tsc();
+	rate[i] = (double)(c1 - c0) * 1e3 / (double)(t1 - t0);
+    }
+    for (i = 1; i < CALIB_ROUNDS; i++)  /* insertion sort */
+	for (j = i; j > 0 && rate[j-1] > rate[j]; j--) {
+	    tmp = rate[j];
+	    rate[j] = rate[j-1];
+	    rate[j-1] = tmp;
+	}
+    return rate[CALIB_ROUNDS/2];
+}
 
-/* Set *hi and *lo to the high and low order bits  of the cycle counter.  
-   Implementation requires assembly code to use the rdtsc instruction. */
-void access_counter(unsigned *hi, unsigned *lo)
+/*
+ * calib_path - Put the name of the calibration cache in path: in 
+ *     $XDG_CACHE_HOME, else hidden in $HOME. Both belong to the user,
+ *     unlike /tmp. Returns 0 if there is neither or the name won't fit.
+ */
+static int calib_path(char *path, size_t size)
 {
-    asm("rdtsc; movl %%edx,%0; movl %%eax,%1"   /* Read cycle counter */
-	: "=r" (*hi), "=r" (*lo)                /* and move results to */
-	: /* No input */                        /* the two outputs */
-	: "%edx", "%eax");
+    char *dir;
+    int n;
+
+    if ((dir = getenv("XDG_CACHE_HOME")) != NULL && *dir == '/')
+	n = snprintf(path, size, "%s/%s", dir, CALIB_CACHE);
+    else if ((dir = getenv("HOME")) != NULL && *dir == '/')
+	n = snprintf(path, size, "%s/.%s", dir, CALIB_CACHE);
+    else
+	return 0;
+    return n > 0 && (size_t)n < size;
+}
+
+/*
+ * calib_open - fopen the calibration cache without following a 
+ *     symlink, creating it readable by the user alone
+ */
+static FILE *calib_open(char *path, int write)
+{
+    int fd, flags = O_NOFOLLOW;
+    FILE *fp;
+
+    flags |= write ? O_WRONLY | O_CREAT | O_TRUNC : O_RDONLY;
+    if ((fd = open(path, flags, 0600)) < 0)
+	return NULL;
+    if ((fp = fdopen(fd, write ? "w" : "r")) == NULL)
+	close(fd);
+    return fp;
+}
+
+/* 
+ * counter_mhz - Rate of the counter behind get_counter, in MHz. The TSC
+ *     rate comes from CPUID, sysfs, the calibration cache, or failing 
+ *     all of those a fresh calibration that is then cached.
+ */
+static double counter_mhz(int verbose)
+{
+    char brand[49], cached[64], path[1024];
+    double rate;
+    char *source;
+    FILE *fp;
+
+    if (use_tsc < 0)
+	init_counter();
+    if (!use_tsc) {
+	if (verbose)
+	    printf("No invariant TSC; timing with CLOCK_MONOTONIC_RAW\n");
+	return 1000.0;
+    }
+
+    source = "cpuid";
+    if ((rate = tsc_mhz_cpuid()) == 0) {
+	source = "sysfs";
+	rate = tsc_mhz_sysfs();
+    }
+    if (rate == 0) {
+	source = "cache";
+	cpu_brand(brand);
+	if (!calib_path(path, sizeof(path)))
+	    path[0] = '\0';
+	if (path[0] && (fp = calib_open(path, 0)) != NULL) {
+	    if (fgets(cached, sizeof(cached), fp) == NULL ||
+		strncmp(cached, brand, strlen(brand)) != 0 ||
+		fscanf(fp, "%lf", &rate) != 1)
+		rate = 0;
+	    fclose(fp);
+	}
+	if (rate == 0) {
+	    source = "calibration";
+	    rate = tsc_mhz_calibrate();
+	    if (path[0] && (fp = calib_open(path, 1)) != NULL) {
+		fprintf(fp, "%s\n%.3f\n", brand, rate);
+		fclose(fp);
+	    }
+	}
+    }
+    if (verbose)
+	printf("TSC rate = %.1f MHz (from %s)\n", rate, source);
+    return rate;
 }
 
 /* Record the current value of the cycle counter. */
 void start_counter()
 {
-    access_counter(&cyc_hi, &cyc_lo);
+    cyc_start = read_counter();
 }
 
 /* Return the number of cycles since the last call to start_counter. */
 double get_counter()
 {
-    unsigned ncyc_hi, ncyc_lo;
-    unsigned hi, lo, borrow;
-    double result;
-
-    /* Get cycle counter */
-    access_counter(&ncyc_hi, &ncyc_lo);
-
-    /* Do double precision subtraction */
-    lo = ncyc_lo - cyc_lo;
-    borrow = lo > ncyc_lo;
-    hi = ncyc_hi - cyc_hi - borrow;
-    result = (double) hi * (1 << 30) * 4 + lo;
-    if (result < 0) {
-	fprintf(stderr, "Error: counter returns neg value: %.0f\n", result);
-    }
-    return result;
+    return (double)(read_counter() - cyc_start);
 }
-/* $end x86cyclecounter */
 
 #elif defined(__alpha)
 
@@ -133,30 +332,37 @@ double get_counter()
     return result;
 }
 
+/* The Alpha exposes no rate, so measure it */
+static double counter_mhz(int verbose)
+{
+    return mhz_full(verbose, 2);
+}
+
 #else
 
 /****************************************************************
  * All the other platforms for which we haven't implemented cycle
- * counter routines. Newer models of sparcs (v8plus) have cycle
- * counters that can be accessed from user programs, but since there
- * are still many sparc boxes out there that don't support this, we
- * haven't provided a Sparc version here.
+ * counter routines count nanoseconds of CLOCK_MONOTONIC_RAW instead,
+ * which looks like a 1000 MHz cycle counter to the callers.
  ***************************************************************/
 
+static uint64_t cyc_start = 0;
+
+static double counter_mhz(int verbose)
+{
+    if (verbose)
+	printf("Timing with CLOCK_MONOTONIC_RAW\n");
+    return 1000.0;
+}
+
 void start_counter()
 {
-    printf("ERROR: You are trying to use a start_counter routine in clock.c\n");
-    printf("that has not been implemented yet on this platform.\n");
-    printf("Please choose another timing package in config.h.\n");
-    exit(1);
+    cyc_start = mono_ns();
 }
 
 double get_counter() 
 {
-    printf("ERROR: You are trying to use a get_counter routine in clock.c\n");
-    printf("that has not been implemented yet on this platform.\n");
-    printf("Please choose another timing package in config.h.\n");
-    exit(1);
+    return (double)(mono_ns() - cyc_start);
 }
 #endif
 
@@ -195,10 +401,19 @@ double mhz_full(int verbose, int sleeptime)
 }
 /* $end mhz */
 
-/* Version using a default sleeptime */
+/* 
+ * Fast version: the counter's rate as reported by the platform, 
+ * computed once. mhz_full remains for a sleep-based cross-check.
+ */
 double mhz(int verbose)
 {
-    return mhz_full(verbose, 2);
+    static double rate = 0.0;
+
+    if (rate == 0.0)
+	rate = counter_mhz(verbose);
+    else if (verbose)
+	printf("Counter rate = %.1f MHz\n", rate);
+    return rate;
 }
 
 /** Special counters that compensate for timer interrupt overhead */
@@ -35,15 +35,16 @@
   "realloc2-bal.rep"
 
 /*
- * This constant gives the estimated performance of the libc malloc
- * package using our traces on some reference system, typically the
- * same kind of system the students use. Its purpose is to cap the
- * contribution of throughput to the performance index. Once the
- * students surpass the AVG_LIBC_THRUPUT, they get no further benefit
- * to their score.  This deters students from building extremely fast,
- * but extremely stupid malloc packages.
+ * The throughput term of the performance index is capped at the
+ * throughput of the libc malloc package on the same traces and the
+ * same machine, so students get no further benefit from being faster
+ * than libc. This deters students from building extremely fast, but
+ * extremely stupid malloc packages. mdriver measures libc at startup
+ * and caches the result in THRUPUT_CACHE (in the current directory),
+ * keyed by host, cache regime and trace set; -R remeasures and -c sets
+ * a fixed cap instead (the old reference system was 1000 Kops/sec).
  */
-#define AVG_LIBC_THRUPUT      1000E3  /* 1000 Kops/sec */
+#define THRUPUT_CACHE ".mdriver-thruput"
 
  /* 
   * This constant determines the contributions of space utilization
@@ -62,10 +63,17 @@
  */
 #define MAX_HEAP (20*(1<<20))  /* 20 MB */
 
+/*
+ * Address space reserved for the heap when memlib is built with
+ * MEMLIB_OS for libmm.so. Pages are only backed by memory once they
+ * are touched.
+ */
+#define OS_MAX_HEAP ((size_t)1 << (sizeof(void *) == 8 ? 36 : 30))
+
 /*****************************************************************************
  * Set exactly one of these USE_xxx constants to "1" to select a timing method
  *****************************************************************************/
-#define USE_FCYC   1   /* cycle counter w/K-best scheme (x86 & Alpha only) */
+#define USE_FCYC   1   /* cycle counter w/K-best scheme (any Unix box) */
 #define USE_ITIMER 0   /* interval timer (any Unix box) */
 #define USE_GETTOD 0   /* gettimeofday (any Unix box) */
 
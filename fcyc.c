@@ -8,6 +8,8 @@
  * the time in CPU cycles for a function f.
  */
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include <sys/times.h>
 #include <stdio.h>
 
@@ -20,21 +22,23 @@
 #define EPSILON 0.01         /* K samples should be EPSILON of each other*/
 #define COMPENSATE 0         /* 1-> try to compensate for clock ticks */
 #define CLEAR_CACHE 0        /* Clear cache before running test function */
-#define CACHE_BYTES (1<<19)  /* Max cache size in bytes */
-#define CACHE_BLOCK 32       /* Cache block size in bytes */
+#define CACHE_BYTES (1<<19)  /* Cache size if it can't be determined */
+#define CACHE_BLOCK 32       /* Cache block size if it can't be determined */
+#define CACHE_SCALE 2        /* Clear this many times the largest cache */
 
 static int kbest = K;
 static int maxsamples = MAXSAMPLES;
 static double epsilon = EPSILON;
 static int compensate = COMPENSATE;
 static int clear_cache = CLEAR_CACHE;
-static int cache_bytes = CACHE_BYTES;
-static int cache_block = CACHE_BLOCK;
+static int cache_bytes = 0;  /* 0 until set or read from the system */
+static int cache_block = 0;
 
 static int *cache_buf = NULL;
 
 static double *values = NULL;
 static int samplecount = 0;
+static double spread = 0.0;  /* relative spread of the last K-best set */
 
 /* for debugging only */
 #define KEEP_VALS 0
@@ -97,6 +101,75 @@ static int has_converged()
 	((1 + epsilon)*values[0] >= values[kbest-1]);
 }
 
+/*
+ * sysfs_cache - Read the size (in bytes) of the largest cache, and its
+ *     line size, from /sys/devices/system/cpu/cpu0/cache. Leaves the
+ *     values alone if there is no such directory.
+ */
+static void sysfs_cache(long *size, long *line)
+{
+    char path[128], unit;
+    long level, best = 0, val;
+    FILE *fp;
+    int i;
+
+    for (i = 0; ; i++) {
+	sprintf(path, "/sys/devices/system/cpu/cpu0/cache/index%d/level", i);
+	if ((fp = fopen(path, "r")) == NULL)
+	    break;
+	if (fscanf(fp, "%ld", &level) != 1)
+	    level = 0;
+	fclose(fp);
+	sprintf(path, "/sys/devices/system/cpu/cpu0/cache/index%d/size", i);
+	if ((fp = fopen(path, "r")) == NULL)
+	    continue;
+	unit = 'B';
+	if (fscanf(fp, "%ld%c", &val, &unit) < 1)
+	    val = 0;
+	fclose(fp);
+	if (unit == 'K')
+	    val <<= 10;
+	else if (unit == 'M')
+	    val <<= 20;
+	if (level >= best && val > 0) {
+	    best = level;
+	    *size = val;
+	}
+	sprintf(path, "/sys/devices/system/cpu/cpu0/cache/index%d/"
+		"coherency_line_size", i);
+	if ((fp = fopen(path, "r")) != NULL) {
+	    if (fscanf(fp, "%ld", &val) == 1 && val > 0)
+		*line = val;
+	    fclose(fp);
+	}
+    }
+}
+
+/*
+ * cache_geometry - Fill in whichever of cache_bytes and cache_block 
+ *     weren't set, from sysconf, then sysfs, then the defaults. The 
+ *     buffer is CACHE_SCALE times the largest cache, since caches are
+ *     not strictly LRU and one pass of exactly their size leaves lines 
+ *     behind.
+ */
+static void cache_geometry(void)
+{
+    long size = 0, line = 0;
+
+#ifdef _SC_LEVEL1_DCACHE_LINESIZE
+    if ((size = sysconf(_SC_LEVEL3_CACHE_SIZE)) <= 0 &&
+	(size = sysconf(_SC_LEVEL2_CACHE_SIZE)) <= 0)
+	size = sysconf(_SC_LEVEL1_DCACHE_SIZE);
+    line = sysconf(_SC_LEVEL1_DCACHE_LINESIZE);
+#endif
+    if (size <= 0 || line <= 0)
+	sysfs_cache(&size, &line);
+    if (cache_bytes == 0)
+	cache_bytes = (size > 0) ? CACHE_SCALE * size : CACHE_BYTES;
+    if (cache_block == 0)
+	cache_block = (line > 0) ? line : CACHE_BLOCK;
+}
+
 /* 
  * clear - Code to clear cache 
  */
@@ -106,7 +179,11 @@ static void clear()
 {
     int x = sink;
     int *cptr, *cend;
-    int incr = cache_block/sizeof(int);
+    int incr;
+
+    if (cache_bytes == 0 || cache_block == 0)
+	cache_geometry();
+    incr = cache_block/sizeof(int);
     if (!cache_buf) {
 	cache_buf = malloc(cache_bytes);
 	if (!cache_buf) {
@@ -160,6 +237,8 @@ double fcyc(test_funct f, void *argp)
     }
 #endif
     result = values[0];
+    spread = (values[0] > 0 && samplecount >= kbest) ?
+	(values[kbest-1] - values[0]) / values[0] : 0.0;
 #if !KEEP_VALS
     free(values); 
     values = NULL;
@@ -168,6 +247,37 @@ double fcyc(test_funct f, void *argp)
 }
 
 
+/*
+ * fcyc_clear_cache - Evict the caches now, as fcyc does before each 
+ *     sample when clearing is enabled
+ */
+void fcyc_clear_cache(void)
+{
+    clear();
+}
+
+/*
+ * fcyc_cache_geometry - Bytes and block size clear() uses, determined
+ *     from the system unless they were set explicitly
+ */
+void fcyc_cache_geometry(int *bytes, int *block)
+{
+    if (cache_bytes == 0 || cache_block == 0)
+	cache_geometry();
+    *bytes = cache_bytes;
+    *block = cache_block;
+}
+
+/*
+ * fcyc_spread - Relative spread (kth best / best - 1) of the K-best
+ *     samples from the most recent call to fcyc. Stays within epsilon
+ *     when the measurement converged, and is larger when it did not.
+ */
+double fcyc_spread(void)
+{
+    return spread;
+}
+
 /*************************************************************
  * Set the various parameters used by the measurement routines 
  ************************************************************/
@@ -184,7 +294,8 @@ void set_fcyc_clear_cache(int clear)
 
 /* 
  * set_fcyc_cache_size - Set size of cache to use when clearing cache 
- *     Default = 1<<19 (512KB)
+ *     Default = twice the largest cache reported by the system, 
+ *     else 1<<19 (512KB)
  */
 void set_fcyc_cache_size(int bytes)
 {
@@ -199,7 +310,7 @@ void set_fcyc_cache_size(int bytes)
 
 /* 
  * set_fcyc_cache_block - Set size of cache block 
- *     Default = 32
+ *     Default = the line size reported by the system, else 32
  */
 void set_fcyc_cache_block(int bytes) {
     cache_block = bytes;
@@ -13,6 +13,15 @@ typedef void (*test_funct)(void *);
 /* Compute number of cycles used by test function f */
 double fcyc(test_funct f, void* argp);
 
+/* Relative spread of the K-best samples behind the last fcyc result */
+double fcyc_spread(void);
+
+/* Evict the caches the way fcyc does before each sample */
+void fcyc_clear_cache(void);
+
+/* Buffer size and stride used to evict the caches */
+void fcyc_cache_geometry(int *bytes, int *block);
+
 /*********************************************************
  * Set the various parameters used by measurement routines 
  *********************************************************/
@@ -26,13 +35,14 @@ void set_fcyc_clear_cache(int clear);
 
 /* 
  * set_fcyc_cache_size - Set size of cache to use when clearing cache 
- *     Default = 1<<19 (512KB)
+ *     Default = twice the largest cache reported by the system, 
+ *     else 1<<19 (512KB)
  */
 void set_fcyc_cache_size(int bytes);
 
 /* 
  * set_fcyc_cache_block - Set size of cache block 
- *     Default = 32
+ *     Default = the line size reported by the system, else 32
  */
 void set_fcyc_cache_block(int bytes);
 
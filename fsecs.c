@@ -54,4 +54,15 @@ double fsecs(fsecs_test_funct f, void *argp)
 #endif 
 }
 
-
+/*
+ * fsecs_noise - Return the relative measurement noise of the last call
+ *     to fsecs, or 0 if the timing method does not estimate it
+ */
+double fsecs_noise(void)
+{
+#if USE_FCYC
+    return fcyc_spread();
+#else
+    return 0.0;
+#endif
+}
@@ -0,0 +1,347 @@
+/*
+ * gensizeclass.c - Choose size classes for mm.c from a set of traces
+ *
+ * Every alloc and realloc request in the traces is turned into the
+ * block size mm.c would use for it (payload plus header and footer,
+ * rounded up to the alignment, at least four tags), and the block sizes
+ * up to a maximum are counted. A block that goes in a size class is
+ * rounded up to the size of the class, so we choose the k class sizes
+ * that waste the fewest bytes over all those requests: the classes are
+ * weighted by how often each size is asked for, and a size nobody asks
+ * for costs nothing. With the sizes seen s[0] < ... < s[n-1] the best
+ * classes can always end at seen sizes, and waste[c][i], the least
+ * waste for s[0..i] in c+1 classes of which the last ends at s[i], is
+ *
+ *   waste[0][i] = cost(0, i)
+ *   waste[c][i] = min over j <= i of waste[c-1][j-1] + cost(j, i)
+ *
+ * where cost(j, i) is the waste of rounding s[j..i] up to s[i]. The
+ * last class always ends at the maximum, so every size up to it has a
+ * class.
+ *
+ * The result is written as a C header (sizeclass.h, see "make
+ * sizeclasses") with the class sizes and a table that maps a block
+ * size to its class in one lookup.
+ *
+ * Usage: gensizeclass [-h] [-k <classes>] [-m <max>] [-a <align>]
+ *                     [-t <tag>] [-o <file>] <trace>...
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+
+/**********************
+ * Constants and macros
+ **********************/
+
+#define MAXLINE      1024      /* longest request line in a trace */
+#define MAX_CLASSES  255       /* class numbers must fit the uint8_t table */
+#define MAX_MAX      (1<<16)   /* largest -m, keeps the lookup table small */
+#define HDR_BYTES    (2 * tag_bytes)  /* header and footer, as in mm.c */
+#define MIN_BLOCK    (4 * tag_bytes)  /* smallest block, as in mm.c */
+
+/* mm.c's tag size: 4, or 8 when it is built with -DMM_WIDE_TAGS (-t) */
+static int tag_bytes = 4;
+
+/*********************
+ * Function prototypes
+ *********************/
+static void read_trace(char *file, uint64_t *count, int align, int max);
+static void write_header(FILE *fp, int argc, char **argv, int *bound,
+			 int nclasses, uint64_t *count, int align, int max);
+static void usage(void);
+static void app_error(char *msg);
+
+/*
+ * block_size - The size of the block mm.c carves out for a request of
+ *    size bytes
+ */
+static int block_size(int size, int align)
+{
+    if (size <= HDR_BYTES)
+	return MIN_BLOCK;
+    return align * ((size + HDR_BYTES + align - 1) / align);
+}
+
+/*
+ * read_trace - Count the block size of every alloc (movable or not) and
+ *    realloc request in a trace that is no bigger than max
+ */
+static void read_trace(char *file, uint64_t *count, int align, int max)
+{
+    FILE *fp;
+    char line[MAXLINE], type;
+    unsigned id, size;
+    int hdr = 0, bsize;
+
+    if ((fp = fopen(file, "r")) == NULL) {
+	perror(file);
+	exit(1);
+    }
+    while (fgets(line, MAXLINE, fp) != NULL) {
+	/* The header is four numbers, one per line */
+	if (hdr < 4) {
+	    hdr++;
+	    continue;
+	}
+	if (sscanf(line, " %c %u %u", &type, &id, &size) != 3 ||
+	    (type != 'a' && type != 'r' && type != 'h'))
+	    continue;
+	/* A movable block keeps its handle in front of the payload */
+	if (type == 'h')
+	    size += align;
+	bsize = block_size(size, align);
+	if (bsize <= max)
+	    count[bsize / align]++;
+    }
+    fclose(fp);
+}
+
+/*
+ * choose - Run the dynamic program over the n sizes seen, s[0..n), with
+ *    freq[i] requests each. Fills in bound[] with the last index of each
+ *    class and returns the number of classes, at most k.
+ */
+static int choose(int *s, uint64_t *freq, int n, int k, int *bound)
+{
+    uint64_t *reqs, *bytes, *waste, best, w;
+    int *from, c, i, j;
+
+    if (k > n)
+	k = n;
+    reqs = calloc(n + 1, sizeof(uint64_t));   /* prefix sums of freq */
+    bytes = calloc(n + 1, sizeof(uint64_t));  /* ... and of freq * s */
+    waste = malloc((size_t)k * n * sizeof(uint64_t));
+    from = malloc((size_t)k * n * sizeof(int));
+    if (reqs == NULL || bytes == NULL || waste == NULL || from == NULL)
+	app_error("Out of memory in choose");
+
+    for (i = 0; i < n; i++) {
+	reqs[i + 1] = reqs[i] + freq[i];
+	bytes[i + 1] = bytes[i] + freq[i] * s[i];
+    }
+
+/* Bytes wasted by rounding s[j..i] up to s[i] */
+#define COST(j, i) ((uint64_t)s[i] * (reqs[(i) + 1] - reqs[j]) - \
+		    (bytes[(i) + 1] - bytes[j]))
+
+    for (i = 0; i < n; i++) {
+	waste[i] = COST(0, i);
+	from[i] = 0;
+    }
+    for (c = 1; c < k; c++) {
+	for (i = 0; i < n; i++) {
+	    /* No way to make c+1 classes out of fewer sizes */
+	    best = UINT64_MAX;
+	    from[c * n + i] = i;
+	    for (j = c; j <= i; j++) {
+		w = waste[(c - 1) * n + j - 1] + COST(j, i);
+		if (w < best) {
+		    best = w;
+		    from[c * n + i] = j;
+		}
+	    }
+	    waste[c * n + i] = best;
+	}
+    }
+
+    /* Walk back from the last size to find where each class starts */
+    for (c = k - 1, i = n - 1; c >= 0; c--) {
+	bound[c] = i;
+	i = from[c * n + i] - 1;
+    }
+
+    free(reqs);
+    free(bytes);
+    free(waste);
+    free(from);
+    return k;
+}
+
+/*
+ * write_header - Write the classes as sizeclass.h. bound[] holds the
+ *    size of each class in bytes.
+ */
+static void write_header(FILE *fp, int argc, char **argv, int *bound,
+			 int nclasses, uint64_t *count, int align, int max)
+{
+    uint64_t reqs, wasted, total_reqs = 0, total_wasted = 0, total = 0;
+    int c, i, size;
+
+    fprintf(fp, "/*\n * sizeclass.h - Size classes for mm.c, generated by "
+	    "gensizeclass. Don't\n * edit it: rerun \"make sizeclasses\" "
+	    "with the traces of the workload.\n *\n * Traces:");
+    for (i = 0; i < argc; i++)
+	fprintf(fp, "%s %s", (i % 2 == 0) ? "\n *  " : "", argv[i]);
+    fprintf(fp, "\n *\n * %5s %8s %12s %12s\n", "class", "size", "requests",
+	    "wasted");
+
+    /* Per class: the requests it takes and the bytes it rounds away */
+    for (c = 0, size = align; c < nclasses; c++) {
+	reqs = wasted = 0;
+	for (; size <= bound[c]; size += align) {
+	    reqs += count[size / align];
+	    wasted += count[size / align] * (bound[c] - size);
+	    total += count[size / align] * size;
+	}
+	fprintf(fp, " * %5d %8d %12llu %12llu\n", c, bound[c],
+		(unsigned long long)reqs, (unsigned long long)wasted);
+	total_reqs += reqs;
+	total_wasted += wasted;
+    }
+    fprintf(fp, " *\n * %llu requests up to %d bytes, %.2f%% of their "
+	    "block bytes wasted\n */\n",
+	    (unsigned long long)total_reqs, max,
+	    total ? 100.0 * total_wasted / (total + total_wasted) : 0.0);
+
+    fprintf(fp, "#ifndef __SIZECLASS_H_\n#define __SIZECLASS_H_\n\n");
+    fprintf(fp, "#include <stdint.h>\n\n");
+    fprintf(fp, "#define SIZE_CLASSES     %d\n", nclasses);
+    fprintf(fp, "#define SIZE_CLASS_ALIGN %d  /* block sizes are multiples "
+	    "of this */\n", align);
+    fprintf(fp, "#define SIZE_CLASS_MAX   %d  /* the largest block with a "
+	    "class */\n", max);
+    fprintf(fp, "#define SIZE_CLASS_TAG   %d  /* bytes per tag the sizes "
+	    "allow for */\n\n", tag_bytes);
+
+    fprintf(fp, "/* The block size of each class */\n");
+    fprintf(fp, "static const uint32_t size_class_size[SIZE_CLASSES] = {");
+    for (c = 0; c < nclasses; c++)
+	fprintf(fp, "%s%d%s", (c % 8 == 0) ? "\n    " : " ", bound[c],
+		(c < nclasses - 1) ? "," : "\n");
+    fprintf(fp, "};\n\n");
+
+    fprintf(fp, "/* The class of each block size, by size / SIZE_CLASS_ALIGN */\n");
+    fprintf(fp, "static const uint8_t size_class_lut[SIZE_CLASS_MAX / "
+	    "SIZE_CLASS_ALIGN + 1] = {");
+    for (size = 0, c = 0; size <= max; size += align) {
+	while (size > bound[c])
+	    c++;
+	fprintf(fp, "%s%d%s", (size / align % 16 == 0) ? "\n    " : " ", c,
+		(size < max) ? "," : "\n");
+    }
+    fprintf(fp, "};\n\n");
+
+    fprintf(fp, "/* The class of a block of sz bytes, sz <= SIZE_CLASS_MAX */\n");
+    fprintf(fp, "#define SIZE_CLASS(sz) (size_class_lut[((sz) + "
+	    "SIZE_CLASS_ALIGN - 1) / SIZE_CLASS_ALIGN])\n\n");
+    fprintf(fp, "#endif /* __SIZECLASS_H_ */\n");
+
+    fprintf(stderr, "gensizeclass: %d classes for %llu requests, %.2f%% "
+	    "of their block bytes wasted\n", nclasses,
+	    (unsigned long long)total_reqs,
+	    total ? 100.0 * total_wasted / (total + total_wasted) : 0.0);
+}
+
+int main(int argc, char **argv)
+{
+    int c, i, n, k = 32, max = 4096, align = 8, nclasses;
+    int *sizes, *bound;
+    uint64_t *count, *freq;
+    char *outfile = NULL;
+    FILE *fp = stdout;
+
+    while ((c = getopt(argc, argv, "k:m:a:t:o:h")) != EOF) {
+	switch (c) {
+	case 'k': /* Number of classes */
+	    k = atoi(optarg);
+	    break;
+	case 'm': /* Largest block size with a class */
+	    max = atoi(optarg);
+	    break;
+	case 'a': /* mm.c's ALIGNMENT */
+	    align = atoi(optarg);
+	    break;
+	case 't': /* mm.c's tag size */
+	    tag_bytes = atoi(optarg);
+	    break;
+	case 'o': /* Write the header here instead of stdout */
+	    outfile = optarg;
+	    break;
+	case 'h':
+	    usage();
+	    exit(0);
+	default:
+	    usage();
+	    exit(1);
+	}
+    }
+    if (optind == argc) {
+	usage();
+	exit(1);
+    }
+    if (k < 1 || k > MAX_CLASSES)
+	app_error("-k must be between 1 and 255");
+    if (tag_bytes != 4 && tag_bytes != 8)
+	app_error("-t must be 4 or 8");
+    if (align < 8 || (align & (align - 1)))
+	app_error("-a must be a power of two, at least 8");
+    if (max < MIN_BLOCK || max > MAX_MAX || max % align)
+	app_error("-m must be a multiple of -a between four tags and 65536");
+
+    if ((count = calloc(max / align + 1, sizeof(uint64_t))) == NULL ||
+	(freq = calloc(max / align + 1, sizeof(uint64_t))) == NULL ||
+	(sizes = calloc(max / align + 1, sizeof(int))) == NULL ||
+	(bound = calloc(k, sizeof(int))) == NULL)
+	app_error("Out of memory in main");
+
+    for (i = optind; i < argc; i++)
+	read_trace(argv[i], count, align, max);
+
+    /* The sizes seen, and the maximum so that the last class ends there */
+    for (n = 0, i = MIN_BLOCK / align; i <= max / align; i++) {
+	if (count[i] == 0 && i != max / align)
+	    continue;
+	sizes[n] = i * align;
+	freq[n++] = count[i];
+    }
+
+    /* From indices into sizes[] to class sizes in bytes */
+    nclasses = choose(sizes, freq, n, k, bound);
+    for (c = 0; c < nclasses; c++)
+	bound[c] = sizes[bound[c]];
+
+    if (outfile && (fp = fopen(outfile, "w")) == NULL) {
+	perror(outfile);
+	exit(1);
+    }
+    write_header(fp, argc - optind, argv + optind, bound, nclasses, count,
+		 align, max);
+    if (fp != stdout && fclose(fp) != 0) {
+	perror(outfile);
+	exit(1);
+    }
+    free(count);
+    free(freq);
+    free(sizes);
+    free(bound);
+    exit(0);
+}
+
+/*
+ * app_error - Report an arbitrary application error
+ */
+static void app_error(char *msg)
+{
+    fprintf(stderr, "gensizeclass: %s\n", msg);
+    exit(1);
+}
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(void)
+{
+    fprintf(stderr, "Usage: gensizeclass [-h] [-k <classes>] [-m <max>] "
+	    "[-a <align>] [-t <tag>]\n"
+	    "                    [-o <file>] <trace>...\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-a <align>    mm.c's ALIGNMENT (default 8).\n");
+    fprintf(stderr, "\t-h            Print this message.\n");
+    fprintf(stderr, "\t-k <classes>  Number of size classes (default 32).\n");
+    fprintf(stderr, "\t-m <max>      Largest block size with a class (default 4096).\n");
+    fprintf(stderr, "\t-o <file>     Write the header to <file> (default stdout).\n");
+    fprintf(stderr, "\t-t <tag>      mm.c's tag size, 8 with MM_WIDE_TAGS (default 4).\n");
+}
@@ -0,0 +1,599 @@
+/*
+ * gentrace.c - Generate synthetic malloc lab traces (.rep files)
+ *
+ * Each trace is a sequence of phases. A phase replays a given number
+ * of requests drawn from one size distribution and one lifetime model:
+ *
+ *   Size distributions
+ *     zipf       - a few small sizes are very popular, with a long tail
+ *     bimodal    - mostly small requests plus occasional large buffers
+ *     lognormal  - sizes clustered around a median with a heavy right tail
+ *
+ *   Lifetime models
+ *     lifo       - the most recently allocated block is freed first
+ *     fifo       - the oldest block is freed first
+ *     longtail   - every block gets a Pareto distributed lifetime
+ *
+ * Independently of the phase, a fraction of requests continue a realloc
+ * growth chain: one block that is repeatedly grown by 25-100% until it
+ * reaches MAX_CHAIN bytes, like a vector or string builder.
+ *
+ * With -M, a fraction of the blocks are allocated with 'h' instead of
+ * 'a': blocks the program reaches through mm's handles, which mdriver
+ * -z lets mm move. With -C, a 'c' line (a call to mm_compact) is put
+ * after every so many requests.
+ *
+ * The live set is steered towards a target number of live bytes, so
+ * traces of tens of millions of requests still fit in the driver's
+ * heap. Every block still live at the end of the last phase is freed,
+ * so the trace is balanced. The generator does not use rand(), so the
+ * same seed produces the same trace whatever the C library.
+ *
+ * Usage: gentrace -o <file> [-n <ops>] [-s <seed>] [-d <dist>]
+ *                 [-l <lifetime>] [-r <pct>] [-m <bytes>] [-P <phases>]
+ *                 [-M <pct>] [-C <ops>]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <errno.h>
+
+/**********************
+ * Constants and macros
+ **********************/
+
+#define MAXPHASES    64        /* max number of phases in -P */
+#define HDRWIDTH     20        /* width of each header field in the output */
+#define MAX_SIZE     (1<<20)   /* largest request the generator emits */
+
+#define ZIPF_SIZES   256       /* zipf: sizes 8, 16, ..., 8*ZIPF_SIZES */
+#define ZIPF_S       1.1       /* zipf: exponent */
+#define BI_LARGE     0.10      /* bimodal: fraction of large requests */
+#define BI_SMALL_LO  8         /* bimodal: small requests are uniform in */
+#define BI_SMALL_HI  64        /*   [BI_SMALL_LO, BI_SMALL_HI] */
+#define BI_LARGE_LO  1024      /* bimodal: large requests are uniform in */
+#define BI_LARGE_HI  16384     /*   [BI_LARGE_LO, BI_LARGE_HI] */
+#define LN_MEDIAN    64.0      /* lognormal: median request size */
+#define LN_SIGMA     1.0       /* lognormal: sigma of log(size) */
+#define PARETO_MIN   16.0      /* longtail: minimum lifetime in requests */
+#define PARETO_ALPHA 1.2       /* longtail: tail index */
+#define MAX_CHAIN    (1<<16)   /* realloc chains end at this many bytes */
+
+/**********************
+ * Data types
+ **********************/
+
+typedef enum {ZIPF, BIMODAL, LOGNORMAL} dist_t;
+typedef enum {LIFO, FIFO, LONGTAIL} life_t;
+
+/* One phase of the generated trace */
+typedef struct {
+    dist_t dist;         /* size distribution */
+    life_t life;         /* lifetime model */
+    long ops;            /* number of requests in this phase */
+} phase_t;
+
+/* A live block. The live set is a min-heap on key. */
+typedef struct {
+    double key;          /* lifo: -birth, fifo: birth, longtail: death */
+    int id;              /* trace id of the block */
+    int size;            /* payload size of the block */
+} block_t;
+
+/********************
+ * Global variables
+ *******************/
+
+static char *dist_names[] = {"zipf", "bimodal", "lognormal", NULL};
+static char *life_names[] = {"lifo", "fifo", "longtail", NULL};
+
+static unsigned long long rng_state;   /* xorshift64* state */
+static double zipf_cdf[ZIPF_SIZES];    /* cumulative zipf probabilities */
+
+static block_t *live = NULL;   /* min-heap of live blocks */
+static long num_live = 0;      /* number of blocks in the heap */
+static long max_live = 0;      /* allocated length of the heap */
+static long live_bytes = 0;    /* total payload bytes currently live */
+static long peak_bytes = 0;    /* high water mark of live_bytes */
+
+static FILE *out;              /* the trace being written */
+static int num_ids = 0;        /* ids handed out so far */
+static long num_ops = 0;       /* requests written so far */
+static double movable_frac = 0; /* share of blocks allocated with 'h' */
+static long compact_every = 0; /* requests between 'c' lines, 0 for none */
+
+/*********************
+ * Function prototypes
+ *********************/
+static void usage(void);
+static void app_error(char *msg);
+
+/*********************************************
+ * Random numbers. We use our own generator so
+ * that a seed gives the same trace with any
+ * C library.
+ *********************************************/
+
+/*
+ * rng_seed - Seed the generator, mixing the seed with splitmix64
+ */
+static void rng_seed(unsigned long long seed)
+{
+    unsigned long long z = seed + 0x9E3779B97F4A7C15ULL;
+
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    rng_state = (z ^ (z >> 31)) | 1;
+}
+
+/*
+ * rng_next - Return the next 64 random bits (xorshift64*)
+ */
+static unsigned long long rng_next(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+/*
+ * rng_uniform - Return a double uniformly distributed in [0, 1)
+ */
+static double rng_uniform(void)
+{
+    return (rng_next() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/*
+ * rng_range - Return an integer uniformly distributed in [lo, hi]
+ */
+static int rng_range(int lo, int hi)
+{
+    return lo + (int)(rng_uniform() * (hi - lo + 1));
+}
+
+/*
+ * rng_normal - Return a standard normal deviate (Box-Muller)
+ */
+static double rng_normal(void)
+{
+    double u1 = 1.0 - rng_uniform();   /* in (0, 1] so log() is finite */
+    double u2 = rng_uniform();
+
+    return sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+}
+
+/*********************************************
+ * Size distributions and lifetimes
+ *********************************************/
+
+/*
+ * init_zipf - Precompute the cumulative zipf distribution
+ */
+static void init_zipf(void)
+{
+    int r;
+    double sum = 0;
+
+    for (r = 0; r < ZIPF_SIZES; r++) {
+	sum += 1.0 / pow(r + 1, ZIPF_S);
+	zipf_cdf[r] = sum;
+    }
+    for (r = 0; r < ZIPF_SIZES; r++)
+	zipf_cdf[r] /= sum;
+}
+
+/*
+ * draw_size - Draw a request size from distribution dist
+ */
+static int draw_size(dist_t dist)
+{
+    double u, x;
+    int lo, hi, mid;
+
+    switch (dist) {
+    case ZIPF:
+	/* Binary search for the first rank whose cdf exceeds u */
+	u = rng_uniform();
+	lo = 0;
+	hi = ZIPF_SIZES - 1;
+	while (lo < hi) {
+	    mid = (lo + hi) / 2;
+	    if (zipf_cdf[mid] < u)
+		lo = mid + 1;
+	    else
+		hi = mid;
+	}
+	return 8 * (lo + 1);
+    case BIMODAL:
+	if (rng_uniform() < BI_LARGE)
+	    return rng_range(BI_LARGE_LO, BI_LARGE_HI);
+	return rng_range(BI_SMALL_LO, BI_SMALL_HI);
+    case LOGNORMAL:
+	x = exp(log(LN_MEDIAN) + LN_SIGMA * rng_normal());
+	if (x < 1)
+	    return 1;
+	return (x > MAX_SIZE) ? MAX_SIZE : (int)x;
+    }
+    return 0;
+}
+
+/*
+ * draw_key - Compute the heap key for a block born at request now.
+ *    The smallest key is freed first.
+ */
+static double draw_key(life_t life, long now)
+{
+    switch (life) {
+    case LIFO:
+	return -(double)now;
+    case FIFO:
+	return (double)now;
+    case LONGTAIL:
+	return now + PARETO_MIN / pow(1.0 - rng_uniform(), 1.0 / PARETO_ALPHA);
+    }
+    return 0;
+}
+
+/*********************************************
+ * The live set, kept as a binary min-heap
+ *********************************************/
+
+/*
+ * live_push - Add a block to the live set
+ */
+static void live_push(double key, int id, int size)
+{
+    long i = num_live++;
+    block_t b;
+
+    if (num_live > max_live) {
+	max_live = max_live ? 2*max_live : 1024;
+	if ((live = realloc(live, max_live * sizeof(block_t))) == NULL)
+	    app_error("realloc failed in live_push");
+    }
+
+    b.key = key;
+    b.id = id;
+    b.size = size;
+    while (i > 0 && live[(i-1)/2].key > key) {
+	live[i] = live[(i-1)/2];
+	i = (i-1)/2;
+    }
+    live[i] = b;
+}
+
+/*
+ * live_pop - Remove and return the block with the smallest key
+ */
+static block_t live_pop(void)
+{
+    block_t top = live[0];
+    block_t last = live[--num_live];
+    long i = 0, child;
+
+    while ((child = 2*i + 1) < num_live) {
+	if (child + 1 < num_live && live[child+1].key < live[child].key)
+	    child++;
+	if (live[child].key >= last.key)
+	    break;
+	live[i] = live[child];
+	i = child;
+    }
+    live[i] = last;
+    return top;
+}
+
+/*********************************************
+ * Writing the trace
+ *********************************************/
+
+/*
+ * emit_alloc - Write an allocation request and return its id
+ */
+static int emit_alloc(int size)
+{
+    /* Only draw when -M asks for it, so old seeds give the same traces */
+    fprintf(out, "%c %d %d\n", 
+	    (movable_frac > 0 && rng_uniform() < movable_frac) ? 'h' : 'a',
+	    num_ids, size);
+    num_ops++;
+    live_bytes += size;
+    if (live_bytes > peak_bytes)
+	peak_bytes = live_bytes;
+    return num_ids++;
+}
+
+/*
+ * emit_realloc - Write a realloc request resizing id from oldsize to size
+ */
+static void emit_realloc(int id, int oldsize, int size)
+{
+    fprintf(out, "r %d %d\n", id, size);
+    num_ops++;
+    live_bytes += size - oldsize;
+    if (live_bytes > peak_bytes)
+	peak_bytes = live_bytes;
+}
+
+/*
+ * emit_free - Write a free request for a block of size bytes
+ */
+static void emit_free(int id, int size)
+{
+    fprintf(out, "f %d\n", id);
+    num_ops++;
+    live_bytes -= size;
+}
+
+/*
+ * emit_compact - Write a compaction point
+ */
+static void emit_compact(void)
+{
+    fprintf(out, "c\n");
+    num_ops++;
+}
+
+/*
+ * write_header - Write the four header fields, each padded to HDRWIDTH
+ *    characters so that they can be rewritten in place at the end.
+ */
+static void write_header(long heapsize, long ids, long ops)
+{
+    fprintf(out, "%-*ld\n%-*ld\n%-*ld\n%-*d\n", HDRWIDTH, heapsize,
+	    HDRWIDTH, ids, HDRWIDTH, ops, HDRWIDTH, 1);
+}
+
+/*********************************************
+ * The generator
+ *********************************************/
+
+/*
+ * run_phase - Generate the requests of one phase, steering the live set
+ *    towards target live bytes. realloc_frac of the requests grow the
+ *    current realloc chain.
+ */
+static void run_phase(phase_t *phase, long target, double realloc_frac,
+		      block_t *chain)
+{
+    long start = num_ops;
+    double p_alloc;
+    block_t b;
+    int size;
+
+    while (num_ops - start < phase->ops) {
+	if (compact_every > 0 && (num_ops + 1) % (compact_every + 1) == 0) {
+	    emit_compact();
+	    continue;
+	}
+
+	/* Grow the realloc chain, starting a new one if needed */
+	if (realloc_frac > 0 && rng_uniform() < realloc_frac) {
+	    if (chain->id < 0) {
+		chain->size = draw_size(phase->dist);
+		chain->id = emit_alloc(chain->size);
+		if (chain->size >= MAX_CHAIN) {
+		    live_push(draw_key(phase->life, num_ops), chain->id,
+			      chain->size);
+		    chain->id = -1;
+		}
+		continue;
+	    }
+	    size = chain->size + chain->size / 4 +
+		(int)(rng_uniform() * (3 * chain->size / 4)) + 1;
+	    emit_realloc(chain->id, chain->size, size);
+	    chain->size = size;
+	    if (size >= MAX_CHAIN) {
+		/* The chain is finished: it now lives like any other block */
+		live_push(draw_key(phase->life, num_ops), chain->id, size);
+		chain->id = -1;
+	    }
+	    continue;
+	}
+
+	/* Longtail blocks die when their lifetime runs out */
+	if (phase->life == LONGTAIL && num_live > 0 && live[0].key <= num_ops) {
+	    b = live_pop();
+	    emit_free(b.id, b.size);
+	    continue;
+	}
+
+	/* Otherwise allocate with a probability that falls as the live
+	   set approaches the target, so live bytes hover around it */
+	p_alloc = 1.0 - 0.5 * (double)live_bytes / target;
+	if (p_alloc < 0.05)
+	    p_alloc = 0.05;
+	if (num_live == 0 || rng_uniform() < p_alloc) {
+	    size = draw_size(phase->dist);
+	    live_push(draw_key(phase->life, num_ops), emit_alloc(size), size);
+	} else {
+	    b = live_pop();
+	    emit_free(b.id, b.size);
+	}
+    }
+}
+
+/*
+ * parse_name - Return the index of name in the NULL terminated names
+ *    array, or exit with an error
+ */
+static int parse_name(char *name, char **names, char *what)
+{
+    int i;
+    char msg[256];
+
+    for (i = 0; names[i]; i++)
+	if (!strcmp(name, names[i]))
+	    return i;
+    sprintf(msg, "Unknown %s '%.100s'", what, name);
+    app_error(msg);
+    return -1;
+}
+
+/*
+ * parse_phases - Parse a phase list dist:life:ops[,dist:life:ops...]
+ *    into phases and return the number of phases
+ */
+static int parse_phases(char *spec, phase_t *phases)
+{
+    int n = 0;
+    char *tok, *dist, *life, *ops;
+
+    for (tok = strtok(spec, ","); tok; tok = strtok(NULL, ",")) {
+	if (n == MAXPHASES)
+	    app_error("Too many phases in -P");
+	dist = tok;
+	if ((life = strchr(dist, ':')) == NULL ||
+	    (ops = strchr(life + 1, ':')) == NULL)
+	    app_error("Phases must be given as dist:lifetime:ops");
+	*life++ = '\0';
+	*ops++ = '\0';
+	phases[n].dist = parse_name(dist, dist_names, "size distribution");
+	phases[n].life = parse_name(life, life_names, "lifetime model");
+	phases[n].ops = atol(ops);
+	if (phases[n].ops <= 0)
+	    app_error("Each phase needs a positive number of ops");
+	n++;
+    }
+    return n;
+}
+
+int main(int argc, char **argv)
+{
+    int c, i, nphases = 0;
+    char *outfile = NULL;
+    char *phasespec = NULL;
+    unsigned long long seed = 1;
+    long target = 1<<20;
+    double realloc_frac = 0.0;
+    phase_t phases[MAXPHASES];
+    block_t chain, b;
+
+    phases[0].dist = ZIPF;
+    phases[0].life = LIFO;
+    phases[0].ops = 100000;
+
+    while ((c = getopt(argc, argv, "o:n:s:d:l:r:m:P:M:C:h")) != EOF) {
+	switch (c) {
+	case 'o': /* Output file */
+	    outfile = optarg;
+	    break;
+	case 'n': /* Number of requests (single phase) */
+	    phases[0].ops = atol(optarg);
+	    break;
+	case 's': /* Random seed */
+	    seed = strtoull(optarg, NULL, 0);
+	    break;
+	case 'd': /* Size distribution (single phase) */
+	    phases[0].dist = parse_name(optarg, dist_names, "size distribution");
+	    break;
+	case 'l': /* Lifetime model (single phase) */
+	    phases[0].life = parse_name(optarg, life_names, "lifetime model");
+	    break;
+	case 'r': /* Percentage of requests that grow a realloc chain */
+	    realloc_frac = atof(optarg) / 100.0;
+	    break;
+	case 'm': /* Target live bytes */
+	    target = atol(optarg);
+	    break;
+	case 'P': /* Phase list, overrides -n, -d and -l */
+	    phasespec = optarg;
+	    break;
+	case 'M': /* Percentage of blocks that are movable */
+	    movable_frac = atof(optarg) / 100.0;
+	    break;
+	case 'C': /* Requests between compaction points */
+	    compact_every = atol(optarg);
+	    break;
+	case 'h':
+	    usage();
+	    exit(0);
+	default:
+	    usage();
+	    exit(1);
+	}
+    }
+
+    if (outfile == NULL) {
+	usage();
+	exit(1);
+    }
+    if (target <= 0 || realloc_frac < 0 || realloc_frac >= 1 ||
+	phases[0].ops <= 0)
+	app_error("-m, -r and -n must be positive, and -r below 100");
+    if (movable_frac < 0 || movable_frac > 1 || compact_every < 0)
+	app_error("-M must be a percentage and -C non-negative");
+    nphases = phasespec ? parse_phases(phasespec, phases) : 1;
+
+    /* The header is rewritten at the end, so we need a seekable file */
+    if ((out = fopen(outfile, "w")) == NULL) {
+	perror(outfile);
+	exit(1);
+    }
+    write_header(0, 0, 0);
+
+    rng_seed(seed);
+    init_zipf();
+    chain.id = -1;
+    for (i = 0; i < nphases; i++)
+	run_phase(&phases[i], target, realloc_frac, &chain);
+
+    /* Free everything that is still live so the trace is balanced */
+    if (chain.id >= 0)
+	emit_free(chain.id, chain.size);
+    while (num_live > 0) {
+	b = live_pop();
+	emit_free(b.id, b.size);
+    }
+
+    if (fseek(out, 0, SEEK_SET) < 0) {
+	perror(outfile);
+	exit(1);
+    }
+    write_header(peak_bytes, num_ids, num_ops);
+    if (fclose(out) != 0) {
+	perror(outfile);
+	exit(1);
+    }
+
+    printf("%s: %ld ops, %d ids, peak live %ld bytes\n",
+	   outfile, num_ops, num_ids, peak_bytes);
+    free(live);
+    exit(0);
+}
+
+/*
+ * app_error - Report an arbitrary application error
+ */
+static void app_error(char *msg)
+{
+    fprintf(stderr, "gentrace: %s\n", msg);
+    exit(1);
+}
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(void)
+{
+    fprintf(stderr, "Usage: gentrace -o <file> [-h] [-n <ops>] [-s <seed>] "
+	    "[-d <dist>] [-l <lifetime>]\n"
+	    "                [-r <pct>] [-m <bytes>] [-P <phases>] [-M <pct>] "
+	    "[-C <ops>]\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-C <ops>       Put a compaction point after every <ops> requests.\n");
+    fprintf(stderr, "\t-d <dist>      Size distribution: zipf, bimodal or lognormal.\n");
+    fprintf(stderr, "\t-h             Print this message.\n");
+    fprintf(stderr, "\t-l <lifetime>  Lifetime model: lifo, fifo or longtail.\n");
+    fprintf(stderr, "\t-m <bytes>     Target live bytes (default 1048576).\n");
+    fprintf(stderr, "\t-M <pct>       Percentage of blocks allocated movable ('h').\n");
+    fprintf(stderr, "\t-n <ops>       Number of requests before the final frees.\n");
+    fprintf(stderr, "\t-o <file>      Write the trace to <file>.\n");
+    fprintf(stderr, "\t-P <phases>    Phases as dist:lifetime:ops[,...]; overrides -d, -l, -n.\n");
+    fprintf(stderr, "\t-r <pct>       Percentage of requests that grow a realloc chain.\n");
+    fprintf(stderr, "\t-s <seed>      Random seed (default 1).\n");
+}
@@ -0,0 +1,246 @@
+/*
+ * heapanalyze.c - Summarize the heap snapshots written by mdriver -d
+ *
+ * A snapshot file holds mm_snaphdr_t records (see mm.h), each followed
+ * by the headers of every block in the heap. For each snapshot we print
+ *
+ *   - the heap size, the live payload bytes and their ratio
+ *   - the number of blocks and of free blocks, the free bytes and the
+ *     largest free block
+ *   - the external fragmentation, 1 - largest free / free bytes: the
+ *     share of free memory that one request cannot get at
+ *   - a histogram of free block sizes by power of two
+ *   - an occupancy map of the heap, one character per equal slice of
+ *     the address space, showing how much of the slice is allocated
+ *
+ * Usage: heapanalyze [-hs] [-t <trace>] [-w <cols>] [-r <rows>] <file>
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mm.h"
+
+/**********************
+ * Constants and macros
+ **********************/
+
+#define NUM_CLASSES  32        /* free block size classes, 2^k..2^(k+1)-1 */
+#define MAX_COLS     256       /* widest occupancy map */
+#define MAX_ROWS     256       /* tallest occupancy map */
+
+#define TAG_SIZE(t)  ((t) & ~0x7)
+#define TAG_ALLOC(t) ((t) & 0x1)
+
+/* Occupancy map characters, from an empty slice to a full one */
+static char shades[] = " .-+*#";
+#define NUM_SHADES   (sizeof(shades) - 1)
+
+/*********************
+ * Function prototypes
+ *********************/
+static void analyze(mm_snaphdr_t *hdr, uint32_t *tags, int cols, int rows,
+		    int summary);
+static void usage(void);
+static void app_error(char *msg);
+
+/*
+ * size_class - The power-of-two class of a block of size bytes
+ */
+static int size_class(size_t size)
+{
+    int k = 0;
+
+    while (k < NUM_CLASSES - 1 && (size >> (k + 1)) != 0)
+	k++;
+    return k;
+}
+
+/*
+ * print_map - Print the occupancy map: the heap is cut into cols*rows
+ *    equal slices and each is drawn with the shade of the fraction of
+ *    its bytes that lie in allocated blocks
+ */
+static void print_map(mm_snaphdr_t *hdr, uint32_t *tags, int cols, int rows)
+{
+    static double used[MAX_COLS * MAX_ROWS];
+    int ncells = cols * rows, c, s;
+    double cell = (double)hdr->heap_size / ncells;
+    double lo, hi, start, end;
+    uint32_t i;
+
+    memset(used, 0, ncells * sizeof(double));
+    start = hdr->first;
+    for (i = 0; i < hdr->nblocks; i++) {
+	end = start + TAG_SIZE(tags[i]);
+	if (TAG_ALLOC(tags[i])) {
+	    for (c = start / cell; c < ncells && c * cell < end; c++) {
+		lo = (start > c * cell) ? start : c * cell;
+		hi = (end < (c + 1) * cell) ? end : (c + 1) * cell;
+		used[c] += hi - lo;
+	    }
+	}
+	start = end;
+    }
+
+    printf("  occupancy, %.0f bytes per character ('%c' free .. '%c' "
+	   "allocated):\n", cell, shades[0], shades[NUM_SHADES - 1]);
+    for (c = 0; c < ncells; c++) {
+	if (c % cols == 0)
+	    printf("  |");
+	s = used[c] / cell * (NUM_SHADES - 1) + 0.999;
+	if (s >= (int)NUM_SHADES)
+	    s = NUM_SHADES - 1;
+	putchar(shades[s]);
+	if (c % cols == cols - 1)
+	    printf("|\n");
+    }
+}
+
+/*
+ * analyze - Print the statistics for one snapshot
+ */
+static void analyze(mm_snaphdr_t *hdr, uint32_t *tags, int cols, int rows,
+		    int summary)
+{
+    size_t nfree = 0, free_bytes = 0, largest = 0, size, walked = 0;
+    size_t count[NUM_CLASSES], bytes[NUM_CLASSES];
+    uint32_t i;
+    int k;
+
+    memset(count, 0, sizeof(count));
+    memset(bytes, 0, sizeof(bytes));
+    for (i = 0; i < hdr->nblocks; i++) {
+	size = TAG_SIZE(tags[i]);
+	walked += size;
+	if (TAG_ALLOC(tags[i]))
+	    continue;
+	nfree++;
+	free_bytes += size;
+	if (size > largest)
+	    largest = size;
+	k = size_class(size);
+	count[k]++;
+	bytes[k] += size;
+    }
+    if (hdr->first + walked > hdr->heap_size)
+	fprintf(stderr, "heapanalyze: trace %u op %u: blocks run past the "
+		"end of the heap\n", hdr->trace, hdr->opnum);
+
+    printf("trace %u, op %u: heap %lu bytes, live %lu (%.1f%%), "
+	   "%u blocks, %lu free\n", hdr->trace, hdr->opnum,
+	   (unsigned long)hdr->heap_size, (unsigned long)hdr->live,
+	   hdr->heap_size ? 100.0 * hdr->live / hdr->heap_size : 0.0,
+	   hdr->nblocks, (unsigned long)nfree);
+    printf("  free bytes %lu, largest free block %lu, external "
+	   "fragmentation %.1f%%\n", (unsigned long)free_bytes,
+	   (unsigned long)largest,
+	   free_bytes ? 100.0 * (1.0 - (double)largest / free_bytes) : 0.0);
+    if (summary)
+	return;
+
+    if (nfree > 0) {
+	printf("  %-23s%10s%12s\n", "free blocks by size", "count", "bytes");
+	for (k = 0; k < NUM_CLASSES; k++) {
+	    if (count[k] == 0)
+		continue;
+	    printf("    %10lu-%-10lu%10lu%12lu\n", 1UL << k,
+		   (2UL << k) - 1, (unsigned long)count[k],
+		   (unsigned long)bytes[k]);
+	}
+    }
+    if (hdr->heap_size > 0)
+	print_map(hdr, tags, cols, rows);
+}
+
+int main(int argc, char **argv)
+{
+    int c, cols = 64, rows = 4, summary = 0, trace = -1;
+    FILE *fp;
+    mm_snaphdr_t hdr;
+    uint32_t *tags = NULL;
+    uint32_t max_tags = 0;
+    int nsnaps = 0;
+
+    while ((c = getopt(argc, argv, "t:w:r:sh")) != EOF) {
+	switch (c) {
+	case 't': /* Only this trace */
+	    trace = atoi(optarg);
+	    break;
+	case 'w': /* Occupancy map width */
+	    cols = atoi(optarg);
+	    break;
+	case 'r': /* Occupancy map height */
+	    rows = atoi(optarg);
+	    break;
+	case 's': /* Two summary lines per snapshot, no histogram or map */
+	    summary = 1;
+	    break;
+	case 'h':
+	    usage();
+	    exit(0);
+	default:
+	    usage();
+	    exit(1);
+	}
+    }
+    if (optind != argc - 1) {
+	usage();
+	exit(1);
+    }
+    if (cols < 1 || cols > MAX_COLS || rows < 1 || rows > MAX_ROWS)
+	app_error("-w and -r must be between 1 and 256");
+
+    if ((fp = fopen(argv[optind], "r")) == NULL) {
+	perror(argv[optind]);
+	exit(1);
+    }
+    while (fread(&hdr, sizeof(hdr), 1, fp) == 1) {
+	if (hdr.magic != MM_SNAP_MAGIC)
+	    app_error("Not a heap snapshot file, or a damaged one");
+	if (hdr.nblocks > max_tags) {
+	    max_tags = hdr.nblocks;
+	    if ((tags = realloc(tags, max_tags * sizeof(uint32_t))) == NULL)
+		app_error("realloc failed in main");
+	}
+	if (fread(tags, sizeof(uint32_t), hdr.nblocks, fp) != hdr.nblocks)
+	    app_error("Snapshot cut short");
+	if (trace >= 0 && hdr.trace != (uint32_t)trace)
+	    continue;
+	if (nsnaps++ > 0)
+	    printf("\n");
+	analyze(&hdr, tags, cols, rows, summary);
+    }
+    if (ferror(fp)) {
+	perror(argv[optind]);
+	exit(1);
+    }
+    fclose(fp);
+    free(tags);
+    exit(0);
+}
+
+/*
+ * app_error - Report an arbitrary application error
+ */
+static void app_error(char *msg)
+{
+    fprintf(stderr, "heapanalyze: %s\n", msg);
+    exit(1);
+}
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(void)
+{
+    fprintf(stderr, "Usage: heapanalyze [-hs] [-t <trace>] [-w <cols>] "
+	    "[-r <rows>] <file>\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-h          Print this message.\n");
+    fprintf(stderr, "\t-r <rows>   Rows in the occupancy map (default 4).\n");
+    fprintf(stderr, "\t-s          Only print the summary of each snapshot.\n");
+    fprintf(stderr, "\t-t <trace>  Only analyze snapshots of this trace.\n");
+    fprintf(stderr, "\t-w <cols>   Columns in the occupancy map (default 64).\n");
+}
@@ -0,0 +1,317 @@
+/*
+ * libmm.c - Exports the allocator in mm.c under the standard malloc
+ *     names so it can replace the C library's allocator in a real
+ *     program:
+ *
+ *     LD_PRELOAD=./libmm.so prog args...
+ *
+ * The heap comes from memlib built with MEMLIB_OS, which reserves
+ * OS_MAX_HEAP bytes of address space and lets the kernel back pages as
+ * they are touched. mm.c is not thread safe, so every call runs under
+ * one global lock, which is also taken around fork() so the child
+ * gets a consistent heap.
+ *
+ * The memalign family is replaced along with malloc: a block the C
+ * library allocated must never reach mm_free.
+ *
+ * A free() that finds the lock taken doesn't wait for it: the block goes
+ * on a lock-free list of remote frees, which whoever takes the lock next
+ * hands to mm_free in one batch. MM_REMOTE_FREE=0 makes free() wait for
+ * the lock instead, for comparison (see mtbench).
+ *
+ * mm's heap profile is written to the file named by MM_PROFILE when the
+ * program exits, and MM_PROFILE_RATE overrides the sampling rate:
+ *
+ *     MM_PROFILE=heap.prof LD_PRELOAD=./libmm.so prog args...
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <execinfo.h>
+
+#include "mm.h"
+#include "memlib.h"
+
+/* mm.c keeps block sizes in 32-bit tags; refuse anything close to that */
+#define MAX_REQUEST ((size_t)1 << 30)
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static int initialized = 0;
+
+static int lock_heap(void);
+
+/*
+ * The remote frees: a stack threaded through the first word of each
+ * block, pushed by any thread with compare-and-swap and emptied all at
+ * once with an exchange by the thread holding the lock. Since nothing
+ * is ever popped alone, a push can't be fooled by a head that was taken
+ * off and put back (the ABA problem).
+ */
+static void *remote_frees = NULL;
+static int remote_free_on = 1;
+
+static void push_remote(void *ptr)
+{
+    void *head = __atomic_load_n(&remote_frees, __ATOMIC_RELAXED);
+
+    do {
+	*(void **)ptr = head;
+    } while (!__atomic_compare_exchange_n(&remote_frees, &head, ptr, 1,
+					  __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/*
+ * drain_remote - Free every block on the remote list. Call with the lock
+ *     held.
+ */
+static void drain_remote(void)
+{
+    void *p, *next;
+
+    if (__atomic_load_n(&remote_frees, __ATOMIC_RELAXED) == NULL)
+	return;
+    p = __atomic_exchange_n(&remote_frees, NULL, __ATOMIC_ACQUIRE);
+    for (; p != NULL; p = next) {
+	next = *(void **)p;
+	mm_free(p);
+    }
+}
+
+/*
+ * The fork handlers hold the lock across fork() so that the child does
+ * not inherit a heap that another thread was halfway through changing
+ */
+static void fork_prepare(void)
+{
+    pthread_mutex_lock(&lock);
+}
+
+static void fork_parent(void)
+{
+    pthread_mutex_unlock(&lock);
+}
+
+static void fork_child(void)
+{
+    pthread_mutex_init(&lock, NULL);
+}
+
+/*
+ * Registering the handlers may itself call malloc, so it must not
+ * happen with the lock held. The same goes for the first backtrace(),
+ * which loads the unwinder, so we get that out of the way here rather
+ * than in the first profiling sample. The dynamic linker mallocs before
+ * we get here, so lock_heap leaves sampling off until now.
+ */
+static void __attribute__((constructor)) libmm_start(void)
+{
+    void *frame;
+    char *remote = getenv("MM_REMOTE_FREE");
+    char *rate = getenv("MM_PROFILE_RATE");
+
+    pthread_atfork(fork_prepare, fork_parent, fork_child);
+    backtrace(&frame, 1);
+    if (remote != NULL && strcmp(remote, "0") == 0)
+	remote_free_on = 0;
+    if (lock_heap()) {
+	mm_prof_rate(rate ? strtoul(rate, NULL, 0) : MM_PROF_RATE);
+	pthread_mutex_unlock(&lock);
+    }
+}
+
+/*
+ * Write the heap profile on the way out if MM_PROFILE asks for it. The
+ * stream gets a static buffer so that stdio does not malloc while we
+ * hold the lock.
+ */
+static void __attribute__((destructor)) libmm_stop(void)
+{
+    static char buf[BUFSIZ];
+    char *file = getenv("MM_PROFILE");
+    FILE *fp;
+
+    if (file == NULL || !initialized || (fp = fopen(file, "w")) == NULL)
+	return;
+    setvbuf(fp, buf, _IOFBF, sizeof(buf));
+    pthread_mutex_lock(&lock);
+    drain_remote();
+    mm_prof_dump(fp);
+    pthread_mutex_unlock(&lock);
+    fclose(fp);
+}
+
+/*
+ * lock_heap - Take the lock, setting up the heap on the first call, and
+ *     free the blocks other threads left on the remote list. Returns 0
+ *     if the heap could not be set up, with the lock released.
+ */
+static int lock_heap(void)
+{
+    pthread_mutex_lock(&lock);
+    if (!initialized) {
+	mem_init();
+	if (mem_heap_lo() == NULL || mm_init() < 0) {
+	    pthread_mutex_unlock(&lock);
+	    return 0;
+	}
+	mm_prof_rate(0);   /* until libmm_start has loaded the unwinder */
+	initialized = 1;
+    }
+    drain_remote();
+    return 1;
+}
+
+/*
+ * aligned_block - Common code for the memalign family. The caller has
+ *     already checked that alignment is a power of two.
+ */
+static void *aligned_block(size_t alignment, size_t size)
+{
+    void *p = NULL;
+
+    if (size >= MAX_REQUEST || alignment >= MAX_REQUEST) {
+	errno = ENOMEM;
+	return NULL;
+    }
+    if (lock_heap()) {
+	p = mm_memalign(alignment, size ? size : 1);
+	pthread_mutex_unlock(&lock);
+    }
+    if (p == NULL)
+	errno = ENOMEM;
+    return p;
+}
+
+void *malloc(size_t size)
+{
+    void *p = NULL;
+
+    if (size >= MAX_REQUEST) {
+	errno = ENOMEM;
+	return NULL;
+    }
+    if (lock_heap()) {
+	/* mm_malloc(0) returns NULL, which callers take to mean failure */
+	p = mm_malloc(size ? size : 1);
+	pthread_mutex_unlock(&lock);
+    }
+    if (p == NULL)
+	errno = ENOMEM;
+    return p;
+}
+
+void free(void *ptr)
+{
+    if (ptr == NULL)
+	return;
+    if (pthread_mutex_trylock(&lock) != 0) {
+	if (remote_free_on) {
+	    push_remote(ptr);
+	    return;
+	}
+	pthread_mutex_lock(&lock);
+    }
+    drain_remote();
+    mm_free(ptr);
+    pthread_mutex_unlock(&lock);
+}
+
+/*
+ * calloc calls mm_malloc itself: given malloc() followed by memset(0),
+ * gcc is free to turn the pair back into a call to calloc
+ */
+void *calloc(size_t nmemb, size_t size)
+{
+    void *p = NULL;
+
+    if (size != 0 && nmemb >= MAX_REQUEST / size) {
+	errno = ENOMEM;
+	return NULL;
+    }
+    if (lock_heap()) {
+	p = mm_malloc((nmemb && size) ? nmemb * size : 1);
+	pthread_mutex_unlock(&lock);
+    }
+    if (p == NULL)
+	errno = ENOMEM;
+    else
+	memset(p, 0, nmemb * size);
+    return p;
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    void *p = NULL;
+
+    if (ptr == NULL)
+	return malloc(size);
+    if (size == 0) {
+	free(ptr);
+	return NULL;
+    }
+    if (size >= MAX_REQUEST) {
+	errno = ENOMEM;
+	return NULL;
+    }
+    pthread_mutex_lock(&lock);
+    drain_remote();
+    p = mm_realloc(ptr, size);
+    pthread_mutex_unlock(&lock);
+    if (p == NULL)
+	errno = ENOMEM;
+    return p;
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+    if (alignment == 0 || (alignment & (alignment - 1))) {
+	errno = EINVAL;
+	return NULL;
+    }
+    return aligned_block(alignment, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+    return memalign(alignment, size);
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    void *p;
+
+    if (alignment % sizeof(void *) || (alignment & (alignment - 1)))
+	return EINVAL;
+    if ((p = aligned_block(alignment, size)) == NULL)
+	return ENOMEM;
+    *memptr = p;
+    return 0;
+}
+
+void *valloc(size_t size)
+{
+    return aligned_block(mem_pagesize(), size);
+}
+
+void *pvalloc(size_t size)
+{
+    size_t page = mem_pagesize();
+
+    return aligned_block(page, (size + page - 1) & ~(page - 1));
+}
+
+size_t malloc_usable_size(void *ptr)
+{
+    size_t size;
+
+    if (ptr == NULL)
+	return 0;
+    pthread_mutex_lock(&lock);
+    size = mm_usable_size(ptr);
+    pthread_mutex_unlock(&lock);
+    return size;
+}
@@ -17,8 +17,12 @@
 #include <time.h>
 
 #include "mm.h"
+#include "allocator.h"
 #include "memlib.h"
 #include "fsecs.h"
+#include "fcyc.h"
+#include "perfctr.h"
+#include "bench.h"
 #include "config.h"
 
 /**********************
@@ -29,6 +33,14 @@
 #define MAXLINE     1024 /* max string size */
 #define HDRLINES       4 /* number of header lines in a trace file */
 #define LINENUM(i) (i+5) /* cnvt trace request nums to linenums (origin 1) */
+#define DEFAULT_TOLERANCE 5.0 /* default -T regression tolerance (percent) */
+#define REGRESSION_EXIT 2     /* exit status when -b finds a regression */
+#define DEFAULT_WARMUP 3      /* default -W untimed runs before -B runs */
+#define MAXALLOCS     16      /* max number of packages compared by -A */
+#define MAXSNAPS      64      /* max number of points in -D */
+#define DEFAULT_CHECK_BUDGET 32 /* default -K blocks per incremental check */
+#define SNAP_PEAK     -1      /* -D point: when the live bytes peak */
+#define SNAP_END      -2      /* -D point: after the last request */
 
 /* Returns true if p is ALIGNMENT-byte aligned */
 #define IS_ALIGNED(p)  ((((unsigned int)(p)) % ALIGNMENT) == 0)
@@ -46,9 +58,10 @@ typedef struct range_t {
 
 /* Characterizes a single trace operation (allocator request) */
 typedef struct {
-    enum {ALLOC, FREE, REALLOC} type; /* type of request */
+    enum {ALLOC, FREE, REALLOC, COMPACT} type; /* type of request */
     int index;                        /* index for free() to use later */
     int size;                         /* byte size of alloc/realloc request */
+    int movable;                      /* set for an ALLOC from an 'h' line */
 } traceop_t;
 
 /* Holds the information for one trace file*/
@@ -57,9 +70,12 @@ typedef struct {
     int num_ids;         /* number of alloc/realloc ids */
     int num_ops;         /* number of distinct requests */
     int weight;          /* weight for this trace (unused) */
+    char *name;          /* trace file name (not owned by the trace) */
     traceop_t *ops;      /* array of requests */
     char **blocks;       /* array of ptrs returned by malloc/realloc... */
     size_t *block_sizes; /* ... and a corresponding array of payload sizes */
+    char *life;          /* MM_LIFE_* hint for each op, or NULL (-L hint) */
+    int movable;         /* number of 'h' lines; if 0, -z moves every block */
 } trace_t;
 
 /* 
@@ -70,8 +86,36 @@ typedef struct {
 typedef struct {
     trace_t *trace;  
     range_t *ranges;
+    int started;     /* steady state: heap already holds earlier replays */
+    int check;       /* if set, run the incremental heap checker (-k) */
 } speed_t;
 
+/* Cache regimes the speed runs can be measured in (-m) */
+typedef enum {
+    MODE_COLD,   /* evict the caches, fresh heap before each run */
+    MODE_WARM,   /* fresh heap each run, caches left from the last run */
+    MODE_STEADY  /* one heap replayed over and over, never reinitialized */
+} cachemode_t;
+
+/* How eval_allocator measures a package */
+typedef struct {
+    cachemode_t mode;  /* cache regime for the speed runs */
+    int bench_iters;   /* if nonzero, -B runs instead of K-best */
+    int bench_warmup;  /* untimed runs before the -B runs */
+    int latency;       /* if set, measure per-op latency percentiles */
+    int hwcounters;    /* if set, count hardware events per op */
+    int mmstats;       /* if set, collect mm_get_stats after each trace */
+    int check;         /* if set, also time the replay with -k checking */
+    int profile;       /* if set, also time the replay with sampling off */
+    int handles;       /* if set, also replay through mm's handle API */
+} evalopts_t;
+
+/* The extra timings printoverhead can report */
+typedef enum {
+    OVERHEAD_CHECK,    /* the -k incremental heap checker */
+    OVERHEAD_PROF      /* mm's heap profiler at the -q rate */
+} overhead_t;
+
 /* Summarizes the important stats for some malloc function on some trace */
 typedef struct {
     /* defined for both libc malloc and student malloc package (mm.c) */
@@ -81,6 +125,24 @@ typedef struct {
 
     /* defined only for the student malloc package */
     double util;     /* space utilization for this trace (always 0 for libc) */
+    double rss;      /* share of the heap still resident at the end of the
+			util run (always 0 for libc) */
+    double noise;    /* relative timing noise reported by fsecs_noise() */
+    double lat[4];   /* per-op latency percentiles in ns (only with -j/-b) */
+    double hw[PERFCTR_NEVENTS]; /* hardware events per op (only with -p),
+				   -1 if the event could not be counted */
+    int hw_counted;  /* set if the hardware counters ran (-p) */
+    bench_t bench;   /* timing statistics (only with -B, else bench.n = 0) */
+    mm_stats_t mm;   /* mm.c's own counters after the trace (only with -s) */
+    int counted;     /* set if mm.c was built with the counters (-s) */
+    double check_secs; /* secs with the incremental checker on (only -k) */
+    double noprof_secs; /* secs with heap profiling off (only -q) */
+    double hutil;    /* util of the replay through mm's handles (only -z) */
+    double hrss;     /* ... and the share of its heap left resident */
+    double compactions; /* compactions during that replay */
+    double moved;    /* bytes they moved */
+    double pause_ns; /* time spent in the ops that compacted */
+    double max_pause_ns; /* the longest of those ops */
 
     /* Note: secs and util are only defined if valid is true */
 } stats_t; 
@@ -95,6 +157,40 @@ char msg[MAXLINE];      /* for whenever we need to compose an error message */
 /* Directory where default tracefiles are found */
 static char tracedir[MAXLINE] = TRACEDIR;
 
+/* Latency percentiles stored in stats_t.lat, and their JSON names */
+static double lat_pct[] = {50.0, 90.0, 99.0, 100.0};
+static char *lat_names[] = {"lat_p50_ns", "lat_p90_ns", "lat_p99_ns", 
+			    "lat_max_ns"};
+#define NUM_LAT (sizeof(lat_pct) / sizeof(double))
+
+static allocator_t *alloc = &mm_allocator; /* the package being evaluated */
+
+/* Fragmentation timeline written by eval_mm_util (set by -u and -i) */
+static FILE *timeline = NULL;  /* CSV output file, or NULL if disabled */
+static int timeline_interval = 100; /* sample every this many ops */
+
+/* Incremental heap checking during the replays (set by -k and -K) */
+static int check_interval = 0;  /* check every this many ops, 0 for never */
+static int check_budget = DEFAULT_CHECK_BUDGET; /* blocks per check */
+
+/* Heap snapshots of mm written by eval_mm_util (set by -d and -D) */
+static FILE *snapfile = NULL;  /* snapshot file, or NULL if disabled */
+static int snap_ops[MAXSNAPS]; /* after these ops, or SNAP_PEAK/SNAP_END */
+static int num_snap_ops = 0;
+
+/* Heap profiling of mm (set by -q and -Q) */
+static size_t prof_rate = MM_PROF_RATE; /* bytes per sample, 0 for none */
+static FILE *proffile = NULL;  /* profiles at the peak of each trace */
+
+/* How mm places blocks by lifetime (set by -L) */
+typedef enum {
+    LIFE_OFF,     /* first fit for everything */
+    LIFE_HINT,    /* pass mm_malloc_hint the lifetimes the trace shows */
+    LIFE_PREDICT  /* let mm predict lifetimes itself */
+} lifemode_t;
+static lifemode_t life_mode = LIFE_OFF;
+#define LIFE_SHORT_FRACTION 2  /* see life_hints */
+
 /* The filenames of the default tracefiles */
 static char *default_tracefiles[] = {  
     DEFAULT_TRACEFILES, NULL
@@ -115,18 +211,48 @@ static void clear_ranges(range_t **ranges);
 static trace_t *read_trace(char *tracedir, char *filename);
 static void free_trace(trace_t *trace);
 
-/* Routines for evaluating the correctness and speed of libc malloc */
-static int eval_libc_valid(trace_t *trace, int tracenum);
-static void eval_libc_speed(void *ptr);
+/* Routines for evaluating libc malloc as a reference */
+static void eval_libc(int n, char **tracefiles, stats_t *stats, 
+		      cachemode_t mode);
+static double libc_thruput(int n, char **tracefiles, stats_t *libc_stats,
+			   char *key, int recalibrate, cachemode_t mode);
 
 /* Routines for evaluating correctnes, space utilization, and speed 
-   of the student's malloc package in mm.c */
+   of a malloc package (alloc; the student's mm.c unless -A is used) */
+static void eval_allocator(allocator_t *a, int n, char **tracefiles,
+			   stats_t *stats, evalopts_t *opts);
 static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges);
-static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges);
+static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges,
+			   double *rss);
 static void eval_mm_speed(void *ptr);
+static void eval_mm_steady(void *ptr);
+static void sample_timeline(trace_t *trace, int tracenum, int opnum,
+			    int total_size, int max_total_size);
+static void parse_snap_ops(char *spec);
+static int peak_op(trace_t *trace);
+static void life_hints(trace_t *trace);
+static void *replay_malloc(trace_t *trace, int i);
+static int want_snapshot(int opnum, int peak, int num_ops);
+static void eval_mm_latency(trace_t *trace, double *lat);
+static void eval_mm_hw(speed_t *speed_params, stats_t *stats);
+static int eval_mm_handles(trace_t *trace, int tracenum, stats_t *stats);
+
+/* These functions save and compare machine-readable results */
+static void write_json(char *file, int n, char **tracefiles, stats_t *stats,
+		       double perfindex);
+static int compare_baseline(char *file, int n, char **tracefiles, 
+			    stats_t *stats, double tolerance);
 
 /* Various helper routines */
 static void printresults(int n, stats_t *stats);
+static void printhw(int n, stats_t *stats);
+static void printbench(int n, stats_t *stats);
+static void printmmstats(int n, stats_t *stats);
+static void printsearch(int n, stats_t *stats);
+static void printoverhead(int n, stats_t *stats, overhead_t what);
+static void printhandles(int n, stats_t *stats);
+static void printcompare(int n, char **tracefiles, int nalloc, 
+			 allocator_t **allocs, stats_t **stats);
 static void usage(void);
 static void unix_error(char *msg);
 static void malloc_error(int tracenum, int opnum, char *msg);
@@ -141,15 +267,36 @@ int main(int argc, char **argv)
     char c;
     char **tracefiles = NULL;  /* null-terminated array of trace file names */
     int num_tracefiles = 0;    /* the number of traces in that array */
-    trace_t *trace = NULL;     /* stores a single trace file in memory */
-    range_t *ranges = NULL;    /* keeps track of block extents for one trace */
     stats_t *libc_stats = NULL;/* libc stats for each trace */
     stats_t *mm_stats = NULL;  /* mm (i.e. student) stats for each trace */
-    speed_t speed_params;      /* input parameters to the xx_speed routines */ 
+    evalopts_t opts;           /* how to measure the packages */
+    allocator_t *compare[MAXALLOCS+1]; /* packages to compare with (-A) */
+    stats_t *compare_stats[MAXALLOCS+1];
+    int ncompare = 0;
+    char *name;
 
     int team_check = 1;  /* If set, check team structure (reset by -a) */
     int run_libc = 0;    /* If set, run libc malloc (set by -l) */
     int autograder = 0;  /* If set, emit summary info for autograder (-g) */
+    int hwcounters = 0;  /* If set, count hardware events (set by -p) */
+    int mmstats = 0;     /* If set, print mm.c's counters (set by -s) */
+    int searchhist = 0;  /* If set, print search lengths (set by -H) */
+    int profile = 0;     /* If set, time mm's heap profiler (set by -q) */
+    int handles = 0;     /* If set, replay through mm's handles (set by -z) */
+    int bench_iters = 0; /* If set, time this many runs per trace (-B) */
+    int bench_warmup = DEFAULT_WARMUP; /* untimed runs before those (-W) */
+    int bench_cpu = -1;  /* CPU to pin to for -B (-P), -1 for current */
+    cachemode_t mode = MODE_COLD; /* cache regime for the speed runs (-m) */
+    char *mode_names[] = {"cold", "warm", "steady"};
+    int cache_bytes, cache_block;
+    char *jsonfile = NULL;     /* If set, write results as JSON (-j) */
+    char *baselinefile = NULL; /* If set, compare against a baseline (-b) */
+    double tolerance = DEFAULT_TOLERANCE; /* regression tolerance (-T) */
+    int regressions = 0;
+    double thru_ref = 0; /* throughput that earns full marks (-c), 0: auto */
+    double util_weight = UTIL_WEIGHT; /* weight of util in the index (-w) */
+    int recalibrate = 0; /* If set, remeasure libc, ignoring the cache (-R) */
+    char refkey[MAXLINE];
 
     /* temporaries used to compute the performance index */
     double secs, ops, util, avg_mm_util, avg_mm_throughput, p1, p2, perfindex;
@@ -158,7 +305,7 @@ int main(int argc, char **argv)
     /* 
      * Read and interpret the command line arguments 
      */
-    while ((c = getopt(argc, argv, "f:t:hvVgal")) != EOF) {
+    while ((c = getopt(argc, argv, "f:t:u:i:j:b:T:B:W:P:m:c:w:A:d:D:k:K:q:Q:L:hvVgalpRsHz")) != EOF) {
         switch (c) {
 	case 'g': /* Generate summary info for the autograder */
 	    autograder = 1;
@@ -178,12 +325,139 @@ int main(int argc, char **argv)
 	    if (tracedir[strlen(tracedir)-1] != '/') 
 		strcat(tracedir, "/"); /* path always ends with "/" */
 	    break;
+        case 'u': /* Write a fragmentation timeline to a CSV file */
+	    if ((timeline = fopen(optarg, "w")) == NULL) {
+		sprintf(msg, "Could not open %s for writing", optarg);
+		unix_error(msg);
+	    }
+	    fprintf(timeline, "trace,file,op,live_bytes,peak_bytes,"
+		    "heap_bytes,free_blocks,max_free,util\n");
+	    break;
+        case 'i': /* Ops between samples in the fragmentation timeline */
+	    timeline_interval = atoi(optarg);
+	    if (timeline_interval <= 0)
+		app_error("-i requires a positive number of ops");
+	    break;
+        case 'd': /* Write heap snapshots of mm to a file */
+	    if ((snapfile = fopen(optarg, "w")) == NULL) {
+		sprintf(msg, "Could not open %s for writing", optarg);
+		unix_error(msg);
+	    }
+	    break;
+        case 'D': /* Ops after which to take the -d snapshots */
+	    parse_snap_ops(optarg);
+	    break;
+        case 'k': /* Run the incremental heap checker every n ops */
+	    check_interval = atoi(optarg);
+	    if (check_interval <= 0)
+		app_error("-k requires a positive number of ops");
+	    break;
+        case 'K': /* Blocks the incremental checker looks at each time */
+	    check_budget = atoi(optarg);
+	    if (check_budget <= 0)
+		app_error("-K requires a positive number of blocks");
+	    break;
+        case 'q': /* Heap profiling rate; report what profiling costs */
+	    prof_rate = strtoul(optarg, NULL, 0);
+	    profile = 1;
+	    break;
+        case 'Q': /* Write mm's heap profile at each trace's peak to a file */
+	    if ((proffile = fopen(optarg, "w")) == NULL) {
+		sprintf(msg, "Could not open %s for writing", optarg);
+		unix_error(msg);
+	    }
+	    break;
+        case 'j': /* Write the results to a JSON file */
+	    jsonfile = optarg;
+	    break;
+        case 'b': /* Compare the results against a baseline JSON file */
+	    baselinefile = optarg;
+	    break;
+        case 'T': /* Regression tolerance in percent */
+	    tolerance = atof(optarg);
+	    if (tolerance < 0)
+		app_error("-T requires a non-negative tolerance");
+	    break;
+        case 'B': /* Statistical benchmark with this many timed runs */
+	    bench_iters = atoi(optarg);
+	    if (bench_iters < 2)
+		app_error("-B requires at least 2 runs");
+	    break;
+        case 'W': /* Untimed warmup runs before the -B runs */
+	    bench_warmup = atoi(optarg);
+	    if (bench_warmup < 0)
+		app_error("-W requires a non-negative number of runs");
+	    break;
+        case 'P': /* CPU to pin to for -B */
+	    bench_cpu = atoi(optarg);
+	    break;
+        case 'm': /* Cache regime: cold, warm or steady */
+	    for (i = MODE_STEADY; i >= 0 && strcmp(optarg, mode_names[i]); i--)
+		;
+	    if (i < 0)
+		app_error("-m requires one of cold, warm or steady");
+	    mode = (cachemode_t)i;
+	    break;
+        case 'c': /* Throughput cap in Kops/sec, or "auto" to measure libc */
+	    if (strcmp(optarg, "auto") == 0)
+		thru_ref = 0;
+	    else if ((thru_ref = atof(optarg) * 1e3) <= 0)
+		app_error("-c requires a positive Kops/sec or \"auto\"");
+	    break;
+        case 'w': /* Weight of utilization in the performance index */
+	    util_weight = atof(optarg);
+	    if (util_weight < 0 || util_weight > 1)
+		app_error("-w requires a weight between 0 and 1");
+	    break;
+        case 'R': /* Remeasure the libc reference throughput */
+	    recalibrate = 1;
+	    break;
+        case 'L': /* Place mm's blocks by lifetime: hint or predict */
+	    if (strcmp(optarg, "hint") == 0)
+		life_mode = LIFE_HINT;
+	    else if (strcmp(optarg, "predict") == 0)
+		life_mode = LIFE_PREDICT;
+	    else {
+		usage();
+		exit(1);
+	    }
+	    break;
+        case 'A': /* Compare against these packages (or "all") */
+	    for (name = strtok(optarg, ","); name; name = strtok(NULL, ",")) {
+		for (i = 0; allocators[i] != NULL; i++) {
+		    if (allocators[i] == &mm_allocator || 
+			(strcmp(name, "all") && 
+			 strcmp(name, allocators[i]->name)))
+			continue;
+		    if (ncompare == MAXALLOCS)
+			app_error("too many packages for -A");
+		    compare[ncompare++] = allocators[i];
+		}
+		if (strcmp(name, "all") && strcmp(name, mm_allocator.name) && 
+		    find_allocator(name) == NULL) {
+		    sprintf(msg, "-A: no package named %s", name);
+		    app_error(msg);
+		}
+	    }
+	    break;
         case 'a': /* Don't check team structure */
             team_check = 0;
             break;
         case 'l': /* Run libc malloc */
             run_libc = 1;
             break;
+        case 'p': /* Count hardware events with perf_event_open */
+            hwcounters = 1;
+            break;
+        case 's': /* Print mm.c's internal counters for each trace */
+            mmstats = 1;
+            break;
+        case 'H': /* Print how far mm.c's searches walk for each trace */
+            searchhist = 1;
+            break;
+        case 'z': /* Replay through mm's movable blocks, with compaction */
+            handles = 1;
+            break;
         case 'v': /* Print per-trace performance breakdown */
             verbose = 1;
             break;
@@ -198,6 +472,12 @@ int main(int argc, char **argv)
             exit(1);
         }
     }
+
+    /* Snapshot at the peak and after the last op unless -D says otherwise */
+    if (snapfile && num_snap_ops == 0) {
+	snap_ops[num_snap_ops++] = SNAP_PEAK;
+	snap_ops[num_snap_ops++] = SNAP_END;
+    }
 	
     /* 
      * Check and print team info 
@@ -237,6 +517,16 @@ int main(int argc, char **argv)
 
     /* Initialize the timing package */
     init_fsecs();
+    set_fcyc_clear_cache(mode == MODE_COLD);
+    if (verbose) {
+	printf("Measuring in the %s cache regime", mode_names[mode]);
+	if (mode == MODE_COLD) {
+	    fcyc_cache_geometry(&cache_bytes, &cache_block);
+	    printf(" (clearing %d KB in %d-byte lines)", 
+		   cache_bytes >> 10, cache_block);
+	}
+	printf(".\n");
+    }
 
     /*
      * Optionally run and evaluate the libc malloc package 
@@ -251,20 +541,7 @@ int main(int argc, char **argv)
 	    unix_error("libc_stats calloc in main failed");
 	
 	/* Evaluate the libc malloc package using the K-best scheme */
-	for (i=0; i < num_tracefiles; i++) {
-	    trace = read_trace(tracedir, tracefiles[i]);
-	    libc_stats[i].ops = trace->num_ops;
-	    if (verbose > 1)
-		printf("Checking libc malloc for correctness, ");
-	    libc_stats[i].valid = eval_libc_valid(trace, i);
-	    if (libc_stats[i].valid) {
-		speed_params.trace = trace;
-		if (verbose > 1)
-		    printf("and performance.\n");
-		libc_stats[i].secs = fsecs(eval_libc_speed, &speed_params);
-	    }
-	    free_trace(trace);
-	}
+	eval_libc(num_tracefiles, tracefiles, libc_stats, mode);
 
 	/* Display the libc results in a compact table */
 	if (verbose) {
@@ -273,6 +550,24 @@ int main(int argc, char **argv)
 	}
     }
 
+    /*
+     * Unless -c gave one, the throughput that earns the full throughput
+     * score is what libc achieves on these traces on this machine
+     */
+    if (thru_ref == 0) {
+	if (gethostname(refkey, MAXLINE/2) < 0)
+	    strcpy(refkey, "unknown");
+	refkey[MAXLINE/2] = '\0';
+	snprintf(refkey + strlen(refkey), MAXLINE - strlen(refkey), " %s %.*s",
+		 mode_names[mode], MAXLINE/2 - 16, tracedir);
+	for (i = 0; i < num_tracefiles; i++)
+	    if (strlen(refkey) + strlen(tracefiles[i]) + 2 < MAXLINE)
+		sprintf(refkey + strlen(refkey), "%s%s", i ? "," : "",
+			tracefiles[i]);
+	thru_ref = libc_thruput(num_tracefiles, tracefiles, libc_stats, 
+				refkey, recalibrate, mode);
+    }
+
     /*
      * Always run and evaluate the student's mm package
      */
@@ -287,32 +582,123 @@ int main(int argc, char **argv)
     /* Initialize the simulated memory system in memlib.c */
     mem_init(); 
 
-    /* Evaluate student's mm malloc package using the K-best scheme */
-    for (i=0; i < num_tracefiles; i++) {
-	trace = read_trace(tracedir, tracefiles[i]);
-	mm_stats[i].ops = trace->num_ops;
-	if (verbose > 1)
-	    printf("Checking mm_malloc for correctness, ");
-	mm_stats[i].valid = eval_mm_valid(trace, i, &ranges);
-	if (mm_stats[i].valid) {
-	    if (verbose > 1)
-		printf("efficiency, ");
-	    mm_stats[i].util = eval_mm_util(trace, i, &ranges);
-	    speed_params.trace = trace;
-	    speed_params.ranges = ranges;
-	    if (verbose > 1)
-		printf("and performance.\n");
-	    mm_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
-	}
-	free_trace(trace);
+    /* Keep the scheduler from moving us between -B runs */
+    if (bench_iters) {
+	if ((i = bench_pin(bench_cpu)) < 0)
+	    printf("Warning: could not pin to a CPU; results may be noisy\n");
+	else if (verbose)
+	    printf("Pinned to CPU %d\n", i);
     }
 
+    /* Carry on without the counters if the kernel won't give us any */
+    if (hwcounters && perfctr_open(1) == 0)
+	hwcounters = 0;
+
+    /* Evaluate student's mm malloc package using the K-best scheme */
+    opts.mode = mode;
+    opts.bench_iters = bench_iters;
+    opts.bench_warmup = bench_warmup;
+    opts.latency = (jsonfile || baselinefile);
+    opts.hwcounters = hwcounters;
+    opts.mmstats = (mmstats || searchhist);
+    opts.check = (check_interval > 0);
+    opts.profile = profile;
+    opts.handles = handles;
+    mm_prof_rate(prof_rate);
+    mm_life_predict(life_mode == LIFE_PREDICT);
+    eval_allocator(&mm_allocator, num_tracefiles, tracefiles, mm_stats, 
+		   &opts);
+
     /* Display the mm results in a compact table */
     if (verbose) {
 	printf("\nResults for mm malloc:\n");
 	printresults(num_tracefiles, mm_stats);
 	printf("\n");
     }
+    if (bench_iters) {
+	printf("Timing over %d runs (%d warmup) for mm malloc:\n", 
+	       bench_iters, bench_warmup);
+	printbench(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+    if (hwcounters) {
+	perfctr_close();
+	printf("Hardware events per op for mm malloc:\n");
+	printhw(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+    if (mmstats) {
+	printf("Internal counters for mm malloc:\n");
+	printmmstats(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+    if (searchhist) {
+	printf("Blocks visited per search for mm malloc:\n");
+	printsearch(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+    if (check_interval) {
+	printf("Checking %d blocks every %d ops in mm malloc:\n", 
+	       check_budget, check_interval);
+	printoverhead(num_tracefiles, mm_stats, OVERHEAD_CHECK);
+	printf("\n");
+    }
+    if (profile) {
+	printf("Heap profiling with a sample per %lu bytes in mm malloc:\n",
+	       (unsigned long)prof_rate);
+	printoverhead(num_tracefiles, mm_stats, OVERHEAD_PROF);
+	printf("\n");
+    }
+    if (handles) {
+	printf("Replaying through movable blocks in mm malloc:\n");
+	printhandles(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+    if (timeline) {
+	fclose(timeline);
+	timeline = NULL;
+    }
+    if (snapfile) {
+	if (fclose(snapfile) != 0)
+	    unix_error("Could not write the -d snapshots");
+	snapfile = NULL;
+    }
+    if (proffile) {
+	if (fclose(proffile) != 0)
+	    unix_error("Could not write the -Q profiles");
+	proffile = NULL;
+    }
+
+    /*
+     * Run the packages named by -A the same way and show them side by side
+     */
+    if (ncompare > 0) {
+	opts.latency = 0;
+	opts.hwcounters = 0;
+	opts.mmstats = 0;
+	opts.check = 0;
+	opts.profile = 0;
+	opts.handles = 0;
+	for (i = 0; i < ncompare; i++) {
+	    if (verbose > 1)
+		printf("\nTesting %s malloc\n", compare[i]->name);
+	    compare_stats[i] = (stats_t *)calloc(num_tracefiles, 
+						 sizeof(stats_t));
+	    if (compare_stats[i] == NULL)
+		unix_error("compare_stats calloc in main failed");
+	    eval_allocator(compare[i], num_tracefiles, tracefiles, 
+			   compare_stats[i], &opts);
+	}
+	for (i = ncompare; i > 0; i--) {
+	    compare[i] = compare[i-1];
+	    compare_stats[i] = compare_stats[i-1];
+	}
+	compare[0] = &mm_allocator;
+	compare_stats[0] = mm_stats;
+	printcompare(num_tracefiles, tracefiles, ncompare + 1, compare, 
+		     compare_stats);
+	printf("\n");
+    }
 
     /* 
      * Accumulate the aggregate statistics for the student's mm package 
@@ -336,13 +722,13 @@ int main(int argc, char **argv)
     if (errors == 0) {
 	avg_mm_throughput = ops/secs;
 
-	p1 = UTIL_WEIGHT * avg_mm_util;
-	if (avg_mm_throughput > AVG_LIBC_THRUPUT) {
-	    p2 = (double)(1.0 - UTIL_WEIGHT);
+	p1 = util_weight * avg_mm_util;
+	if (avg_mm_throughput > thru_ref) {
+	    p2 = (double)(1.0 - util_weight);
 	} 
 	else {
-	    p2 = ((double) (1.0 - UTIL_WEIGHT)) * 
-		(avg_mm_throughput/AVG_LIBC_THRUPUT);
+	    p2 = ((double) (1.0 - util_weight)) * 
+		(avg_mm_throughput/thru_ref);
 	}
 	
 	perfindex = (p1 + p2)*100.0;
@@ -362,6 +748,17 @@ int main(int argc, char **argv)
 	printf("perfidx:%.0f\n", perfindex);
     }
 
+    if (jsonfile)
+	write_json(jsonfile, num_tracefiles, tracefiles, mm_stats, perfindex);
+    if (baselinefile) {
+	regressions = compare_baseline(baselinefile, num_tracefiles, 
+				       tracefiles, mm_stats, tolerance);
+	if (regressions > 0) {
+	    printf("%d regressions against %s\n", regressions, baselinefile);
+	    exit(REGRESSION_EXIT);
+	}
+    }
+
     exit(0);
 }
 
@@ -396,8 +793,9 @@ static int add_range(range_t **ranges, char *lo, int size,
     }
 
     /* The payload must lie within the extent of the heap */
-    if ((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) || 
-	(hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) {
+    if (alloc->uses_memlib &&
+	((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) || 
+	 (hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi()))) {
 	sprintf(msg, "Payload (%p:%p) lies outside heap (%p:%p)",
 		lo, hi, mem_heap_lo(), mem_heap_hi());
 	malloc_error(tracenum, opnum, msg);
@@ -499,6 +897,9 @@ static trace_t *read_trace(char *tracedir, char *filename)
     fscanf(tracefile, "%d", &(trace->num_ids));     
     fscanf(tracefile, "%d", &(trace->num_ops));     
     fscanf(tracefile, "%d", &(trace->weight));        /* not used */
+    trace->name = filename;
+    trace->life = NULL;
+    trace->movable = 0;
     
     /* We'll store each request line in the trace in this array */
     if ((trace->ops = 
@@ -519,7 +920,12 @@ static trace_t *read_trace(char *tracedir, char *filename)
     index = 0;
     op_index = 0;
     while (fscanf(tracefile, "%s", type) != EOF) {
+	trace->ops[op_index].movable = 0;
 	switch(type[0]) {
+	case 'h': /* an alloc that may move under -z */
+	    trace->ops[op_index].movable = 1;
+	    trace->movable++;
+	    /* fall through */
 	case 'a':
 	    fscanf(tracefile, "%u %u", &index, &size);
 	    trace->ops[op_index].type = ALLOC;
@@ -539,6 +945,11 @@ static trace_t *read_trace(char *tracedir, char *filename)
 	    trace->ops[op_index].type = FREE;
 	    trace->ops[op_index].index = index;
 	    break;
+	case 'c': /* a point where a program would call mm_compact */
+	    trace->ops[op_index].type = COMPACT;
+	    trace->ops[op_index].index = 0;
+	    trace->ops[op_index].size = 0;
+	    break;
 	default:
 	    printf("Bogus type character (%c) in tracefile %s\n", 
 		   type[0], path);
@@ -556,13 +967,15 @@ static trace_t *read_trace(char *tracedir, char *filename)
 
 /*
  * free_trace - Free the trace record and the three arrays it points
- *              to, all of which were allocated in read_trace().
+ *              to, all of which were allocated in read_trace(), and
+ *              the hints from life_hints().
  */
 void free_trace(trace_t *trace)
 {
     free(trace->ops);         /* free the three arrays... */
     free(trace->blocks);      
     free(trace->block_sizes);
+    free(trace->life);        /* (only with -L hint) */
     free(trace);              /* and the trace record itself... */
 }
 
@@ -571,6 +984,85 @@ void free_trace(trace_t *trace)
  * and throughput of the libc and mm malloc packages.
  **********************************************************************/
 
+/*
+ * eval_allocator - Run package a on each of the n traces: check it for
+ *    correctness, measure its utilization (if its heap comes from 
+ *    memlib) and time it as opts says, filling in stats[0..n). Leaves
+ *    alloc pointing at a.
+ */
+static void eval_allocator(allocator_t *a, int n, char **tracefiles,
+			   stats_t *stats, evalopts_t *opts)
+{
+    int i;
+    trace_t *trace;
+    range_t *ranges = NULL;
+    speed_t speed_params;
+    bench_t *b;
+    void (*speed)(void *) = (opts->mode == MODE_STEADY) ? 
+	eval_mm_steady : eval_mm_speed;
+
+    alloc = a;
+    for (i=0; i < n; i++) {
+	trace = read_trace(tracedir, tracefiles[i]);
+	stats[i].ops = trace->num_ops;
+	if (life_mode == LIFE_HINT && a->malloc_hint)
+	    life_hints(trace);
+	if (verbose > 1)
+	    printf("Checking %s malloc for correctness, ", a->name);
+	stats[i].valid = eval_mm_valid(trace, i, &ranges);
+	if (stats[i].valid && opts->mmstats)
+	    stats[i].counted = mm_get_stats(&stats[i].mm);
+	if (stats[i].valid) {
+	    if (a->uses_memlib) {
+		if (verbose > 1)
+		    printf("efficiency, ");
+		stats[i].util = eval_mm_util(trace, i, &ranges, 
+					      &stats[i].rss);
+	    }
+	    if (opts->handles && a == &mm_allocator) {
+		if (verbose > 1)
+		    printf("movable blocks, ");
+		stats[i].valid = eval_mm_handles(trace, i, &stats[i]);
+	    }
+	}
+	if (stats[i].valid) {
+	    speed_params.trace = trace;
+	    speed_params.ranges = ranges;
+	    speed_params.started = 0;
+	    speed_params.check = 0;
+	    if (verbose > 1)
+		printf("and performance.\n");
+	    if (opts->bench_iters) {
+		b = &stats[i].bench;
+		bench(speed, &speed_params, opts->bench_warmup, 
+		      opts->bench_iters, opts->mode == MODE_COLD, b);
+		stats[i].secs = b->median;
+		stats[i].noise = (b->ci_hi - b->ci_lo) / (2 * b->median);
+	    }
+	    else {
+		stats[i].secs = fsecs(speed, &speed_params);
+		stats[i].noise = fsecs_noise();
+	    }
+	    if (opts->check && a->check_incr) {
+		speed_params.check = 1;
+		stats[i].check_secs = fsecs(speed, &speed_params);
+		speed_params.check = 0;
+	    }
+	    if (opts->profile && a == &mm_allocator) {
+		mm_prof_rate(0);
+		stats[i].noprof_secs = fsecs(speed, &speed_params);
+		mm_prof_rate(prof_rate);
+	    }
+	    if (opts->latency)
+		eval_mm_latency(trace, stats[i].lat);
+	    if (opts->hwcounters)
+		eval_mm_hw(&speed_params, &stats[i]);
+	}
+	free_trace(trace);
+    }
+    clear_ranges(&ranges);
+}
+
 /*
  * eval_mm_valid - Check the mm malloc package for correctness
  */
@@ -589,7 +1081,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
     clear_ranges(ranges);
 
     /* Call the mm package's init function */
-    if (mm_init() < 0) {
+    if (alloc->init() < 0) {
 	malloc_error(tracenum, 0, "mm_init failed.");
 	return 0;
     }
@@ -604,7 +1096,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
         case ALLOC: /* mm_malloc */
 
 	    /* Call the student's malloc */
-	    if ((p = mm_malloc(size)) == NULL) {
+	    if ((p = replay_malloc(trace, i)) == NULL) {
 		malloc_error(tracenum, i, "mm_malloc failed.");
 		return 0;
 	    }
@@ -633,7 +1125,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    
 	    /* Call the student's realloc */
 	    oldp = trace->blocks[index];
-	    if ((newp = mm_realloc(oldp, size)) == NULL) {
+	    if ((newp = alloc->realloc(oldp, size)) == NULL) {
 		malloc_error(tracenum, i, "mm_realloc failed.");
 		return 0;
 	    }
@@ -653,7 +1145,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    oldsize = trace->block_sizes[index];
 	    if (size < oldsize) oldsize = size;
 	    for (j = 0; j < oldsize; j++) {
-	      if (newp[j] != (index & 0xFF)) {
+	      if ((unsigned char)newp[j] != (index & 0xFF)) {
 		malloc_error(tracenum, i, "mm_realloc did not preserve the "
 			     "data from old block");
 		return 0;
@@ -671,13 +1163,28 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    /* Remove region from list and call student's free function */
 	    p = trace->blocks[index];
 	    remove_range(ranges, p);
-	    mm_free(p);
+	    alloc->free(p);
+	    break;
+
+	case COMPACT: /* only the -z replay acts on these */
 	    break;
 
 	default:
 	    app_error("Nonexistent request type in eval_mm_valid");
         }
 
+	/* With -k, check a slice of the heap every check_interval ops */
+	if (check_interval && alloc->check_incr && 
+	    (i+1) % check_interval == 0 && !alloc->check_incr(check_budget)) {
+	    malloc_error(tracenum, i, "incremental heap check failed");
+	    return 0;
+	}
+    }
+
+    /* With -V, also run the package's own heap checker */
+    if (verbose > 1 && alloc->check && !alloc->check()) {
+	malloc_error(tracenum, trace->num_ops - 1, "heap check failed");
+	return 0;
     }
 
     /* As far as we know, this is a valid malloc package */
@@ -694,8 +1201,19 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
  *   doesn't allow the students to decrement the brk pointer, so brk
  *   is always the high water mark of the heap. 
  *   
+ *   If a timeline file was requested with -u, the live bytes, heap
+ *   size and free block statistics are also sampled every
+ *   timeline_interval ops, so that fragmentation can be plotted over
+ *   the course of the trace. With -d, mm's heap is also dumped at the
+ *   -D points for heapanalyze, and with -Q its heap profile is written
+ *   when the live bytes peak.
+ *
+ *   *rss is set to the share of the heap that is still resident once
+ *   the trace is done, which is how much of it the package gave back.
+ *   The pages the previous run left behind are released first.
  */
-static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
+static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges,
+			   double *rss)
 {   
     int i;
     int index;
@@ -704,12 +1222,18 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
     int total_size = 0;
     char *p;
     char *newp, *oldp;
+    int peak = -1;
 
     /* initialize the heap and the mm malloc package */
+    mem_release(mem_heap_lo(), (char *)mem_heap_hi() + 1);
     mem_reset_brk();
-    if (mm_init() < 0)
+    if (alloc->init() < 0)
 	app_error("mm_init failed in eval_mm_util");
 
+    /* Snapshots and profiles are only taken of mm itself */
+    if ((snapfile || proffile) && alloc == &mm_allocator)
+	peak = peak_op(trace);
+
     for (i = 0;  i < trace->num_ops;  i++) {
         switch (trace->ops[i].type) {
 
@@ -717,7 +1241,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    index = trace->ops[i].index;
 	    size = trace->ops[i].size;
 
-	    if ((p = mm_malloc(size)) == NULL) 
+	    if ((p = replay_malloc(trace, i)) == NULL) 
 		app_error("mm_malloc failed in eval_mm_util");
 	    
 	    /* Remember region and size */
@@ -739,7 +1263,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    oldsize = trace->block_sizes[index];
 
 	    oldp = trace->blocks[index];
-	    if ((newp = mm_realloc(oldp,newsize)) == NULL)
+	    if ((newp = alloc->realloc(oldp,newsize)) == NULL)
 		app_error("mm_realloc failed in eval_mm_util");
 
 	    /* Remember region and size */
@@ -760,7 +1284,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    size = trace->block_sizes[index];
 	    p = trace->blocks[index];
 	    
-	    mm_free(p);
+	    alloc->free(p);
 	    
 	    /* Keep track of current total size
 	     * of all allocated blocks */
@@ -768,15 +1292,162 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    
 	    break;
 
+	case COMPACT: /* only the -z replay acts on these */
+	    break;
+
 	default:
 	    app_error("Nonexistent request type in eval_mm_util");
 
         }
+
+	if (timeline && ((i+1) % timeline_interval == 0 || 
+			 i == trace->num_ops - 1))
+	    sample_timeline(trace, tracenum, i, total_size, max_total_size);
+	if (peak >= 0 && snapfile && want_snapshot(i, peak, trace->num_ops) &&
+	    mm_snapshot(snapfile, tracenum, i, total_size) < 0)
+	    unix_error("Could not write a -d snapshot");
+	if (i == peak && proffile) {
+	    fprintf(proffile, "# trace %d (%s), op %d, %d bytes live\n", 
+		    tracenum, trace->name, i, total_size);
+	    if (mm_prof_dump(proffile) < 0)
+		unix_error("Could not write a -Q profile");
+	}
     }
 
+    *rss = (double)mem_resident() / (double)mem_heapsize();
     return ((double)max_total_size / (double)mem_heapsize());
 }
 
+/*
+ * sample_timeline - Append one row of fragmentation statistics for
+ *    request opnum of trace tracenum to the timeline file.
+ */
+static void sample_timeline(trace_t *trace, int tracenum, int opnum,
+			    int total_size, int max_total_size)
+{
+    size_t heapsize = mem_heapsize();
+    size_t nfree, maxfree;
+
+    nfree = maxfree = 0;
+    if (alloc->freeinfo)
+	alloc->freeinfo(&nfree, &maxfree);
+    fprintf(timeline, "%d,%s,%d,%d,%d,%lu,%lu,%lu,%.4f\n",
+	    tracenum, trace->name, opnum, total_size, max_total_size,
+	    (unsigned long)heapsize, (unsigned long)nfree, 
+	    (unsigned long)maxfree,
+	    heapsize ? (double)total_size / (double)heapsize : 0.0);
+}
+
+/*
+ * parse_snap_ops - Parse the -D list of op numbers, "peak" and "end"
+ */
+static void parse_snap_ops(char *spec)
+{
+    char *tok, *end;
+
+    num_snap_ops = 0;
+    for (tok = strtok(spec, ","); tok; tok = strtok(NULL, ",")) {
+	if (num_snap_ops == MAXSNAPS)
+	    app_error("Too many points in -D");
+	if (!strcmp(tok, "peak"))
+	    snap_ops[num_snap_ops] = SNAP_PEAK;
+	else if (!strcmp(tok, "end"))
+	    snap_ops[num_snap_ops] = SNAP_END;
+	else {
+	    snap_ops[num_snap_ops] = strtol(tok, &end, 10);
+	    if (*end != '\0' || snap_ops[num_snap_ops] < 0)
+		app_error("-D takes op numbers, peak and end");
+	}
+	num_snap_ops++;
+    }
+}
+
+/*
+ * peak_op - The first op of trace after which the live payload bytes
+ *    reach their high water mark
+ */
+static int peak_op(trace_t *trace)
+{
+    int i, index, peak = 0;
+    long live = 0, max_live = -1;
+    int *sizes;
+
+    if ((sizes = (int *)calloc(trace->num_ids, sizeof(int))) == NULL)
+	unix_error("calloc in peak_op failed");
+    for (i = 0; i < trace->num_ops; i++) {
+	index = trace->ops[i].index;
+	if (trace->ops[i].type == COMPACT)
+	    continue;
+	if (trace->ops[i].type == FREE) {
+	    live -= sizes[index];
+	    continue;
+	}
+	live += trace->ops[i].size - sizes[index];
+	sizes[index] = trace->ops[i].size;
+	if (live > max_live) {
+	    max_live = live;
+	    peak = i;
+	}
+    }
+    free(sizes);
+    return peak;
+}
+
+/*
+ * life_hints - Fill in trace->life from the trace itself: a block is
+ *    short lived if it is freed (or reallocated) within the first 
+ *    1/LIFE_SHORT_FRACTION of the trace's length after it was allocated.
+ *    That is as good as a caller's hint could ever be.
+ */
+static void life_hints(trace_t *trace)
+{
+    int i, index, *end;
+    int short_ops = trace->num_ops / LIFE_SHORT_FRACTION;
+
+    if ((trace->life = (char *)malloc(trace->num_ops)) == NULL ||
+	(end = (int *)malloc(trace->num_ids * sizeof(int))) == NULL)
+	unix_error("malloc in life_hints failed");
+
+    /* Walk backwards, so end[index] is the op that ends the block */
+    for (i = 0; i < trace->num_ids; i++)
+	end[i] = trace->num_ops;
+    for (i = trace->num_ops - 1; i >= 0; i--) {
+	if (trace->ops[i].type == COMPACT)
+	    continue;
+	index = trace->ops[i].index;
+	trace->life[i] = (end[index] - i < short_ops) ? 
+	    MM_LIFE_SHORT : MM_LIFE_LONG;
+	end[index] = i;
+    }
+    free(end);
+}
+
+/*
+ * replay_malloc - Allocate the block for op i of trace, an ALLOC, with
+ *    its lifetime hint if there is one
+ */
+static void *replay_malloc(trace_t *trace, int i)
+{
+    if (trace->life != NULL)
+	return alloc->malloc_hint(trace->ops[i].size, trace->life[i]);
+    return alloc->malloc(trace->ops[i].size);
+}
+
+/*
+ * want_snapshot - Is op opnum of a trace with num_ops ops one of the -D
+ *    points? (peak is the op returned by peak_op)
+ */
+static int want_snapshot(int opnum, int peak, int num_ops)
+{
+    int i;
+
+    for (i = 0; i < num_snap_ops; i++)
+	if (snap_ops[i] == opnum || 
+	    (snap_ops[i] == SNAP_PEAK && opnum == peak) ||
+	    (snap_ops[i] == SNAP_END && opnum == num_ops - 1))
+	    return 1;
+    return 0;
+}
 
 /*
  * eval_mm_speed - This is the function that is used by fcyc()
@@ -784,23 +1455,23 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
  */
 static void eval_mm_speed(void *ptr)
 {
-    int i, index, size, newsize;
+    int i, index, newsize;
     char *p, *newp, *oldp, *block;
     trace_t *trace = ((speed_t *)ptr)->trace;
+    int check = ((speed_t *)ptr)->check;
 
     /* Reset the heap and initialize the mm package */
     mem_reset_brk();
-    if (mm_init() < 0) 
+    if (alloc->init() < 0) 
 	app_error("mm_init failed in eval_mm_speed");
 
     /* Interpret each trace request */
-    for (i = 0;  i < trace->num_ops;  i++)
+    for (i = 0;  i < trace->num_ops;  i++) {
         switch (trace->ops[i].type) {
 
         case ALLOC: /* mm_malloc */
             index = trace->ops[i].index;
-            size = trace->ops[i].size;
-            if ((p = mm_malloc(size)) == NULL)
+            if ((p = replay_malloc(trace, i)) == NULL)
 		app_error("mm_malloc error in eval_mm_speed");
             trace->blocks[index] = p;
             break;
@@ -809,7 +1480,7 @@ static void eval_mm_speed(void *ptr)
 	    index = trace->ops[i].index;
             newsize = trace->ops[i].size;
 	    oldp = trace->blocks[index];
-            if ((newp = mm_realloc(oldp,newsize)) == NULL)
+            if ((newp = alloc->realloc(oldp,newsize)) == NULL)
 		app_error("mm_realloc error in eval_mm_speed");
             trace->blocks[index] = newp;
             break;
@@ -817,97 +1488,432 @@ static void eval_mm_speed(void *ptr)
         case FREE: /* mm_free */
             index = trace->ops[i].index;
             block = trace->blocks[index];
-            mm_free(block);
+            alloc->free(block);
             break;
 
+	case COMPACT: /* only the -z replay acts on these */
+	    break;
+
 	default:
 	    app_error("Nonexistent request type in eval_mm_valid");
         }
+
+	if (check && (i+1) % check_interval == 0 && 
+	    !alloc->check_incr(check_budget))
+	    app_error("incremental heap check failed in eval_mm_speed");
+    }
 }
 
 /*
- * eval_libc_valid - We run this function to make sure that the
- *    libc malloc can run to completion on the set of traces.
- *    We'll be conservative and terminate if any libc malloc call fails.
- *
+ * eval_mm_steady - Like eval_mm_speed, but the heap is only initialized
+ *    on the first call for a trace. Later calls replay the trace on top
+ *    of whatever the earlier replays left behind, so the allocator's 
+ *    metadata stays warm and its free structures reach a steady state.
+ *    Blocks still allocated at the end of the trace are freed at the
+ *    end of each replay, and that is timed too.
  */
-static int eval_libc_valid(trace_t *trace, int tracenum)
+static void eval_mm_steady(void *ptr)
 {
-    int i, newsize;
-    char *p, *newp, *oldp;
+    speed_t *params = (speed_t *)ptr;
+    trace_t *trace = params->trace;
+    int i, index;
+    char *p;
+
+    if (!params->started) {
+	mem_reset_brk();
+	if (alloc->init() < 0) 
+	    app_error("mm_init failed in eval_mm_steady");
+	memset(trace->blocks, 0, trace->num_ids * sizeof(char *));
+	params->started = 1;
+    }
 
     for (i = 0;  i < trace->num_ops;  i++) {
+	index = trace->ops[i].index;
         switch (trace->ops[i].type) {
-
-        case ALLOC: /* malloc */
-	    if ((p = malloc(trace->ops[i].size)) == NULL) {
-		malloc_error(tracenum, i, "libc malloc failed");
-		unix_error("System message");
-	    }
-	    trace->blocks[trace->ops[i].index] = p;
+        case ALLOC: /* mm_malloc */
+            if ((p = replay_malloc(trace, i)) == NULL)
+		app_error("mm_malloc error in eval_mm_steady");
+            trace->blocks[index] = p;
+            break;
+	case REALLOC: /* mm_realloc */
+            if ((p = alloc->realloc(trace->blocks[index], 
+				trace->ops[i].size)) == NULL)
+		app_error("mm_realloc error in eval_mm_steady");
+            trace->blocks[index] = p;
+            break;
+        case FREE: /* mm_free */
+            alloc->free(trace->blocks[index]);
+            trace->blocks[index] = NULL;
+            break;
+	case COMPACT: /* only the -z replay acts on these */
 	    break;
+	default:
+	    app_error("Nonexistent request type in eval_mm_steady");
+        }
 
-	case REALLOC: /* realloc */
-            newsize = trace->ops[i].size;
-	    oldp = trace->blocks[trace->ops[i].index];
-	    if ((newp = realloc(oldp, newsize)) == NULL) {
-		malloc_error(tracenum, i, "libc realloc failed");
-		unix_error("System message");
-	    }
-	    trace->blocks[trace->ops[i].index] = newp;
+	if (params->check && (i+1) % check_interval == 0 && 
+	    !alloc->check_incr(check_budget))
+	    app_error("incremental heap check failed in eval_mm_steady");
+    }
+
+    /* Leave an empty (but fragmented) heap for the next replay */
+    for (i = 0; i < trace->num_ids; i++)
+	if (trace->blocks[i] != NULL) {
+	    alloc->free(trace->blocks[i]);
+	    trace->blocks[i] = NULL;
+	}
+}
+
+/*
+ * cmp_double - qsort comparison function for doubles
+ */
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * elapsed_ns - Nanoseconds between two CLOCK_MONOTONIC readings
+ */
+static double elapsed_ns(struct timespec *start, struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) * 1e9 + 
+	(end->tv_nsec - start->tv_nsec);
+}
+
+/*
+ * eval_mm_latency - Replay the trace once, timing every request on its
+ *    own, and store the latency percentiles listed in lat_pct (in ns)
+ *    in lat. The cost of reading the clock is measured first and
+ *    subtracted from every sample. The trace's compaction points are
+ *    not requests and are skipped.
+ */
+static void eval_mm_latency(trace_t *trace, double *lat)
+{
+    int i, n, index, pos;
+    unsigned j;
+    double *samples, ovhd;
+    struct timespec start, end;
+    char *p;
+
+    if ((samples = (double *)malloc(trace->num_ops * sizeof(double))) == NULL)
+	unix_error("malloc failed in eval_mm_latency");
+
+    /* Take the cheapest of a few back-to-back clock reads as the overhead */
+    ovhd = DBL_MAX;
+    for (i = 0; i < 100; i++) {
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	if (elapsed_ns(&start, &end) < ovhd)
+	    ovhd = elapsed_ns(&start, &end);
+    }
+
+    mem_reset_brk();
+    if (alloc->init() < 0) 
+	app_error("mm_init failed in eval_mm_latency");
+
+    for (i = n = 0;  i < trace->num_ops;  i++) {
+	if (trace->ops[i].type == COMPACT)
+	    continue;
+	index = trace->ops[i].index;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+        switch (trace->ops[i].type) {
+        case ALLOC: /* mm_malloc */
+            p = replay_malloc(trace, i);
+	    trace->blocks[index] = p;
 	    break;
-	    
-        case FREE: /* free */
-	    free(trace->blocks[trace->ops[i].index]);
+	case REALLOC: /* mm_realloc */
+	    p = alloc->realloc(trace->blocks[index], trace->ops[i].size);
+	    trace->blocks[index] = p;
 	    break;
-
+        case FREE: /* mm_free */
+	    p = trace->blocks[index];
+            alloc->free(p);
+            break;
 	default:
-	    app_error("invalid operation type  in eval_libc_valid");
+	    app_error("Nonexistent request type in eval_mm_latency");
 	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	if (p == NULL)
+	    app_error("mm_malloc/mm_realloc failed in eval_mm_latency");
+	samples[n] = elapsed_ns(&start, &end) - ovhd;
+	if (samples[n] < 0)
+	    samples[n] = 0;
+	n++;
     }
 
+    qsort(samples, n, sizeof(double), cmp_double);
+    for (j = 0; j < NUM_LAT; j++) {
+	pos = (int)(lat_pct[j] / 100.0 * (n - 1) + 0.5);
+	lat[j] = samples[pos];
+    }
+    free(samples);
+}
+
+/*
+ * eval_mm_hw - Replay the trace once more with the hardware counters
+ *    running and store the events per op. The K-best timing runs have
+ *    already warmed the caches.
+ */
+static void eval_mm_hw(speed_t *speed_params, stats_t *stats)
+{
+    double counts[PERFCTR_NEVENTS];
+    int e;
+
+    perfctr_measure(eval_mm_speed, speed_params, counts);
+    stats->hw_counted = 1;
+    for (e = 0; e < PERFCTR_NEVENTS; e++)
+	stats->hw[e] = (counts[e] < 0) ? -1 : counts[e] / stats->ops;
+}
+
+/*
+ * block_intact - Does the payload at p still hold size bytes of the low
+ *    byte of index, as the replays filled it?
+ */
+static int block_intact(char *p, int size, int index)
+{
+    int j;
+
+    for (j = 0; j < size; j++)
+	if ((unsigned char)p[j] != (index & 0xFF))
+	    return 0;
     return 1;
 }
 
-/* 
- * eval_libc_speed - This is the function that is used by fcyc() to
- *    measure the running time of the libc malloc package on the set
- *    of traces.
+/*
+ * eval_mm_handles - Replay the trace through mm's movable blocks (-z).
+ *    Every block is allocated with mm_halloc, or only those of the 'h'
+ *    lines if the trace has any, and is locked only while the driver
+ *    touches it; the trace's 'c' lines call mm_compact. Fills in the
+ *    utilization and resident share of the heap, the compactions and
+ *    the bytes they moved, and the time spent in the requests during
+ *    which mm compacted (and in the 'c' lines). Since blocks move
+ *    behind the driver's back, their data is checked whenever they are
+ *    freed or reallocated. Returns 0 if mm got something wrong.
  */
-static void eval_libc_speed(void *ptr)
+static int eval_mm_handles(trace_t *trace, int tracenum, stats_t *stats)
 {
-    int i;
-    int index, size, newsize;
-    char *p, *newp, *oldp, *block;
-    trace_t *trace = ((speed_t *)ptr)->trace;
+    int i, index, size, oldsize;
+    int total_size = 0, max_total_size = 0;
+    mm_handle_t *handle;
+    size_t before, after, moved;
+    struct timespec start, end;
+    double ns;
+    char *p;
+
+    if ((handle = (mm_handle_t *)calloc(trace->num_ids,
+					sizeof(mm_handle_t))) == NULL)
+	unix_error("calloc failed in eval_mm_handles");
+
+    mem_release(mem_heap_lo(), (char *)mem_heap_hi() + 1);
+    mem_reset_brk();
+    if (mm_init() < 0)
+	app_error("mm_init failed in eval_mm_handles");
+    stats->pause_ns = stats->max_pause_ns = 0;
 
     for (i = 0;  i < trace->num_ops;  i++) {
+	index = trace->ops[i].index;
+	size = trace->ops[i].size;
+	mm_hinfo(&before, &moved);
+
         switch (trace->ops[i].type) {
-        case ALLOC: /* malloc */
-	    index = trace->ops[i].index;
-	    size = trace->ops[i].size;
-	    if ((p = malloc(size)) == NULL)
-		unix_error("malloc failed in eval_libc_speed");
+
+        case ALLOC: /* mm_halloc, or mm_malloc for a pinned block */
+	    clock_gettime(CLOCK_MONOTONIC, &start);
+	    if (trace->ops[i].movable || trace->movable == 0)
+		p = (handle[index] = mm_halloc(size)) ?
+		    mm_hlock(handle[index]) : NULL;
+	    else
+		p = mm_malloc(size);
+	    clock_gettime(CLOCK_MONOTONIC, &end);
+	    if (p == NULL) {
+		malloc_error(tracenum, i, "mm_halloc failed.");
+		free(handle);
+		return 0;
+	    }
+	    memset(p, index & 0xFF, size);
+	    if (handle[index])
+		mm_hunlock(handle[index]);
 	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    total_size += size;
 	    break;
 
-	case REALLOC: /* realloc */
-	    index = trace->ops[i].index;
-	    newsize = trace->ops[i].size;
-	    oldp = trace->blocks[index];
-	    if ((newp = realloc(oldp, newsize)) == NULL)
-		unix_error("realloc failed in eval_libc_speed\n");
-	    
-	    trace->blocks[index] = newp;
+        case REALLOC: /* mm_hrealloc or mm_realloc */
+	    oldsize = trace->block_sizes[index];
+	    if (handle[index]) {
+		p = mm_hlock(handle[index]);
+		if (!block_intact(p, oldsize, index)) {
+		    malloc_error(tracenum, i, "a movable block lost its data");
+		    free(handle);
+		    return 0;
+		}
+		mm_hunlock(handle[index]);
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		p = (mm_hrealloc(handle[index], size) == 0) ?
+		    mm_hlock(handle[index]) : NULL;
+		clock_gettime(CLOCK_MONOTONIC, &end);
+	    }
+	    else {
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		p = mm_realloc(trace->blocks[index], size);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+	    }
+	    if (p == NULL) {
+		malloc_error(tracenum, i, "mm_hrealloc failed.");
+		free(handle);
+		return 0;
+	    }
+	    if (!block_intact(p, (size < oldsize) ? size : oldsize, index)) {
+		malloc_error(tracenum, i, "mm_hrealloc did not preserve the "
+			     "data from old block");
+		free(handle);
+		return 0;
+	    }
+	    memset(p, index & 0xFF, size);
+	    if (handle[index])
+		mm_hunlock(handle[index]);
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    total_size += size - oldsize;
 	    break;
-	    
-        case FREE: /* free */
-	    index = trace->ops[i].index;
-	    block = trace->blocks[index];
-	    free(block);
+
+        case FREE: /* mm_hfree or mm_free */
+	    p = handle[index] ? mm_hlock(handle[index]) : trace->blocks[index];
+	    if (!block_intact(p, trace->block_sizes[index], index)) {
+		malloc_error(tracenum, i, "a movable block lost its data");
+		free(handle);
+		return 0;
+	    }
+	    clock_gettime(CLOCK_MONOTONIC, &start);
+	    if (handle[index])
+		mm_hfree(handle[index]);
+	    else
+		mm_free(p);
+	    clock_gettime(CLOCK_MONOTONIC, &end);
+	    handle[index] = 0;
+	    total_size -= trace->block_sizes[index];
+	    break;
+
+	case COMPACT: /* mm_compact */
+	    clock_gettime(CLOCK_MONOTONIC, &start);
+	    mm_compact();
+	    clock_gettime(CLOCK_MONOTONIC, &end);
 	    break;
+
+	default:
+	    app_error("Nonexistent request type in eval_mm_handles");
+        }
+
+	/* A request that compacted the heap is a pause */
+	mm_hinfo(&after, &moved);
+	if (after > before || trace->ops[i].type == COMPACT) {
+	    ns = elapsed_ns(&start, &end);
+	    stats->pause_ns += ns;
+	    if (ns > stats->max_pause_ns)
+		stats->max_pause_ns = ns;
+	}
+	if (total_size > max_total_size)
+	    max_total_size = total_size;
+
+	if (check_interval && (i+1) % check_interval == 0 &&
+	    !mm_check_incr(check_budget)) {
+	    malloc_error(tracenum, i, "incremental heap check failed");
+	    free(handle);
+	    return 0;
+	}
+    }
+    free(handle);
+
+    if (verbose > 1 && !mm_check()) {
+	malloc_error(tracenum, trace->num_ops - 1, "heap check failed");
+	return 0;
+    }
+
+    mm_hinfo(&after, &moved);
+    stats->compactions = after;
+    stats->moved = moved;
+    stats->hrss = (double)mem_resident() / (double)mem_heapsize();
+    stats->hutil = (double)max_total_size / (double)mem_heapsize();
+    return 1;
+}
+
+/*
+ * eval_libc - Check libc malloc on each of the n traces and time it with
+ *    the K-best scheme, filling in stats[0..n)
+ */
+static void eval_libc(int n, char **tracefiles, stats_t *stats, 
+		      cachemode_t mode)
+{
+    evalopts_t opts;
+    allocator_t *saved = alloc;
+
+    memset(&opts, 0, sizeof(opts));
+    opts.mode = mode;
+    eval_allocator(&libc_allocator, n, tracefiles, stats, &opts);
+    alloc = saved;
+}
+
+/*
+ * libc_thruput - Return the throughput (ops/sec) of libc malloc over the
+ *    n traces. It is taken from libc_stats if libc was already run (-l),
+ *    else from the THRUPUT_CACHE entry for key, else measured. Fresh 
+ *    measurements are appended to the cache; the last entry for a key 
+ *    wins.
+ */
+static double libc_thruput(int n, char **tracefiles, stats_t *libc_stats,
+			   char *key, int recalibrate, cachemode_t mode)
+{
+    FILE *fp;
+    char line[MAXLINE + 64], *source = "measured";
+    double kops, thru = 0, secs = 0, ops = 0;
+    stats_t *stats = libc_stats;
+    int i;
+
+    if (stats == NULL && !recalibrate && 
+	(fp = fopen(THRUPUT_CACHE, "r")) != NULL) {
+	while (fgets(line, sizeof(line), fp) != NULL) {
+	    line[strcspn(line, "\n")] = '\0';
+	    if (sscanf(line, "%lf", &kops) == 1 && strchr(line, ' ') &&
+		strcmp(strchr(line, ' ') + 1, key) == 0)
+		thru = kops * 1e3;
 	}
+	fclose(fp);
+	source = "cached";
     }
+
+    if (thru == 0) {
+	source = "measured";
+	if (stats == NULL) {
+	    if (verbose > 1)
+		printf("\nMeasuring libc malloc for the throughput reference\n");
+	    if ((stats = (stats_t *)calloc(n, sizeof(stats_t))) == NULL)
+		unix_error("calloc failed in libc_thruput");
+	    eval_libc(n, tracefiles, stats, mode);
+	}
+	for (i = 0; i < n; i++)
+	    if (stats[i].valid) {
+		secs += stats[i].secs;
+		ops += stats[i].ops;
+	    }
+	if (secs <= 0)
+	    app_error("could not measure the libc throughput reference");
+	thru = ops / secs;
+	if (stats != libc_stats)
+	    free(stats);
+	if ((fp = fopen(THRUPUT_CACHE, "a")) != NULL) {
+	    fprintf(fp, "%.0f %s\n", thru / 1e3, key);
+	    fclose(fp);
+	}
+    }
+
+    if (verbose)
+	printf("Reference throughput: %.0f Kops/sec (libc, %s)\n", 
+	       thru / 1e3, source);
+    return thru;
 }
 
 /*************************************
@@ -924,54 +1930,692 @@ static void printresults(int n, stats_t *stats)
     double secs = 0;
     double ops = 0;
     double util = 0;
+    double rss = 0;
 
     /* Print the individual results for each trace */
-    printf("%5s%7s %5s%8s%10s%6s\n", 
-	   "trace", " valid", "util", "ops", "secs", "Kops");
+    printf("%5s%7s %5s%5s%8s%10s%6s\n", 
+	   "trace", " valid", "util", "rss", "ops", "secs", "Kops");
     for (i=0; i < n; i++) {
 	if (stats[i].valid) {
-	    printf("%2d%10s%5.0f%%%8.0f%10.6f%6.0f\n", 
+	    printf("%2d%10s%5.0f%%%4.0f%%%8.0f%10.6f%6.0f\n", 
 		   i,
 		   "yes",
 		   stats[i].util*100.0,
+		   stats[i].rss*100.0,
 		   stats[i].ops,
 		   stats[i].secs,
 		   (stats[i].ops/1e3)/stats[i].secs);
 	    secs += stats[i].secs;
 	    ops += stats[i].ops;
 	    util += stats[i].util;
+	    rss += stats[i].rss;
 	}
 	else {
-	    printf("%2d%10s%6s%8s%10s%6s\n", 
+	    printf("%2d%10s%6s%5s%8s%10s%6s\n", 
 		   i,
 		   "no",
 		   "-",
 		   "-",
 		   "-",
+		   "-",
 		   "-");
 	}
     }
 
     /* Print the aggregate results for the set of traces */
     if (errors == 0) {
-	printf("%12s%5.0f%%%8.0f%10.6f%6.0f\n", 
+	printf("%12s%5.0f%%%4.0f%%%8.0f%10.6f%6.0f\n", 
 	       "Total       ",
 	       (util/n)*100.0,
+	       (rss/n)*100.0,
 	       ops, 
 	       secs,
 	       (ops/1e3)/secs);
     }
     else {
-	printf("%12s%6s%8s%10s%6s\n", 
+	printf("%12s%6s%5s%8s%10s%6s\n", 
 	       "Total       ",
 	       "-", 
 	       "-", 
 	       "-", 
+	       "-", 
 	       "-");
     }
 
 }
 
+/*
+ * printhw - prints the hardware events per op for each trace, with
+ *     "-" for events that could not be counted
+ */
+static void printhw(int n, stats_t *stats)
+{
+    static char *heads[PERFCTR_NEVENTS] = 
+	{"cycles", "instrs", "brmiss", "L1Dmiss", "LLCmiss", "dTLBmiss"};
+    int i, e;
+
+    printf("%5s", "trace");
+    for (e = 0; e < PERFCTR_NEVENTS; e++)
+	printf("%10s", heads[e]);
+    printf("%6s\n", "IPC");
+    for (i = 0; i < n; i++) {
+	printf("%5d", i);
+	for (e = 0; e < PERFCTR_NEVENTS; e++) {
+	    if (!stats[i].valid || stats[i].hw[e] < 0)
+		printf("%10s", "-");
+	    else
+		printf("%10.2f", stats[i].hw[e]);
+	}
+	if (stats[i].valid && stats[i].hw[PERFCTR_CYCLES] > 0 &&
+	    stats[i].hw[PERFCTR_INSTRUCTIONS] >= 0)
+	    printf("%6.2f\n", stats[i].hw[PERFCTR_INSTRUCTIONS] / 
+		   stats[i].hw[PERFCTR_CYCLES]);
+	else
+	    printf("%6s\n", "-");
+    }
+}
+
+/*
+ * printbench - prints the -B timing statistics for each trace
+ */
+static void printbench(int n, stats_t *stats)
+{
+    int i;
+    bench_t *b;
+
+    printf("%5s%12s%25s%8s\n", "trace", "median(s)", "95% CI", "CV");
+    for (i = 0; i < n; i++) {
+	b = &stats[i].bench;
+	if (!stats[i].valid || b->n == 0) {
+	    printf("%5d%12s\n", i, "-");
+	    continue;
+	}
+	printf("%5d%12.6f  [%10.6f, %10.6f]%7.1f%%%s\n", i, b->median, 
+	       b->ci_lo, b->ci_hi, b->cv * 100.0, b->noisy ? "  NOISY" : "");
+    }
+}
+
+/*
+ * printmmstats - prints the counters mm.c kept while each trace was
+ *     checked for correctness (-s): calls, splits, the four coalesce
+ *     cases, heap extensions, blocks cut from the top of the heap,
+ *     blocks visited per search, bytes granted as a percentage of bytes
+ *     requested, the peak number of free and of all blocks, and the same
+ *     two counts at the end of the trace.
+ *     Only the last two are known unless mm.c was built with MM_STATS.
+ */
+static void printmmstats(int n, stats_t *stats)
+{
+    int i;
+    mm_stats_t *st;
+
+    for (i = 0; i < n && !(stats[i].valid && stats[i].counted); i++)
+	;
+    if (i == n)
+	printf("(mm.c was built without MM_STATS; make clean; "
+	       "make MMFLAGS=-DMM_STATS for the counters)\n");
+
+    printf("%5s%7s%7s%8s%7s%8s%8s%8s%8s%7s%7s%7s%6s%8s%8s%8s%8s\n", "trace", 
+	   "malloc", "free", "realloc", "split", "co-none", "co-prev", 
+	   "co-next", "co-both", "extend", "wild", "steps", "grant", 
+	   "maxfree", "maxblk", "freeblk", "blocks");
+    for (i = 0; i < n; i++) {
+	st = &stats[i].mm;
+	if (!stats[i].valid) {
+	    printf("%5d%8s\n", i, "-");
+	    continue;
+	}
+	printf("%5d", i);
+	if (stats[i].counted)
+	    printf("%7lu%7lu%8lu%7lu%8lu%8lu%8lu%8lu%7lu%7lu%7.0f%5.0f%%%8lu%8lu",
+		   (unsigned long)st->mallocs, (unsigned long)st->frees,
+		   (unsigned long)st->reallocs, (unsigned long)st->splits,
+		   (unsigned long)st->coalesce[0], 
+		   (unsigned long)st->coalesce[1], 
+		   (unsigned long)st->coalesce[2], 
+		   (unsigned long)st->coalesce[3], 
+		   (unsigned long)st->extends,
+		   (unsigned long)st->wild_allocs,
+		   st->searches ? (double)st->search_steps / st->searches : 0,
+		   st->bytes_requested ? 
+		   100.0 * st->bytes_granted / st->bytes_requested : 0,
+		   (unsigned long)st->max_free_blocks,
+		   (unsigned long)st->max_heap_blocks);
+	else
+	    printf("%7s%7s%8s%7s%8s%8s%8s%8s%7s%7s%7s%6s%8s%8s", "-", "-", 
+		   "-", "-", "-", "-", "-", "-", "-", "-", "-", "-", "-", "-");
+	printf("%8lu%8lu\n", (unsigned long)st->free_blocks, 
+	       (unsigned long)st->heap_blocks);
+    }
+}
+
+/*
+ * hist_pct - the histogram bucket that holds the pct'th percentile of
+ *     the total entries in hist[0..MM_STATS_BUCKETS)
+ */
+static int hist_pct(size_t *hist, size_t total, double pct)
+{
+    size_t sum = 0;
+    int b;
+
+    for (b = 0; b < MM_STATS_BUCKETS - 1; b++) {
+	sum += hist[b];
+	if (sum >= pct / 100.0 * total)
+	    break;
+    }
+    return b;
+}
+
+/*
+ * printsearchrow - prints one row of the printsearch table for a size
+ *     class (or all of them) with the given search statistics
+ */
+static void printsearchrow(char *trace, char *class, size_t searches, 
+			   size_t steps, size_t maxsteps, size_t hdr, 
+			   size_t span, size_t *hist)
+{
+    static double pcts[] = {50.0, 90.0, 99.0};
+    char buf[32];
+    int k, b;
+
+    printf("%5s  %-16s%9lu%9.1f", trace, class, (unsigned long)searches,
+	   (double)steps / searches);
+    for (k = 0; k < 3; k++) {
+	b = hist_pct(hist, searches, pcts[k]);
+	if (b == MM_STATS_BUCKETS - 1)
+	    sprintf(buf, ">=%lu", 1UL << b);
+	else
+	    sprintf(buf, "<%lu", 1UL << (b + 1));
+	printf("%9s", buf);
+    }
+    printf("%9lu%10.1f%10.1f\n", (unsigned long)maxsteps, 
+	   (double)hdr / searches, (double)span / searches / 1024);
+}
+
+/*
+ * printsearch - prints how many blocks mm.c's free block searches visited
+ *     on each trace (-H), broken down by the size class of the request.
+ *     The percentiles come from power-of-two histograms, so they are 
+ *     shown as the bound of their bucket. hdrB is the bytes of block
+ *     tags read and spanKB the stretch of heap walked, per search.
+ */
+static void printsearch(int n, stats_t *stats)
+{
+    int i, c, b;
+    char trace[16], class[32];
+    size_t hist[MM_STATS_BUCKETS];
+    size_t steps, hdr, span, maxsteps;
+    mm_stats_t *st;
+
+    for (i = 0; i < n && !(stats[i].valid && stats[i].counted); i++)
+	;
+    if (i == n) {
+	printf("(mm.c was built without MM_STATS; make clean; "
+	       "make MMFLAGS=-DMM_STATS for the histograms)\n");
+	return;
+    }
+
+    printf("%5s  %-16s%9s%9s%9s%9s%9s%9s%10s%10s\n", "trace", "size class",
+	   "searches", "mean", "p50", "p90", "p99", "max", "hdrB", "spanKB");
+    for (i = 0; i < n; i++) {
+	st = &stats[i].mm;
+	sprintf(trace, "%d", i);
+	if (!stats[i].valid || !stats[i].counted || st->searches == 0) {
+	    printf("%5s  %-16s\n", trace, "-");
+	    continue;
+	}
+	memset(hist, 0, sizeof(hist));
+	steps = hdr = span = maxsteps = 0;
+	for (c = 0; c < MM_STATS_CLASSES; c++) {
+	    if (st->class_searches[c] == 0)
+		continue;
+	    if (c == MM_STATS_CLASSES - 1)
+		sprintf(class, "%lu+", 1UL << (c + 4));
+	    else
+		sprintf(class, "%lu-%lu", 1UL << (c + 4), 
+			(1UL << (c + 5)) - 1);
+	    printsearchrow(trace, class, st->class_searches[c], 
+			   st->class_steps[c], st->class_max_steps[c], 
+			   st->class_hdr_bytes[c], st->class_span[c],
+			   st->search_hist[c]);
+	    trace[0] = '\0';
+	    for (b = 0; b < MM_STATS_BUCKETS; b++)
+		hist[b] += st->search_hist[c][b];
+	    steps += st->class_steps[c];
+	    hdr += st->class_hdr_bytes[c];
+	    span += st->class_span[c];
+	    if (st->class_max_steps[c] > maxsteps)
+		maxsteps = st->class_max_steps[c];
+	}
+	printsearchrow(trace, "all", st->searches, steps, maxsteps, hdr, 
+		       span, hist);
+    }
+}
+
+/*
+ * printoverhead - prints the time each trace took with and without an
+ *     optional feature (the -k checker or the -q profiler), and what the
+ *     feature costs
+ */
+static void printoverhead(int n, stats_t *stats, overhead_t what)
+{
+    int i;
+    double with, without, secs = 0, base_secs = 0;
+
+    printf("%5s%12s%12s%10s\n", "trace", "without", "with", "overhead");
+    for (i = 0; i < n; i++) {
+	if (!stats[i].valid) {
+	    printf("%5d%12s\n", i, "-");
+	    continue;
+	}
+	if (what == OVERHEAD_CHECK) {
+	    without = stats[i].secs;
+	    with = stats[i].check_secs;
+	}
+	else {
+	    without = stats[i].noprof_secs;
+	    with = stats[i].secs;
+	}
+	printf("%5d%12.6f%12.6f%9.1f%%\n", i, without, with,
+	       100.0 * (with / without - 1.0));
+	secs += with;
+	base_secs += without;
+    }
+    if (base_secs > 0)
+	printf("%5s%12.6f%12.6f%9.1f%%\n", "Total", base_secs, secs,
+	       100.0 * (secs / base_secs - 1.0));
+}
+
+/*
+ * printhandles - prints the utilization of each trace with mm_malloc and
+ *     through mm's movable blocks (-z), how much of the heap the latter
+ *     left resident, and what its compactions cost: how many there were,
+ *     the bytes they moved, and the total and longest pause
+ */
+static void printhandles(int n, stats_t *stats)
+{
+    int i, nvalid = 0;
+    double util = 0, hutil = 0, hrss = 0, compactions = 0, moved = 0;
+    double pause = 0, max_pause = 0;
+
+    printf("%5s%8s%9s%8s%10s%10s%10s%10s\n", "trace", "util", "movable", 
+	   "rss", "compacts", "moved KB", "pause ms", "max us");
+    for (i = 0; i < n; i++) {
+	if (!stats[i].valid) {
+	    printf("%5d%8s\n", i, "-");
+	    continue;
+	}
+	printf("%5d%7.0f%%%8.0f%%%7.0f%%%10.0f%10.0f%10.3f%10.1f\n", i,
+	       stats[i].util * 100.0, stats[i].hutil * 100.0,
+	       stats[i].hrss * 100.0, stats[i].compactions,
+	       stats[i].moved / 1024, stats[i].pause_ns / 1e6,
+	       stats[i].max_pause_ns / 1e3);
+	nvalid++;
+	util += stats[i].util;
+	hutil += stats[i].hutil;
+	hrss += stats[i].hrss;
+	compactions += stats[i].compactions;
+	moved += stats[i].moved;
+	pause += stats[i].pause_ns;
+	if (stats[i].max_pause_ns > max_pause)
+	    max_pause = stats[i].max_pause_ns;
+    }
+    if (nvalid > 0)
+	printf("%5s%7.0f%%%8.0f%%%7.0f%%%10.0f%10.0f%10.3f%10.1f\n", "Total",
+	       util / nvalid * 100.0, hutil / nvalid * 100.0,
+	       hrss / nvalid * 100.0, compactions, moved / 1024, pause / 1e6,
+	       max_pause / 1e3);
+}
+
+/*
+ * printcompare - prints the utilization and throughput of each of the
+ *     nalloc packages side by side, one row per trace
+ */
+static void printcompare(int n, char **tracefiles, int nalloc, 
+			 allocator_t **allocs, stats_t **stats)
+{
+    int i, k, valid;
+    double secs, ops, util;
+
+    printf("Comparison (util / Kops):\n");
+    printf("%-20s", "trace");
+    for (k = 0; k < nalloc; k++)
+	printf("%16s", allocs[k]->name);
+    printf("\n");
+    for (i = 0; i < n; i++) {
+	printf("%-20s", tracefiles[i]);
+	for (k = 0; k < nalloc; k++) {
+	    if (!stats[k][i].valid)
+		printf("%16s", "-");
+	    else if (allocs[k]->uses_memlib)
+		printf("%5.0f%% / %7.0f", stats[k][i].util * 100.0,
+		       (stats[k][i].ops/1e3) / stats[k][i].secs);
+	    else
+		printf("%6s / %7.0f", "-", 
+		       (stats[k][i].ops/1e3) / stats[k][i].secs);
+	}
+	printf("\n");
+    }
+    printf("%-20s", "total");
+    for (k = 0; k < nalloc; k++) {
+	secs = ops = util = 0;
+	valid = 1;
+	for (i = 0; i < n; i++) {
+	    valid &= stats[k][i].valid;
+	    secs += stats[k][i].secs;
+	    ops += stats[k][i].ops;
+	    util += stats[k][i].util;
+	}
+	if (!valid)
+	    printf("%16s", "-");
+	else if (allocs[k]->uses_memlib)
+	    printf("%5.0f%% / %7.0f", util / n * 100.0, (ops/1e3) / secs);
+	else
+	    printf("%6s / %7.0f", "-", (ops/1e3) / secs);
+    }
+    printf("\n");
+}
+
+/*****************************************************************
+ * The following routines save results as JSON and compare them 
+ * against a previously saved baseline. The reader only understands 
+ * the flat layout produced by write_json: one object per trace with
+ * number and string members, plus a "total" object.
+ ****************************************************************/
+
+/*
+ * write_json - Write the mm results for n traces to file
+ */
+static void write_json(char *file, int n, char **tracefiles, stats_t *stats,
+		       double perfindex)
+{
+    FILE *fp;
+    int i;
+    unsigned j;
+    double secs = 0, ops = 0, util = 0, noise = 0;
+
+    if ((fp = fopen(file, "w")) == NULL) {
+	sprintf(msg, "Could not open %s in write_json", file);
+	unix_error(msg);
+    }
+
+    fprintf(fp, "{\n  \"team\": \"%s\",\n  \"traces\": [\n", team.teamname);
+    for (i = 0; i < n; i++) {
+	fprintf(fp, "    {\"name\": \"%s\", \"valid\": %d", 
+		tracefiles[i], stats[i].valid);
+	if (stats[i].valid) {
+	    fprintf(fp, ", \"util\": %.6f, \"ops\": %.0f, \"secs\": %.9f, "
+		    "\"kops\": %.3f, \"noise\": %.6f",
+		    stats[i].util, stats[i].ops, stats[i].secs, 
+		    (stats[i].ops/1e3)/stats[i].secs, stats[i].noise);
+	    for (j = 0; j < NUM_LAT; j++)
+		fprintf(fp, ", \"%s\": %.1f", lat_names[j], stats[i].lat[j]);
+	    for (j = 0; j < PERFCTR_NEVENTS; j++)
+		if (stats[i].hw_counted && stats[i].hw[j] >= 0)
+		    fprintf(fp, ", \"hw_%s\": %.3f", perfctr_names[j], 
+			    stats[i].hw[j]);
+	    if (stats[i].bench.n > 0) {
+		fprintf(fp, ", \"median\": %.9f, \"ci_lo\": %.9f, "
+			"\"ci_hi\": %.9f, \"cv\": %.6f, \"noisy\": %d, "
+			"\"samples\": [",
+			stats[i].bench.median, stats[i].bench.ci_lo,
+			stats[i].bench.ci_hi, stats[i].bench.cv, 
+			stats[i].bench.noisy);
+		for (j = 0; j < (unsigned)stats[i].bench.n; j++)
+		    fprintf(fp, "%s%.9f", j ? ", " : "", 
+			    stats[i].bench.samples[j]);
+		fprintf(fp, "]");
+	    }
+	    secs += stats[i].secs;
+	    ops += stats[i].ops;
+	    util += stats[i].util;
+	    noise += stats[i].noise * stats[i].secs;
+	}
+	fprintf(fp, "}%s\n", (i < n-1) ? "," : "");
+    }
+    fprintf(fp, "  ],\n");
+    if (errors == 0 && secs > 0)
+	fprintf(fp, "  \"total\": {\"name\": \"total\", \"valid\": 1, "
+		"\"util\": %.6f, \"ops\": %.0f, \"secs\": %.9f, "
+		"\"kops\": %.3f, \"noise\": %.6f},\n",
+		util/n, ops, secs, (ops/1e3)/secs, noise/secs);
+    else
+	fprintf(fp, "  \"total\": {\"name\": \"total\", \"valid\": 0},\n");
+    fprintf(fp, "  \"perfindex\": %.1f\n}\n", perfindex);
+    fclose(fp);
+}
+
+/*
+ * json_member - Find "key": inside the object text [obj, end) and 
+ *    return a pointer to the start of its value, or NULL
+ */
+static char *json_member(char *obj, char *end, char *key)
+{
+    char pattern[MAXLINE];
+    char *p;
+    size_t len;
+
+    sprintf(pattern, "\"%s\"", key);
+    len = strlen(pattern);
+    for (p = obj; p + len <= end; p++) {
+	if (strncmp(p, pattern, len) == 0) {
+	    p += len;
+	    while (p < end && (*p == ' ' || *p == ':'))
+		p++;
+	    return (p < end) ? p : NULL;
+	}
+    }
+    return NULL;
+}
+
+/*
+ * json_number - Read the numeric member key of [obj, end) into *val.
+ *    Returns 0 if there is no such member.
+ */
+static int json_number(char *obj, char *end, char *key, double *val)
+{
+    char *p = json_member(obj, end, key);
+
+    if (p == NULL)
+	return 0;
+    *val = strtod(p, NULL);
+    return 1;
+}
+
+/*
+ * json_array - Read the numeric array member key of [obj, end) into a
+ *    newly allocated array *vals. Returns the number of elements, or 0 
+ *    if there is no such member.
+ */
+static int json_array(char *obj, char *end, char *key, double **vals)
+{
+    char *p = json_member(obj, end, key), *next;
+    int n = 0, max = 64;
+
+    if (p == NULL || *p != '[')
+	return 0;
+    if ((*vals = (double *)malloc(max * sizeof(double))) == NULL)
+	unix_error("malloc failed in json_array");
+    for (p++; p < end && *p != ']'; p = next) {
+	(*vals)[n] = strtod(p, &next);
+	if (next == p)
+	    break;
+	if (++n == max) {
+	    max *= 2;
+	    if ((*vals = (double *)realloc(*vals, max * sizeof(double))) == NULL)
+		unix_error("realloc failed in json_array");
+	}
+	while (next < end && (*next == ',' || *next == ' '))
+	    next++;
+    }
+    if (n == 0)
+	free(*vals);
+    return n;
+}
+
+/*
+ * json_object - Find the baseline object whose "name" member is name.
+ *    On success, set *end to just past the object and return its start.
+ */
+static char *json_object(char *text, char *name, char **end)
+{
+    char pattern[MAXLINE];
+    char *p, *obj;
+
+    sprintf(pattern, "\"name\": \"%s\"", name);
+    if ((p = strstr(text, pattern)) == NULL)
+	return NULL;
+    for (obj = p; obj > text && *obj != '{'; obj--)
+	;
+    if ((*end = strchr(p, '}')) == NULL)
+	return NULL;
+    return obj;
+}
+
+/*
+ * compare_values - Compare one set of results against the baseline
+ *    numbers and print a line for it. Util is deterministic, so it must
+ *    stay within tolerance percent. Throughput must stay within 
+ *    tolerance percent plus the measurement noise of both runs, unless
+ *    the caller ran a significance test (nbase > 0), in which case a 
+ *    drop beyond tolerance only counts if pvalue is below BENCH_ALPHA.
+ *    Returns the number of regressions found (0, 1 or 2).
+ */
+static int compare_values(char *label, double base_util, double base_kops,
+			  double base_noise, double util, double kops, 
+			  double noise, int nbase, double pvalue, 
+			  double tolerance)
+{
+    double slack = tolerance/100.0 + noise + base_noise;
+    int found = 0, slower;
+
+    if (nbase > 0)
+	slower = (kops < base_kops * (1.0 - tolerance/100.0)) && 
+	    pvalue < BENCH_ALPHA;
+    else
+	slower = kops < base_kops * (1.0 - slack);
+
+    printf("%-20s%6.1f%%%7.1f%%%10.0f%10.0f%+8.1f%%", label, base_util*100.0,
+	   util*100.0, base_kops, kops, (kops/base_kops - 1.0)*100.0);
+    if (nbase > 0)
+	printf("%8.4f", pvalue);
+    else
+	printf("%8s", "-");
+    if (util < base_util * (1.0 - tolerance/100.0)) {
+	printf("  UTIL");
+	found++;
+    }
+    if (slower) {
+	printf("  THRU");
+	found++;
+    }
+    printf("\n");
+    return found;
+}
+
+/*
+ * compare_one - Compare one trace's results against its baseline 
+ *    object [obj, end). When both runs kept their -B samples, the 
+ *    Mann-Whitney test decides whether a throughput drop is real.
+ *    Returns the number of regressions found.
+ */
+static int compare_one(char *label, char *obj, char *end, double util, 
+		       double kops, double noise, bench_t *b, 
+		       double tolerance)
+{
+    double base_util, base_kops, base_noise = 0, pvalue = 1.0;
+    double *base_samples;
+    int nbase = 0;
+
+    if (!json_number(obj, end, "util", &base_util) ||
+	!json_number(obj, end, "kops", &base_kops)) {
+	printf("%-20s%10s\n", label, "no baseline");
+	return 0;
+    }
+    json_number(obj, end, "noise", &base_noise);
+
+    if (b != NULL && b->n > 0 &&
+	(nbase = json_array(obj, end, "samples", &base_samples)) > 0) {
+	pvalue = bench_mannwhitney(b->samples, b->n, base_samples, nbase);
+	free(base_samples);
+    }
+    return compare_values(label, base_util, base_kops, base_noise, util,
+			  kops, noise, nbase, pvalue, tolerance);
+}
+
+/*
+ * compare_baseline - Compare the mm results against the JSON results 
+ *    saved in file by an earlier -j run, trace by trace, and return the 
+ *    number of regressions found. The total line sums both runs over 
+ *    the same traces: those that have a baseline.
+ */
+static int compare_baseline(char *file, int n, char **tracefiles, 
+			    stats_t *stats, double tolerance)
+{
+    FILE *fp;
+    char *text, *obj, *end;
+    long len;
+    int i, found = 0, matched = 0;
+    double secs = 0, ops = 0, util = 0, noise = 0;
+    double b_secs = 0, b_ops = 0, b_util = 0, b_noise = 0;
+    double v_secs, v_ops, v_util, v_noise;
+    char label[MAXLINE];
+
+    if ((fp = fopen(file, "r")) == NULL) {
+	sprintf(msg, "Could not open baseline %s", file);
+	unix_error(msg);
+    }
+    fseek(fp, 0, SEEK_END);
+    len = ftell(fp);
+    rewind(fp);
+    if ((text = (char *)malloc(len + 1)) == NULL)
+	unix_error("malloc failed in compare_baseline");
+    text[fread(text, 1, len, fp)] = '\0';
+    fclose(fp);
+
+    printf("\nComparison against %s (tolerance %.1f%%):\n", file, tolerance);
+    printf("%-20s%7s%8s%10s%10s%9s%8s\n", 
+	   "trace", "b-util", "util", "b-Kops", "Kops", "change", "p");
+    for (i = 0; i < n; i++) {
+	if (!stats[i].valid)
+	    continue;
+	if ((obj = json_object(text, tracefiles[i], &end)) == NULL) {
+	    printf("%-20s%10s\n", tracefiles[i], "no baseline");
+	    continue;
+	}
+	found += compare_one(tracefiles[i], obj, end, stats[i].util, 
+			     (stats[i].ops/1e3)/stats[i].secs, stats[i].noise,
+			     &stats[i].bench, tolerance);
+	if (!json_number(obj, end, "util", &v_util) ||
+	    !json_number(obj, end, "ops", &v_ops) ||
+	    !json_number(obj, end, "secs", &v_secs) || v_secs <= 0)
+	    continue;
+	v_noise = 0;
+	json_number(obj, end, "noise", &v_noise);
+	b_secs += v_secs;
+	b_ops += v_ops;
+	b_util += v_util;
+	b_noise += v_noise * v_secs;
+	secs += stats[i].secs;
+	ops += stats[i].ops;
+	util += stats[i].util;
+	noise += stats[i].noise * stats[i].secs;
+	matched++;
+    }
+    if (errors == 0 && matched > 0) {
+	if (matched < n)
+	    sprintf(label, "total (%d of %d)", matched, n);
+	else
+	    strcpy(label, "total");
+	found += compare_values(label, b_util/matched, (b_ops/1e3)/b_secs, 
+				b_noise/b_secs, util/matched, (ops/1e3)/secs,
+				noise/secs, 0, 1.0, tolerance);
+    }
+
+    free(text);
+    return found;
+}
+
 /* 
  * app_error - Report an arbitrary application error
  */
@@ -1004,14 +2648,44 @@ void malloc_error(int tracenum, int opnum, char *msg)
  */
 static void usage(void) 
 {
-    fprintf(stderr, "Usage: mdriver [-hvVal] [-f <file>] [-t <dir>]\n");
+    fprintf(stderr, "Usage: mdriver [-hvValpRsHz] [-f <file>] [-t <dir>] "
+	    "[-u <file> [-i <n>]]\n"
+	    "               [-j <file>] [-b <file> [-T <pct>]]\n"
+	    "               [-B <n> [-W <n>] [-P <cpu>]] [-m <mode>]\n"
+	    "               [-c <kops>|auto] [-w <wt>] [-A <pkg>,...|all]\n"
+	    "               [-d <file> [-D <op>|peak|end,...]] [-k <n> [-K <n>]]\n"
+	    "               [-q <n>] [-Q <file>] [-L hint|predict]\n");
     fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-A <pkgs>  Also run these packages (or all) and compare them.\n");
     fprintf(stderr, "\t-a         Don't check the team structure.\n");
+    fprintf(stderr, "\t-B <n>     Time <n> runs per trace; report median, CI and CV.\n");
+    fprintf(stderr, "\t-b <file>  Compare against baseline JSON <file>; exit %d on regression.\n", REGRESSION_EXIT);
+    fprintf(stderr, "\t-c <kops>  Throughput for full marks, or auto to measure libc (default).\n");
+    fprintf(stderr, "\t-d <file>  Write heap snapshots of mm to <file> for heapanalyze.\n");
+    fprintf(stderr, "\t-D <ops>   Snapshot after these ops, peak or end (default peak,end).\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
     fprintf(stderr, "\t-g         Generate summary info for autograder.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-H         Print how many blocks mm.c's searches visit.\n");
+    fprintf(stderr, "\t-i <n>     Sample the -u timeline every <n> ops.\n");
+    fprintf(stderr, "\t-j <file>  Write the results as JSON to <file>.\n");
+    fprintf(stderr, "\t-k <n>     Check part of the heap every <n> ops; report the cost.\n");
+    fprintf(stderr, "\t-K <n>     Blocks the -k checker looks at each time (default %d).\n", DEFAULT_CHECK_BUDGET);
     fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+    fprintf(stderr, "\t-L <how>   Place mm's short lived blocks apart: hint from the trace or predict.\n");
+    fprintf(stderr, "\t-m <mode>  Time with cold (default), warm or steady caches.\n");
+    fprintf(stderr, "\t-P <cpu>   Pin to <cpu> for -B (default: the current one).\n");
+    fprintf(stderr, "\t-p         Count hardware events per op (Linux perf).\n");
+    fprintf(stderr, "\t-q <n>     Sample every <n> bytes in mm's heap profiler; report the cost.\n");
+    fprintf(stderr, "\t-Q <file>  Write mm's heap profile at each trace's peak to <file>.\n");
+    fprintf(stderr, "\t-s         Print mm.c's internal counters for each trace.\n");
+    fprintf(stderr, "\t-R         Remeasure the libc reference instead of using %s.\n", THRUPUT_CACHE);
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
+    fprintf(stderr, "\t-T <pct>   Regression tolerance for -b in percent (default %.0f).\n", DEFAULT_TOLERANCE);
+    fprintf(stderr, "\t-u <file>  Write a fragmentation timeline (CSV) to <file>.\n");
     fprintf(stderr, "\t-v         Print per-trace performance breakdowns.\n");
     fprintf(stderr, "\t-V         Print additional debug info.\n");
+    fprintf(stderr, "\t-w <wt>    Weight of utilization in the index (default %.2f).\n", UTIL_WEIGHT);
+    fprintf(stderr, "\t-W <n>     Untimed warmup runs before -B (default %d).\n", DEFAULT_WARMUP);
+    fprintf(stderr, "\t-z         Replay through mm's movable blocks too; report util and pauses.\n");
 }
@@ -9,6 +9,7 @@
 #include <unistd.h>
 #include <sys/mman.h>
 #include <string.h>
+#include <stdint.h>
 #include <errno.h>
 
 #include "memlib.h"
@@ -21,9 +22,22 @@ static char *mem_max_addr;   /* largest legal heap address */
 
 /* 
  * mem_init - initialize the memory system model
+ *
+ * Built with MEMLIB_OS (for libmm.so), the heap is a lazily backed
+ * mapping of OS_MAX_HEAP bytes instead, since malloc is not available
+ * to the allocator that replaces it.
  */
 void mem_init(void)
 {
+#ifdef MEMLIB_OS
+    mem_start_brk = mmap(NULL, OS_MAX_HEAP, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mem_start_brk == MAP_FAILED) {
+	mem_start_brk = NULL;
+	return;
+    }
+    mem_max_addr = mem_start_brk + OS_MAX_HEAP;
+#else
     /* allocate the storage we will use to model the available VM */
     if ((mem_start_brk = (char *)malloc(MAX_HEAP)) == NULL) {
 	fprintf(stderr, "mem_init_vm: malloc error\n");
@@ -31,6 +45,7 @@ void mem_init(void)
     }
 
     mem_max_addr = mem_start_brk + MAX_HEAP;  /* max legal heap address */
+#endif
     mem_brk = mem_start_brk;                  /* heap is empty initially */
 }
 
@@ -39,7 +54,11 @@ void mem_init(void)
  */
 void mem_deinit(void)
 {
+#ifdef MEMLIB_OS
+    munmap(mem_start_brk, OS_MAX_HEAP);
+#else
     free(mem_start_brk);
+#endif
 }
 
 /*
@@ -61,7 +80,9 @@ void *mem_sbrk(int incr)
 
     if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr)) {
 	errno = ENOMEM;
+#ifndef MEMLIB_OS
 	fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
+#endif
 	return (void *)-1;
     }
     mem_brk += incr;
@@ -99,3 +120,48 @@ size_t mem_pagesize()
 {
     return (size_t)getpagesize();
 }
+
+/*
+ * mem_release - give the pages that lie wholly inside [lo, hi) back to
+ *    the OS. They stay part of the heap and read as zeros when they are
+ *    next touched. MADV_FREE would be cheaper, but the pages would only
+ *    leave the resident set once the kernel ran short of memory.
+ */
+void mem_release(void *lo, void *hi)
+{
+    uintptr_t page = mem_pagesize();
+    uintptr_t start = ((uintptr_t)lo + page - 1) & ~(page - 1);
+    uintptr_t end = (uintptr_t)hi & ~(page - 1);
+
+    if (end > start)
+	madvise((void *)start, end - start, MADV_DONTNEED);
+}
+
+/*
+ * mem_resident - returns how many bytes of the heap are in memory
+ */
+size_t mem_resident()
+{
+    unsigned char vec[256];
+    size_t page = mem_pagesize();
+    char *p = (char *)((uintptr_t)mem_start_brk & ~(page - 1));
+    char *lo, *hi;
+    size_t i, n, bytes = 0;
+
+    while (p < mem_brk) {
+	n = (mem_brk - p + page - 1) / page;
+	if (n > sizeof(vec))
+	    n = sizeof(vec);
+	if (mincore(p, n * page, vec) < 0)
+	    return 0;
+	for (i = 0; i < n; i++, p += page) {
+	    if (!(vec[i] & 1))
+		continue;
+	    /* Only count the part of the page that is heap */
+	    lo = (p < mem_start_brk) ? mem_start_brk : p;
+	    hi = (p + page > mem_brk) ? mem_brk : p + page;
+	    bytes += hi - lo;
+	}
+    }
+    return bytes;
+}
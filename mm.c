@@ -11,9 +11,20 @@
 #include <unistd.h>
 #include <string.h>
 #include <stdint.h>
+#include <sys/mman.h>
+#ifdef __GLIBC__
+#include <execinfo.h>
+#endif
 
 #include "mm.h"
 #include "memlib.h"
+#include "allocator.h"
+#if defined(MM_SIZECLASSES) || defined(MM_PAGEMAP)
+#include "sizeclass.h"
+#endif
+#ifdef MM_PAGEMAP
+#include "pagemap.h"
+#endif
 
 /* Team information. */
 team_t team = {
@@ -39,362 +50,2329 @@ static void * extend_heap( size_t units );
 // Coalesce adjacent free blocks
 static void * coalesce( void * bp );
 
-//Find a free block of appropriate size
+//Find a free block of appropriate size, by the placement policy
 static void * findSpace( size_t size );
 
+//Point anything that pointed inside a block that was just merged at its start
+static void merged( void * bp, size_t sz );
+
+#ifdef MM_DEFERRED_COALESCE
+//Merge the free blocks after a free block into it
+static size_t merge_run( void * bp );
+#endif
+
+//Find the highest free block of appropriate size, for short lived blocks
+static void * findSpaceTop( size_t size );
+
 //Allocate space at bp of size bytes
 static void place( void * bp, size_t size );
 
+//Allocate space at the high end of bp, returning where it went
+static void * place_top( void * bp, size_t size );
+
+//The free block at the top of the heap, if there is one
+static void * wild_block( void );
+
+//Allocate space from the top of the heap, growing it if need be
+static void * place_wild( size_t size );
+
+//malloc and free without the call counting, for use inside mm.c
+static void * malloc_block( size_t size, int life );
+static void free_block( void * ptr );
+
+//Slide the movable blocks down over the free space below them
+static size_t compact( void );
+
+//memalign without the call counting: the payload lands skew bytes past
+//  a multiple of alignment
+static void * align_block( size_t alignment, size_t skew, size_t size );
+
 void prnHeap();
 
 /*
  * Constant definitions
+ *
+ * The block geometry and the policies are picked when mm.c is compiled,
+ * so none of them costs a branch at run time (the Makefile's VARIANTS
+ * build several of these side by side):
+ *   -DMM_WIDE_TAGS          8 byte tags instead of 4, for blocks of 4GB and up
+ *   -DMM_ALIGNMENT=n        payload alignment, a power of two from 8, default 8
+ *   -DMM_PAGE_SIZE=n        heap growth and span size, default 4096
+ *   -DMM_NEXT_FIT           searches start where the last one left off
+ *   -DMM_BEST_FIT           searches take the smallest block that fits
+ *   -DMM_DEFERRED_COALESCE  free blocks merge when a search walks over them
+ * The default is first fit with immediate coalescing.
  */
 
 #define DEBUG 1
 
+#ifdef MM_WIDE_TAGS
+typedef uint64_t tag_t;
+#define WORD_SIZE   8
+#define DWORD_SIZE  16
+#else
+typedef uint32_t tag_t;
 #define WORD_SIZE   4
 #define DWORD_SIZE  8
+#endif
 
+#ifdef MM_ALIGNMENT
+#define ALIGNMENT   MM_ALIGNMENT //libmm.so builds with 16, as the x86-64 ABI expects
+#else
 #define ALIGNMENT   8
+#endif
+#ifdef MM_PAGE_SIZE
+#define PAGE_SIZE   MM_PAGE_SIZE
+#else
 #define PAGE_SIZE   4096
+#endif
 
 #define MIN_BLK_SZ  2*DWORD_SIZE //enough for the header info and a DWORD
 
+#if defined(MM_NEXT_FIT) && defined(MM_BEST_FIT)
+#error "pick one of MM_NEXT_FIT and MM_BEST_FIT"
+#endif
+#if (ALIGNMENT & (ALIGNMENT - 1)) || (PAGE_SIZE & (PAGE_SIZE - 1))
+#error "ALIGNMENT and PAGE_SIZE must be powers of two"
+#endif
+#if ALIGNMENT < 8
+#error "ALIGNMENT must be at least 8: block sizes keep their low three bits free for the flags"
+#endif
+
 /* 
  * Some useful macros, based on "Computer Systems"
  *   Bryant & O'Hallaron SS 9.9.12
  */
 
 #define MAX(x, y)           ((x)>(y)?(x):(y))
+#define MIN(x, y)           ((x)<(y)?(x):(y))
 
 //Pack a size and alloc bit into a uint tag
 #define MK_INFO(sz, al)   ((sz)|(al))
 
 // Retreive info from journaling tags
-#define GET_SIZE(tp)      (*((uint32_t *)(tp)) & ~0x7)
-#define GET_ALLOC(tp)     (*((uint32_t *)(tp)) & 0x1)
+#define GET_SIZE(tp)      (*((tag_t *)(tp)) & ~(tag_t)0x7)
+#define GET_ALLOC(tp)     (*((tag_t *)(tp)) & 0x1)
 
 // Compute header and footer pointers from block pointer
 #define HDRP(bp)            (((void *)(bp)) - WORD_SIZE)
 #define FTRP(bp)            (((void *)(bp)) + GET_SIZE(HDRP(bp)) - DWORD_SIZE)
 
 //Get/Set the info tag header
-#define GET_TAG(tp)         (*(uint32_t *)(tp))
-#define SET_TAG(tp, tag)    (*(uint32_t *)(tp) = ((uint32_t)(tag)))
+#define GET_TAG(tp)         (*(tag_t *)(tp))
+#define SET_TAG(tp, tag)    (*(tag_t *)(tp) = ((tag_t)(tag)))
 
 //Calculate pointer to next and prev blocks, c.o. Bryant and O'Hallaron
 #define NEXT_BLKP(bp) ((void *)(bp) + GET_SIZE(HDRP(bp)))
 #define PREV_FTRP(bp) ((void *)(bp) - DWORD_SIZE) //fast calc prev footer
 #define PREV_BLKP(bp) ((void *)(bp) - GET_SIZE(PREV_FTRP(bp)))
 
-//Compute best multiple of DWORD_SIZE to fit a given size of variable
-#define DMULT(x)    (DWORD_SIZE * (((size) + DWORD_SIZE + (DWORD_SIZE-1)) / DWORD_SIZE))
+//Compute best multiple of ALIGNMENT to fit a given size of variable plus its tags
+#define DMULT(x)    (ALIGNMENT * (((size) + DWORD_SIZE + (ALIGNMENT-1)) / ALIGNMENT))
+
+//Built with -DMM_SIZECLASSES, blocks up to SIZE_CLASS_MAX are rounded up to the
+//  size classes in sizeclass.h ("make sizeclasses" fits them to the traces), so
+//  that a freed block fits any later request of its class.
+#ifdef MM_SIZECLASSES
+#if SIZE_CLASS_ALIGN != ALIGNMENT
+#error "sizeclass.h was made for another ALIGNMENT, rerun gensizeclass with -a"
+#endif
+#if SIZE_CLASS_TAG != WORD_SIZE
+#error "sizeclass.h was made for another tag size, rerun gensizeclass with -t"
+#endif
+#define CLASS_ROUND(sz) (((sz) <= SIZE_CLASS_MAX)?size_class_size[SIZE_CLASS(sz)]:(sz))
+#else
+#define CLASS_ROUND(sz) (sz)
+#endif
 
 //Global pointer to the start of our heap, i.e. the first free block.
 static void * g_heapPtr;
 
-/* 
- * mm_init - initialize the malloc package.
+//Where mm_check_incr will pick up its sweep of the heap
+static void * g_checkCur;
+
+#ifdef MM_NEXT_FIT
+//Where the next search starts: the block the last one found
+static void * g_rover;
+#endif
+
+//No free block below the top of the heap is bigger than this. It only
+//  grows as blocks are freed, and a search that fails pulls it back down.
+static size_t g_maxFree;
+
+//Counters for mm_get_stats. STAT(x) does g_stats.x, and nothing at all
+//  unless we're built with -DMM_STATS, so the fast path stays as it was.
+#ifdef MM_STATS
+static mm_stats_t g_stats;
+#define STAT(x)     (g_stats.x)
+#else
+#define STAT(x)
+#endif
+
+#ifdef MM_STATS
+/*
+ * stat_search - record a search for a block of size bytes that visited
+ *   steps blocks, reading hdr bytes of tags over span bytes of heap
  */
-int mm_init(void)
+static void stat_search( size_t size, size_t steps, size_t hdr, size_t span )
 {
-    //Start a free list with some dummy data
-    if((g_heapPtr = mem_sbrk(4*WORD_SIZE)) == (void *)-1)
-        return -1; //Fail if we can't get 16 bytes to start (god help us)
 
-    uint32_t dummyTag = MK_INFO(DWORD_SIZE, 1);
+    int c = 0, b = 0;
 
-    SET_TAG(g_heapPtr, 0); // This is padding.     The first two WORDS in this list
-    SET_TAG(g_heapPtr + WORD_SIZE, dummyTag);  //  are a dummy entry (alloc'd) to
-    SET_TAG(g_heapPtr + DWORD_SIZE, dummyTag); //  safeguard from initialization
+    while( c < MM_STATS_CLASSES - 1 && (size >> (c + 5)) != 0 ) c++;
+    while( b < MM_STATS_BUCKETS - 1 && (steps >> (b + 1)) != 0 ) b++;
 
-    // This will be overwritten in a minute. We need it to avoid segfaulting.
-    SET_TAG(g_heapPtr + 3*WORD_SIZE, MK_INFO(0, 1));
+    g_stats.searches++;
+    g_stats.search_steps += steps;
+    g_stats.class_searches[c]++;
+    g_stats.class_steps[c] += steps;
+    g_stats.class_max_steps[c] = MAX(g_stats.class_max_steps[c], steps);
+    g_stats.class_hdr_bytes[c] += hdr;
+    g_stats.class_span[c] += span;
+    g_stats.search_hist[c][b]++;
 
-    g_heapPtr += DWORD_SIZE; // Set the heap list pointer between the header and footer.
+}
+#endif
 
-    //Extend the heap by one page.
-    if ( extend_heap(PAGE_SIZE/WORD_SIZE) == NULL) return -1;
+//Count size bytes asked for and the block bp handed back for them
+#define STAT_GRANT(size, bp) \
+    do { STAT(bytes_requested += (size)); STAT(bytes_granted += GET_SIZE(HDRP(bp))); } while(0)
+
+//Track the number of blocks and free blocks as they change, and their peaks
+#define STAT_BLOCKS(nblk, nfree) \
+    do { STAT(heap_blocks += (nblk)); STAT(free_blocks += (nfree)); \
+         STAT(max_heap_blocks = MAX(g_stats.max_heap_blocks, g_stats.heap_blocks)); \
+         STAT(max_free_blocks = MAX(g_stats.max_free_blocks, g_stats.free_blocks)); } while(0)
+
+/*
+ * Heap profiling. Every allocation takes its size off g_sampleLeft, and
+ * the one that takes it below zero is sampled: its stack goes into
+ * g_prof and its tags get the SAMPLED bit, so that free only has to look
+ * the block up when the bit is set. The gaps between samples are drawn
+ * at random around g_profRate so that periodic traces don't always hit
+ * the same call, and each sample stands for the bytes of the gaps it
+ * closed.
+ */
+#define SAMPLED         0x2
+#define PROF_MAX        4096 //live samples we can track (power of two)
+#define PROF_DEPTH      6    //frames kept per sample
+#ifdef MM_PROF_SKIP
+#define PROF_SKIP       MM_PROF_SKIP //libmm.so adds a frame for its malloc
+#else
+#define PROF_SKIP       2    //frames inside mm.c: sample_block and its caller
+#endif
+
+typedef struct {
+    void * bp;               //the block, NULL if the slot is empty
+    size_t size;             //bytes asked for
+    uint64_t weight;         //bytes of allocation it stands for
+    uint64_t birth;          //bytes allocated before it
+    void * stack[PROF_DEPTH];
+} prof_t;
+
+static prof_t g_prof[PROF_MAX];
+static size_t g_profLive, g_profDropped, g_profFreed;
+static size_t g_profRate = MM_PROF_RATE;
+static long g_sampleLeft;            //bytes to go until the next sample
+static uint64_t g_profDrawn;         //sum of all the gaps drawn so far
+static uint32_t g_profRand = 2463534242u;
+
+//Sample bp if it uses up the current gap
+#define SAMPLE(size, bp) \
+    do { if( (g_sampleLeft -= (long)(size)) < 0 ) sample_block( bp, size ); } while(0)
+
+#define PROF_HASH(bp)   ((((uintptr_t)(bp) >> 3) * 2654435761u) & (PROF_MAX - 1))
+
+/*
+ * prof_gap - draw the bytes until the next sample, uniform in [1, 2*rate]
+ */
+static long prof_gap( void )
+{
+
+    g_profRand ^= g_profRand << 13;
+    g_profRand ^= g_profRand >> 17;
+    g_profRand ^= g_profRand << 5;
+
+    return 1 + (long)(g_profRand % (2 * g_profRate));
 
-    //Sehr guht.
-    return 0;
 }
 
 /*
- * extend_heap - add more memory to the heap
+ * prof_reset - forget all the samples and start a new gap
  */
-static void * extend_heap( size_t units )
+static void prof_reset( void )
 {
 
-    void * bp;
-    size_t sz = units * WORD_SIZE;
+    memset(g_prof, 0, sizeof(g_prof));
+    g_profLive = g_profDropped = g_profFreed = 0;
+    g_profDrawn = 0;
 
-    if ((long)(bp = mem_sbrk(sz)) == -1) return NULL; //we are oom
+    if( g_profRate == 0 ) {
 
-    //Overwrite the old epilogue header with new info for this free block
-    SET_TAG(HDRP(bp), MK_INFO(sz, 0)); //New header
-    SET_TAG(FTRP(bp), MK_INFO(sz, 0)); //New footer
+        g_sampleLeft = (long)(~0UL >> 1); //never, in practice
+        return;
 
-    SET_TAG(HDRP(NEXT_BLKP(bp)), MK_INFO(0, 1)); //New epilogue
+    }
 
-    return coalesce( bp );
+    g_sampleLeft = prof_gap();
+    g_profDrawn = g_sampleLeft;
 
 }
 
-/* 
- * mm_malloc - 
+/*
+ * sample_block - record the stack that allocated bp and mark the block.
+ *   Kept out of line so that the frames we skip are always the same.
  */
-void * mm_malloc(size_t size)
+static void __attribute__((noinline)) sample_block( void * bp, size_t size )
 {
 
-    void * bp;
+    void * frames[PROF_DEPTH + PROF_SKIP];
+    uint64_t weight = 0, now = g_profDrawn - g_sampleLeft;
+    size_t i;
+    int n = 0;
 
-    if( size == 0 ) return NULL;
+    //Sampling is off: all we did was run down a very long gap
+    if( g_profRate == 0 ) {
 
-    //Voodoo to figure out how much memory we need for overhead and to preserve alignment.
-    size_t adj_size = (size <= DWORD_SIZE)?(2*DWORD_SIZE):DMULT(size);
+        g_sampleLeft = (long)(~0UL >> 1);
+        return;
 
-    //If we find space to put the block, place it and return its pointer
-    if ((bp = findSpace(adj_size)) != NULL) {
+    }
 
-        place( bp, adj_size );
-        return bp;
+    //A block may close more than one gap
+    while( g_sampleLeft < 0 ) {
+
+        weight += g_profRate;
+        g_sampleLeft += prof_gap();
 
     }
+    g_profDrawn = now + g_sampleLeft;
 
-    //We didn't have enough room, so extend the heap, place the block, and return.
-    if((bp = extend_heap(MAX(adj_size, PAGE_SIZE)/WORD_SIZE)) == NULL)
-        return NULL;
- 
-    place(bp, adj_size);
+    //Keep the table at most 3/4 full so probes stay short
+    if( g_profLive >= PROF_MAX / 4 * 3 ) {
 
-    return bp;
+        g_profDropped++;
+        return;
+
+    }
+
+    for( i = PROF_HASH(bp); g_prof[i].bp != NULL; i = (i + 1) & (PROF_MAX - 1) )
+        ;
+
+    memset(&g_prof[i], 0, sizeof(prof_t));
+#ifdef __GLIBC__
+    n = backtrace(frames, PROF_DEPTH + PROF_SKIP);
+#endif
+    if( n > PROF_SKIP ) memcpy(g_prof[i].stack, frames + PROF_SKIP, (n - PROF_SKIP) * sizeof(void *));
+    g_prof[i].bp = bp;
+    g_prof[i].size = size;
+    g_prof[i].weight = weight;
+    g_prof[i].birth = now - size;
+    g_profLive++;
+
+    SET_TAG(HDRP(bp), GET_TAG(HDRP(bp)) | SAMPLED);
+    SET_TAG(FTRP(bp), GET_TAG(FTRP(bp)) | SAMPLED);
 
 }
 
 /*
- * findSpace - find a block of correct size
+ * unsample_block - bp, which has the SAMPLED bit, is being freed. Take it
+ *   out of the table, shifting back the entries that probed past it.
  */
-static void * findSpace( size_t size )
+static void unsample_block( void * bp )
 {
 
-    void * bp = g_heapPtr;
-    uint32_t sz =  GET_SIZE(HDRP(bp));
+    size_t i, j, h;
 
-    //Loop through the blocks until we find one that is both free and greater than
-    //  or equal to size bytes wide
+    for( i = PROF_HASH(bp); g_prof[i].bp != bp; i = (i + 1) & (PROF_MAX - 1) )
+        if( g_prof[i].bp == NULL ) return; //not in the table
 
-    while( sz != 0 ) {
+    g_profLive--;
+    g_profFreed++;
 
-        if( (sz >= size) && !GET_ALLOC(HDRP(bp)) ) return bp;
+    for( j = (i + 1) & (PROF_MAX - 1); g_prof[j].bp != NULL; j = (j + 1) & (PROF_MAX - 1) ) {
 
-        bp = NEXT_BLKP(bp);
-        sz = GET_SIZE(HDRP(bp));
+        //An entry can move into the hole if the hole is on its probe path
+        h = PROF_HASH(g_prof[j].bp);
+        if( ((j - h) & (PROF_MAX - 1)) >= ((j - i) & (PROF_MAX - 1)) ) {
+
+            g_prof[i] = g_prof[j];
+            i = j;
+
+        }
 
     }
+    g_prof[i].bp = NULL;
+
+}
 
-    //We didn't find anything...
-    return NULL;
+/*
+ * Lifetime-segregated placement. Blocks that are expected to die young
+ * go to the top of the heap: the search runs down from the epilogue and
+ * the block is cut from the high end of the free block it finds. Every
+ * other block goes first-fit from the bottom as before, so long lived
+ * blocks don't end up pinned between short lived ones. The lifetime is
+ * the caller's hint to mm_malloc_hint or, once mm_life_predict is on, a
+ * guess from the block's size class. By Little's law the mean lifetime
+ * of a class is its live blocks over its rate of allocation, so a class
+ * whose share of the live blocks is well below its share of the recent
+ * allocations is short lived.
+ */
+#define LIFE_CLASSES    32   //power of two block size classes
+#define LIFE_WINDOW     4096 //allocations between halvings of the history
+#define LIFE_MARGIN     2    //short lived is under 1/LIFE_MARGIN of the mean
+
+#define LIFE_CLASS(sz)  (31 - __builtin_clz((uint32_t)(sz)))
+
+static int g_lifePredict;
+static uint32_t g_lifeAllocs[LIFE_CLASSES]; //recent allocations per class
+static uint32_t g_lifeLive[LIFE_CLASSES];   //live blocks per class
+static uint32_t g_lifeAllocsAll, g_lifeLiveAll, g_lifeClock;
+
+//Count the block at bp in or out of the history of its size class
+#define LIFE_BORN(bp) \
+    do { if( g_lifePredict ) life_born( GET_SIZE(HDRP(bp)) ); } while(0)
+#define LIFE_DIED(bp) \
+    do { if( g_lifePredict ) life_died( GET_SIZE(HDRP(bp)) ); } while(0)
+#define LIFE_MOVED(old, bp) \
+    do { if( g_lifePredict ) life_moved( old, GET_SIZE(HDRP(bp)) ); } while(0)
+
+/*
+ * life_reset - forget the history, but not whether we're predicting
+ */
+static void life_reset( void )
+{
+
+    memset(g_lifeAllocs, 0, sizeof(g_lifeAllocs));
+    memset(g_lifeLive, 0, sizeof(g_lifeLive));
+    g_lifeAllocsAll = g_lifeLiveAll = g_lifeClock = 0;
 
 }
 
 /*
- * place - put partition the free block for return
+ * life_born - a block of size bytes was handed out
  */
-static void place( void * bp, size_t size )
+static void life_born( size_t size )
 {
 
-    size_t wholesz = GET_SIZE(HDRP(bp));
-    size_t remsz = wholesz - size;
+    int c = LIFE_CLASS(size);
 
-    //If the remainder size isn't large enough to constitute a block, then
-    //  use the whole size of this block, even though it is larger than required.
-    size = ( remsz < MIN_BLK_SZ )?wholesz:size;
+    g_lifeAllocs[c]++;
+    g_lifeAllocsAll++;
+    g_lifeLive[c]++;
+    g_lifeLiveAll++;
 
-    //This header/footer information is good regardless of whether
-    //  or not we are splitting the block
-    SET_TAG(HDRP(bp), MK_INFO(size, 1));
-    SET_TAG(FTRP(bp), MK_INFO(size, 1));
+    //Halve the allocation counts now and then so old phases fade out
+    if( ++g_lifeClock == LIFE_WINDOW ) {
 
-    //If the remainder size is sufficiently large, then split the
-    //  block and create new headers/footers
-    if( remsz >= MIN_BLK_SZ ) {
+        g_lifeClock = 0;
+        g_lifeAllocsAll = 0;
+        for( c = 0; c < LIFE_CLASSES; c++ ) {
 
-        SET_TAG(HDRP(NEXT_BLKP(bp)), MK_INFO(remsz, 0));
-        SET_TAG(FTRP(NEXT_BLKP(bp)), MK_INFO(remsz, 0)); 
+            g_lifeAllocs[c] /= 2;
+            g_lifeAllocsAll += g_lifeAllocs[c];
+
+        }
 
     }
 
 }
 
 /*
- * mm_free - Return a block to the free list.
+ * life_died - a block of size bytes was freed. It may have been handed
+ *   out before prediction was turned on, so don't count below zero.
+ *   Returns 0 if it wasn't counted.
  */
-void mm_free(void *ptr)
+static int life_died( size_t size )
 {
 
-    size_t sz = GET_SIZE(HDRP(ptr));
+    int c = LIFE_CLASS(size);
 
-    //Set the alloc bit to zero on the header and footer
-    SET_TAG(HDRP(ptr), MK_INFO(sz, 0));
-    SET_TAG(FTRP(ptr), MK_INFO(sz, 0));
+    if( g_lifeLive[c] == 0 ) return 0;
 
-    // coalesce adjacent free blocks together
-    coalesce(ptr);
+    g_lifeLive[c]--;
+    g_lifeLiveAll--;
+    return 1;
 
 }
 
-static void * coalesce( void * bp )
+/*
+ * life_moved - a block of old bytes was resized in place to size bytes.
+ *   It is still the allocation it was, so it changes class without
+ *   counting as a new one.
+ */
+static void life_moved( size_t old, size_t size )
 {
 
-    uint8_t pAlloc = GET_ALLOC(PREV_FTRP(bp));
-    uint8_t nAlloc = GET_ALLOC(HDRP(NEXT_BLKP(bp)));
-    size_t sz = GET_SIZE(HDRP(bp));
+    if( !life_died(old) ) return;
 
-    //Following elif blocks perform necessary resizing and mutation on the headers and footers
-    //  depending on which adjacent blocks are free
+    g_lifeLive[LIFE_CLASS(size)]++;
+    g_lifeLiveAll++;
 
-    if( pAlloc && nAlloc ) return bp;
+}
 
-    else if ( !pAlloc && nAlloc ) { // Prev is free
-        
-        sz += GET_SIZE(PREV_FTRP(bp));
-        SET_TAG(FTRP(bp), MK_INFO(sz, 0));
-        SET_TAG(HDRP(PREV_BLKP(bp)), MK_INFO(sz, 0));
-        bp = PREV_BLKP(bp); // set bp back to appropriate start
+/*
+ * life_short - guess whether a block of size bytes will die young
+ */
+static int life_short( size_t size )
+{
 
-    } else if ( pAlloc && !nAlloc ) { // Next is free
-        
-        sz += GET_SIZE(HDRP(NEXT_BLKP(bp)));
-        SET_TAG(HDRP(bp), MK_INFO(sz, 0));
-        SET_TAG(FTRP(bp), MK_INFO(sz, 0));
-    
-    } else { // both are free
+    int c = LIFE_CLASS(size);
 
-        sz += GET_SIZE(PREV_FTRP(bp)) +
-              GET_SIZE(HDRP(NEXT_BLKP(bp)));
+    return (uint64_t)g_lifeLive[c] * g_lifeAllocsAll * LIFE_MARGIN <
+           (uint64_t)g_lifeAllocs[c] * g_lifeLiveAll;
 
-        SET_TAG(HDRP(PREV_BLKP(bp)), MK_INFO(sz, 0));
-        SET_TAG(FTRP(NEXT_BLKP(bp)), MK_INFO(sz, 0));
+}
 
-        bp = PREV_BLKP(bp);
+/*
+ * Giving free memory back. Nothing reads the inside of a free block, so
+ * once a big one forms, the pages that lie wholly inside it can go back
+ * to the OS and will fault back in, zeroed, when the block is reused.
+ * That only pays if the block stays free, so the biggest block to form
+ * must go RELEASE_GAP frees without being allocated from before we
+ * release it; blocks that merge into it in the meantime go with it.
+ * -DMM_RELEASE_MIN=0 turns it off.
+ */
+#ifdef MM_RELEASE_MIN
+#define RELEASE_MIN     MM_RELEASE_MIN
+#else
+#define RELEASE_MIN     (16*PAGE_SIZE) //smallest free block worth releasing
+#endif
+#define RELEASE_GAP     64   //frees a block must stay free to be released
+
+static void * g_releaseBlk; //the block we are waiting to release, if any
+static int g_releaseWait;   //frees to go until we release it
+
+/*
+ * release_note - called with each block free_block leaves behind, once it
+ *   is coalesced
+ */
+static void release_note( void * bp )
+{
+
+    size_t sz = GET_SIZE(HDRP(bp));
+
+    if( RELEASE_MIN == 0 ) return;
+
+    //A bigger block takes over the wait, unless it is the one we had
+    if( sz >= RELEASE_MIN &&
+        (g_releaseBlk == NULL || sz > GET_SIZE(HDRP(g_releaseBlk))) ) {
+
+        if( bp != g_releaseBlk ) g_releaseWait = RELEASE_GAP;
+        g_releaseBlk = bp;
 
     }
 
-    return bp;
+    if( g_releaseBlk == NULL || --g_releaseWait > 0 ) return;
+
+    //Keep the tags, which sit in the first and last words
+    mem_release( g_releaseBlk, FTRP(g_releaseBlk) );
+    g_releaseBlk = NULL;
 
 }
 
 /*
- * mm_realloc
+ * Movable blocks. A block from mm_halloc is reached only through its
+ * handle, an index into g_handles, so compact() is free to move it
+ * while it isn't locked. Its tags carry the MOVABLE bit and the first
+ * ALIGNMENT bytes of its payload hold its handle, which is how the
+ * compaction walk, going through the heap in address order, finds the
+ * slot to update. The table lives outside the heap, like the page map,
+ * so that it never pins anything down, and grows by doubling.
  */
-void *mm_realloc(void *ptr, size_t size)
+#define MOVABLE         0x4
+#define HANDLE_MIN      1024 //slots in the first table
+#define COMPACT_SHARE   8    //compact when 1/COMPACT_SHARE of the heap was freed
+
+typedef struct {
+    void * bp;               //the block
+    uint32_t locks;          //mm_hlock calls not yet undone
+    uint32_t next;           //next free handle, while this one is free
+} handle_t;
+
+static handle_t * g_handles;
+static uint32_t g_handleCap;  //slots in the table
+static uint32_t g_handleUsed; //slots ever handed out since mm_init
+static uint32_t g_handleFree; //first free handle, 0 if none
+static size_t g_handleLive;   //handles in use
+static size_t g_freedBytes;   //bytes freed since the last compaction
+static size_t g_compactions, g_movedBytes;
+
+#define HSLOT(h)        (&g_handles[(h) - 1])
+
+/*
+ * handle_reset - forget every handle, keeping the table for reuse
+ */
+static void handle_reset( void )
 {
-    void *newptr;
-    size_t copySize;
 
-    //acts like free if size is null, acts like malloc if ptr is null
-    if( size == 0 ) {
+    g_handleUsed = g_handleFree = 0;
+    g_handleLive = g_freedBytes = 0;
+    g_compactions = g_movedBytes = 0;
 
-        mm_free(ptr);
-        return NULL;
+}
 
-    } else if( ptr == NULL ) return mm_malloc(size);
+/*
+ * handle_new - a free handle, or 0 if the table can't grow
+ */
+static uint32_t handle_new( void )
+{
 
-    //Voodoo to figure out how much memory we need for overhead and to preserve alignment.
-    size_t adj_size = (size <= DWORD_SIZE)?(2*DWORD_SIZE):DMULT(size);
+    handle_t * table;
+    uint32_t h, cap;
 
-    size_t cur_size = GET_SIZE(HDRP(ptr));
+    if( (h = g_handleFree) != 0 ) {
 
-    if( adj_size == cur_size ) { //Pointer is exactly the right size.
+        g_handleFree = HSLOT(h)->next;
+        return h;
 
-        return ptr;
+    }
 
-    } else if( adj_size < GET_SIZE(HDRP(ptr)) ) {  //Free block might be split,
-                                                    //so free and place at same loc
+    if( g_handleUsed == g_handleCap ) {
 
-        //Free is inlined here so that I can use the poitner returned by coalesce()
-        size_t sz = GET_SIZE(HDRP(ptr));
+        cap = ( g_handleCap == 0 )?HANDLE_MIN:2 * g_handleCap;
+        table = mmap(NULL, cap * sizeof(handle_t), PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if( table == MAP_FAILED ) return 0;
 
-        //Set the alloc bit to zero on the header and footer
-        SET_TAG(HDRP(ptr), MK_INFO(sz, 0));
-        SET_TAG(FTRP(ptr), MK_INFO(sz, 0));
+        if( g_handles != NULL ) {
 
-        newptr = coalesce(ptr);
+            memcpy(table, g_handles, g_handleCap * sizeof(handle_t));
+            munmap(g_handles, g_handleCap * sizeof(handle_t));
 
-        if(newptr != ptr) memcpy(newptr, ptr, size);    //copy to beginning of free
-                                                        //  block if ptr changes
+        }
+        g_handles = table;
+        g_handleCap = cap;
 
-        place( newptr, adj_size ); //split if necessary
-        return newptr;
+    }
 
-    } else { //We need more space.
+    return ++g_handleUsed;
 
-        if( (newptr = mm_malloc( size )) == NULL) return NULL; //oom
+}
 
-        //If the new size is less than the buffer between the headers, only copy that,
-        //  otherwise copy the whole existing buffer.
-        copySize = ( size < (cur_size - DWORD_SIZE) )?size:(cur_size - DWORD_SIZE);
+/*
+ * handle_set - make bp the movable block of handle h
+ */
+static void handle_set( uint32_t h, void * bp )
+{
 
-        memcpy(newptr, ptr, copySize);
-        mm_free(ptr);
-        return newptr;
+    SET_TAG(HDRP(bp), GET_TAG(HDRP(bp)) | MOVABLE);
+    SET_TAG(FTRP(bp), GET_TAG(FTRP(bp)) | MOVABLE);
+    *(uint32_t *)bp = h;
+    HSLOT(h)->bp = bp;
+
+}
+
+/*
+ * check_handle - the movable block at bp must be the one its handle has
+ */
+static int check_handle( void * bp )
+{
+
+    uint32_t h = *(uint32_t *)bp;
+
+    if( h == 0 || h > g_handleUsed || HSLOT(h)->bp != bp ) {
+
+        printf("Movable block at %p has a bad handle %u.\n", bp, (unsigned)h);
+        return 0;
 
     }
 
+    return 1;
+
 }
 
+#ifdef MM_PAGEMAP
 /*
- * mm_check checks the heap for consistency
- * This checker is relatively simple because our malloc algorithm does not
- * use an explicit free list. It checks for contigious free blocks that
- * escaped coalescing. Free list blocks really being free and free blocks
- * being on the free list are impossible to test without an explicit free
- * list. We do not use pointers in our headers, and it is impossible to
- * check if blocks overlap in our implementation because we cannot tell
- * the difference between header and payload data.
+ * Small blocks from spans, built with -DMM_PAGEMAP. A request of up to
+ * SPAN_MAX_OBJ bytes gets an object in a span: a page, cut from the
+ * heap as one block, that holds nothing but untagged objects of one
+ * size class (sizeclass.h). g_pagemap maps each heap page to a span_t
+ * that lives outside the heap, so free and mm_usable_size find an
+ * object's class with two loads. Which objects are free is a bitmap in
+ * the span_t too, so overrunning an object can reach its neighbours but
+ * no allocator metadata.
+ * The span's block is placed with its payload ALIGNMENT bytes into the
+ * page, so that its tags fall in the first words of the page and of
+ * the next one and spans tile the heap with no gaps between them.
  */
-int mm_check() {
-    void * bp = g_heapPtr;
-    size_t size = GET_SIZE(HDRP(bp));
-    int prevAlloc = 1;
-    int isValid = 1;
+#define SPAN_MAX_OBJ    256  //larger requests get tagged blocks as before
 
-    do {
-        int alloc = GET_ALLOC(HDRP(bp));
-        if (!prevAlloc && !alloc) {
-            printf("Contigious free block at %p.\n", bp);
-            isValid = 0;
-        }
-        bp = NEXT_BLKP(bp);
-        size = GET_SIZE(HDRP(bp));
-        prevAlloc = alloc;
-    } while (size != 0);
+#if SPAN_MAX_OBJ + DWORD_SIZE > SIZE_CLASS_MAX
+#error "sizeclass.h has no classes for the biggest span objects"
+#endif
+#if ALIGNMENT < DWORD_SIZE
+#error "a span's tags need ALIGNMENT of at least two tags, use MM_ALIGNMENT=16"
+#endif
+
+#define SPAN_BITS       (PAGE_SIZE / ALIGNMENT) //most objects a span can hold
+#define SPAN_WORDS      ((SPAN_BITS + 63) / 64)
+
+typedef struct span {
+    uint16_t cls;               //size class + 1, or 0 if the page isn't a span
+    uint16_t nfree;             //free objects
+    uint64_t free[SPAN_WORDS];  //bit k is set if object k is free
+    void * page;                //the page itself
+    struct span * next, * prev; //spans of the class with free objects
+} span_t;
+
+static pagemap_t g_pagemap;
+static span_t * g_spans[SIZE_CLASSES];    //spans with free objects, by class
+static uint32_t g_objSize[SIZE_CLASSES];  //object size of each class
+
+#define PAGE_NUM(p)     ((uintptr_t)(p) / PAGE_SIZE - (uintptr_t)mem_heap_lo() / PAGE_SIZE)
+#define SPAN_OBJS(c)    ((PAGE_SIZE - ALIGNMENT) / g_objSize[c])
+
+/*
+ * span_reset - forget all the spans; the heap they were in is gone
+ */
+static void span_reset( void )
+{
+
+    int c;
+
+    pagemap_init(&g_pagemap, sizeof(span_t));
+    memset(g_spans, 0, sizeof(g_spans));
+
+    //The class sizes count the tags that objects don't have
+    for( c = 0; c < SIZE_CLASSES; c++ )
+        g_objSize[c] = (size_class_size[c] - DWORD_SIZE + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
 
-    if (isValid) {
-        printf("Heap consistent.\n");
-    }
-    return isValid;
 }
 
 /*
- * prnHeap
+ * span_of - the span that ptr is an object of, or NULL if it's a block
  */
-void prnHeap()
+static span_t * span_of( void * ptr )
 {
 
-    void * bp = g_heapPtr;
-    size_t sz = GET_SIZE(HDRP(bp));
+    span_t * sp = pagemap_get(&g_pagemap, PAGE_NUM(ptr));
 
-    do {
+    //A tagged block can end in a span's page, in front of its first object
+    if( sp == NULL || sp->cls == 0 || (uintptr_t)ptr % PAGE_SIZE < ALIGNMENT ) return NULL;
 
-        printf("%p:%09d, %d\n", bp, sz, GET_ALLOC(HDRP(bp)));
-        bp = NEXT_BLKP(bp);
-        sz = GET_SIZE(HDRP(bp));
+    return sp;
 
-    } while ( sz != 0 );
+}
+
+/*
+ * span_link, span_unlink - put sp on or take it off its class's list of
+ *   spans with free objects
+ */
+static void span_link( span_t * sp, int c )
+{
 
-    printf("Reached sentinel! %p:%d\n", bp, sz);
+    sp->prev = NULL;
+    sp->next = g_spans[c];
+    if( sp->next != NULL ) sp->next->prev = sp;
+    g_spans[c] = sp;
 
 }
+
+static void span_unlink( span_t * sp, int c )
+{
+
+    if( sp->prev != NULL ) sp->prev->next = sp->next;
+    else g_spans[c] = sp->next;
+    if( sp->next != NULL ) sp->next->prev = sp->prev;
+
+}
+
+/*
+ * span_new - cut a span for class c from the heap, all its objects free
+ */
+static span_t * span_new( int c )
+{
+
+    void * bp, * page;
+    span_t * sp;
+    int k, n = SPAN_OBJS(c);
+
+    //A request of PAGE_SIZE - DWORD_SIZE makes a block of exactly a page
+    if( (bp = align_block(PAGE_SIZE, ALIGNMENT, PAGE_SIZE - DWORD_SIZE)) == NULL )
+        return NULL;
+
+    page = bp - ALIGNMENT;
+    if( (sp = pagemap_make(&g_pagemap, PAGE_NUM(page))) == NULL ) {
+
+        free_block(bp);
+        return NULL;
+
+    }
+
+    sp->cls = c + 1;
+    sp->page = page;
+    sp->nfree = n;
+
+    memset(sp->free, 0, sizeof(sp->free));
+    for( k = 0; k < n / 64; k++ ) sp->free[k] = ~(uint64_t)0;
+    if( n % 64 != 0 ) sp->free[k] = ((uint64_t)1 << (n % 64)) - 1;
+
+    span_link(sp, c);
+    return sp;
+
+}
+
+/*
+ * span_malloc - an object of at least size bytes, size <= SPAN_MAX_OBJ
+ */
+static void * span_malloc( size_t size )
+{
+
+    int c = SIZE_CLASS(size + DWORD_SIZE);
+    span_t * sp = g_spans[c];
+    int w, k;
+
+    if( sp == NULL && (sp = span_new(c)) == NULL ) return NULL;
+
+    //A span on the list has a free object: take the lowest
+    for( w = 0; sp->free[w] == 0; w++ );
+    k = __builtin_ctzll(sp->free[w]);
+    sp->free[w] &= sp->free[w] - 1;
+
+    //A full span leaves the list until one of its objects comes back
+    if( --sp->nfree == 0 ) span_unlink(sp, c);
+
+    return sp->page + ALIGNMENT + (w * 64 + k) * g_objSize[c];
+
+}
+
+/*
+ * span_free - free ptr if it's an object in a span; returns 0 if it's not
+ */
+static int span_free( void * ptr )
+{
+
+    span_t * sp = span_of(ptr);
+    uint64_t bit;
+    int c, k;
+
+    if( sp == NULL ) return 0;
+
+    c = sp->cls - 1;
+    k = (ptr - sp->page - ALIGNMENT) / g_objSize[c];
+    bit = (uint64_t)1 << (k % 64);
+
+    //Freeing a free object again changes nothing
+    if( sp->free[k / 64] & bit ) return 1;
+
+    sp->free[k / 64] |= bit;
+    if( sp->nfree++ == 0 ) span_link(sp, c);
+
+    //Give an empty span back to the heap, unless it's the last one of its
+    //  class with room, which the next request would only cut again
+    if( sp->nfree == SPAN_OBJS(c) && (g_spans[c] != sp || sp->next != NULL) ) {
+
+        span_unlink(sp, c);
+        sp->cls = 0;
+        free_block(sp->page + ALIGNMENT);
+
+    }
+
+    return 1;
+
+}
+
+/*
+ * check_span - the free bitmap of the span whose block is at bp must mark
+ *   nfree objects, all of them inside the span
+ */
+static int check_span( void * bp )
+{
+
+    span_t * sp = span_of(bp);
+    int k, n = 0, objs;
+
+    if( sp == NULL || sp->page + ALIGNMENT != bp ) return 1; //not a span
+
+    objs = SPAN_OBJS(sp->cls - 1);
+    for( k = 0; k < SPAN_BITS; k++ ) {
+
+        if( !(sp->free[k / 64] & ((uint64_t)1 << (k % 64))) ) continue;
+        if( k >= objs ) {
+
+            printf("Span at %p marks object %d free, but holds only %d.\n", sp->page, k, objs);
+            return 0;
+
+        }
+        n++;
+
+    }
+
+    if( n != sp->nfree ) {
+
+        printf("Span at %p marks %d objects free, expected %u.\n",
+               sp->page, n, (unsigned)sp->nfree);
+        return 0;
+
+    }
+
+    return 1;
+
+}
+#endif
+
+/* 
+ * mm_init - initialize the malloc package.
+ */
+int mm_init(void)
+{
+#ifdef MM_STATS
+    memset(&g_stats, 0, sizeof(g_stats));
+#endif
+    STAT_BLOCKS(1, 0); //the dummy entry below
+    prof_reset();
+    life_reset();
+    handle_reset();
+#ifdef MM_PAGEMAP
+    span_reset();
+#endif
+
+    //Pad the front of the heap so that the first block's payload is aligned
+    size_t pad = (ALIGNMENT - ((uintptr_t)mem_heap_hi() + 1 + 3*WORD_SIZE) % ALIGNMENT) % ALIGNMENT;
+
+    //Start a free list with some dummy data
+    if((g_heapPtr = mem_sbrk(pad + 3*WORD_SIZE)) == (void *)-1)
+        return -1; //Fail if we can't get 16 bytes to start (god help us)
+
+    tag_t dummyTag = MK_INFO(DWORD_SIZE, 1);
+
+    memset(g_heapPtr, 0, pad); // This is padding.
+    g_heapPtr += pad;
+
+    SET_TAG(g_heapPtr, dummyTag);              // The first two WORDS in this list
+    SET_TAG(g_heapPtr + WORD_SIZE, dummyTag);  //  are a dummy entry (alloc'd) to
+                                               //  safeguard from initialization
+
+    // This will be overwritten in a minute. We need it to avoid segfaulting.
+    SET_TAG(g_heapPtr + DWORD_SIZE, MK_INFO(0, 1));
+
+    g_heapPtr += WORD_SIZE; // Set the heap list pointer between the header and footer.
+    g_checkCur = g_heapPtr;
+#ifdef MM_NEXT_FIT
+    g_rover = g_heapPtr;
+#endif
+    g_maxFree = 0;
+    g_releaseBlk = NULL;
+    g_releaseWait = 0;
+
+    //Extend the heap by one page.
+    if ( extend_heap(PAGE_SIZE/WORD_SIZE) == NULL) return -1;
+
+    //Sehr guht.
+    return 0;
+}
+
+/*
+ * extend_heap - add more memory to the heap
+ */
+static void * extend_heap( size_t units )
+{
+
+    void * bp;
+    size_t sz = units * WORD_SIZE;
+
+    if ((long)(bp = mem_sbrk(sz)) == -1) return NULL; //we are oom
+
+    STAT(extends++);
+    STAT(extend_bytes += sz);
+    STAT_BLOCKS(1, 1);
+
+    //Overwrite the old epilogue header with new info for this free block
+    SET_TAG(HDRP(bp), MK_INFO(sz, 0)); //New header
+    SET_TAG(FTRP(bp), MK_INFO(sz, 0)); //New footer
+
+    SET_TAG(HDRP(NEXT_BLKP(bp)), MK_INFO(0, 1)); //New epilogue
+
+    return coalesce( bp );
+
+}
+
+/* 
+ * mm_malloc - 
+ */
+void * mm_malloc(size_t size)
+{
+
+    return mm_malloc_hint( size, MM_LIFE_AUTO );
+
+}
+
+/*
+ * mm_malloc_hint - mm_malloc for a block the caller expects to be short
+ *   or long lived
+ */
+void * mm_malloc_hint( size_t size, int life )
+{
+
+    void * bp;
+
+#ifdef MM_PAGEMAP
+    //Small blocks come from spans, with no tags to count or sample
+    if( size != 0 && size <= SPAN_MAX_OBJ ) {
+
+        STAT(mallocs++);
+        STAT(bytes_requested += size);
+        return span_malloc( size );
+
+    }
+#endif
+
+    bp = malloc_block( size, life );
+
+    STAT(mallocs++);
+    if( bp != NULL ) {
+
+        STAT_GRANT(size, bp);
+        SAMPLE(size, bp);
+        LIFE_BORN(bp);
+
+    }
+
+    return bp;
+
+}
+
+/*
+ * malloc_block - the work of mm_malloc
+ */
+static void * malloc_block( size_t size, int life )
+{
+
+    void * bp;
+
+    if( size == 0 ) return NULL;
+
+    //Voodoo to figure out how much memory we need for overhead and to preserve alignment.
+    size_t adj_size = CLASS_ROUND((size <= DWORD_SIZE)?(2*DWORD_SIZE):DMULT(size));
+
+    if( life == MM_LIFE_AUTO )
+        life = ( g_lifePredict && life_short(adj_size) )?MM_LIFE_SHORT:MM_LIFE_LONG;
+
+    //Short lived blocks are kept at the top of the heap
+    if( life == MM_LIFE_SHORT ) {
+
+        if( (bp = findSpaceTop(adj_size)) == NULL &&
+            (bp = extend_heap(MAX(adj_size, PAGE_SIZE)/WORD_SIZE)) == NULL )
+            return NULL;
+
+        return place_top( bp, adj_size );
+
+    }
+
+    //Nothing below the top is big enough, so don't bother looking
+    if( adj_size > g_maxFree ) return place_wild( adj_size );
+
+    //If we find space to put the block, place it and return its pointer
+    if ((bp = findSpace(adj_size)) != NULL) {
+
+        place( bp, adj_size );
+        return bp;
+
+    }
+
+    //We didn't have enough room, so take it from the top of the heap.
+    return place_wild( adj_size );
+
+}
+
+/*
+ * findSpace - find a free block of at least size bytes. First fit takes
+ *   the lowest one, best fit the smallest (stopping early on an exact
+ *   fit), and next fit the first one at or after the rover, wrapping
+ *   around to the bottom of the heap once.
+ */
+static void * findSpace( size_t size )
+{
+
+#ifdef MM_NEXT_FIT
+    void * bp = g_rover;
+#else
+    void * bp = g_heapPtr;
+#endif
+    void * fit = NULL, * stop = NULL;
+    size_t sz = GET_SIZE(HDRP(bp));
+    size_t largest = 0, top = 0;
+#ifdef MM_STATS
+    size_t steps = 0, span = 0;
+#endif
+
+    //Loop through the blocks until we find one that is both free and greater than
+    //  or equal to size bytes wide
+
+    while( stop == NULL || bp < stop ) {
+
+        if( sz == 0 ) {
+
+#ifdef MM_NEXT_FIT
+            //Go round again from the bottom, up to where we started. The
+            //  top block can only be the last free block before the wrap.
+            if( stop == NULL && g_rover != g_heapPtr ) {
+
+                if( GET_ALLOC(PREV_FTRP(bp)) ) largest = MAX(largest, top);
+                top = 0;
+                stop = g_rover;
+                bp = g_heapPtr;
+                sz = GET_SIZE(HDRP(bp));
+                continue;
+
+            }
+#endif
+            break;
+
+        }
+
+#ifdef MM_STATS
+        steps++;
+#endif
+        if( !GET_ALLOC(HDRP(bp)) ) {
+
+#ifdef MM_DEFERRED_COALESCE
+            sz = merge_run( bp );
+#endif
+            if( sz >= size ) {
+
+#ifdef MM_BEST_FIT
+                if( fit == NULL || sz < GET_SIZE(HDRP(fit)) ) fit = bp;
+                if( sz == size ) break;
+#else
+                fit = bp;
+                break;
+#endif
+
+            } else {
+
+                largest = MAX(largest, top);
+                top = sz; //not counted until we know it isn't the top block
+
+            }
+
+        }
+
+#ifdef MM_STATS
+        span += sz;
+#endif
+        bp = NEXT_BLKP(bp);
+        sz = GET_SIZE(HDRP(bp));
+
+    }
+
+#ifdef MM_STATS
+    //A failed search also read the epilogue header
+    stat_search( size, steps, (steps + (sz == 0)) * WORD_SIZE, span );
+#endif
+
+    if( fit == NULL ) {
+
+        //Having seen every free block, we know the real bound
+        if( stop == NULL && !GET_ALLOC(PREV_FTRP(bp)) ) g_maxFree = largest;
+        else g_maxFree = MAX(largest, top);
+
+    }
+#ifdef MM_NEXT_FIT
+    else g_rover = fit;
+#endif
+
+    return fit;
+
+}
+
+/*
+ * findSpaceTop - find the highest free block of correct size, walking
+ *   down the footers from the end of the heap to the prologue
+ */
+static void * findSpaceTop( size_t size )
+{
+
+    void * ftrp = mem_heap_hi() + 1 - DWORD_SIZE; //the last block's footer
+    size_t sz = GET_SIZE(ftrp);
+#ifdef MM_STATS
+    size_t steps = 0;
+#endif
+
+    while( ftrp != g_heapPtr ) {
+
+#ifdef MM_STATS
+        steps++;
+#endif
+        if( (sz >= size) && !GET_ALLOC(ftrp) ) break;
+
+        ftrp -= sz;
+        sz = GET_SIZE(ftrp);
+
+    }
+
+#ifdef MM_STATS
+    //A failed search also read the prologue footer
+    stat_search( size, steps, (steps + (ftrp == g_heapPtr)) * WORD_SIZE,
+                 mem_heap_hi() + 1 - ftrp );
+#endif
+
+    //We stopped on the prologue if we didn't find anything...
+    return ( ftrp != g_heapPtr )?(ftrp + DWORD_SIZE - sz):NULL;
+
+}
+
+/*
+ * place - put partition the free block for return
+ */
+static void place( void * bp, size_t size )
+{
+
+    size_t wholesz = GET_SIZE(HDRP(bp));
+    size_t remsz = wholesz - size;
+
+    //If the remainder size isn't large enough to constitute a block, then
+    //  use the whole size of this block, even though it is larger than required.
+    size = ( remsz < MIN_BLK_SZ )?wholesz:size;
+    STAT_BLOCKS(0, -1);
+    if( bp == g_releaseBlk ) g_releaseBlk = NULL;
+
+    //This header/footer information is good regardless of whether
+    //  or not we are splitting the block
+    SET_TAG(HDRP(bp), MK_INFO(size, 1));
+    SET_TAG(FTRP(bp), MK_INFO(size, 1));
+
+    //If the remainder size is sufficiently large, then split the
+    //  block and create new headers/footers
+    if( remsz >= MIN_BLK_SZ ) {
+
+        STAT(splits++);
+        STAT_BLOCKS(1, 1);
+        SET_TAG(HDRP(NEXT_BLKP(bp)), MK_INFO(remsz, 0));
+        SET_TAG(FTRP(NEXT_BLKP(bp)), MK_INFO(remsz, 0)); 
+
+    }
+
+}
+
+/*
+ * place_top - like place, but the allocated part is cut from the high end
+ *   of the free block and the remainder stays below it
+ */
+static void * place_top( void * bp, size_t size )
+{
+
+    size_t wholesz = GET_SIZE(HDRP(bp));
+    size_t remsz = wholesz - size;
+
+    //Too small to split, so it's all the same which end we use
+    if( remsz < MIN_BLK_SZ ) {
+
+        place( bp, size );
+        return bp;
+
+    }
+
+    STAT(splits++);
+    STAT_BLOCKS(1, 0);
+    SET_TAG(HDRP(bp), MK_INFO(remsz, 0));
+    SET_TAG(FTRP(bp), MK_INFO(remsz, 0));
+    g_maxFree = MAX(g_maxFree, remsz); //bp may have been the top block
+
+    bp = NEXT_BLKP(bp);
+    SET_TAG(HDRP(bp), MK_INFO(size, 1));
+    SET_TAG(FTRP(bp), MK_INFO(size, 1));
+
+    return bp;
+
+}
+
+/*
+ * wild_block - the free block that ends at the top of the heap, found
+ *   from the last footer, or NULL if the last block is allocated
+ */
+static void * wild_block( void )
+{
+
+    void * ftrp = mem_heap_hi() + 1 - DWORD_SIZE;
+    void * bp;
+
+    if( GET_ALLOC(ftrp) ) return NULL;
+    bp = ftrp + DWORD_SIZE - GET_SIZE(ftrp);
+
+#ifdef MM_DEFERRED_COALESCE
+    //Free blocks below it may not have been merged into it yet
+    while( !GET_ALLOC(PREV_FTRP(bp)) ) bp = coalesce(bp);
+#endif
+
+    return bp;
+
+}
+
+/*
+ * place_wild - allocate size bytes from the low end of the top free
+ *   block, without a search. If the top is short, the heap only grows by
+ *   the difference. When there are movable blocks and enough has been
+ *   freed since the last compaction to pay for another (and to make the
+ *   growth unnecessary), we compact first instead.
+ */
+static void * place_wild( size_t size )
+{
+
+    void * bp = wild_block();
+    size_t have = ( bp != NULL )?GET_SIZE(HDRP(bp)):0;
+
+    STAT(wild_allocs++);
+    if( have < size && g_handleLive != 0 &&
+        g_freedBytes >= MAX(size - have, mem_heapsize() / COMPACT_SHARE) ) {
+
+        compact();
+        bp = wild_block();
+        have = ( bp != NULL )?GET_SIZE(HDRP(bp)):0;
+
+    }
+
+    if( have < size &&
+        (bp = extend_heap(MAX(size - have, PAGE_SIZE)/WORD_SIZE)) == NULL )
+        return NULL;
+
+    place( bp, size );
+    return bp;
+
+}
+
+/*
+ * mm_free - Return a block to the free list.
+ */
+void mm_free(void *ptr)
+{
+
+    STAT(frees++);
+    free_block( ptr );
+
+}
+
+/*
+ * free_block - the work of mm_free
+ */
+static void free_block( void * ptr )
+{
+
+    size_t sz;
+
+#ifdef MM_PAGEMAP
+    if( span_free(ptr) ) return;
+#endif
+
+    sz = GET_SIZE(HDRP(ptr));
+
+    if( GET_TAG(HDRP(ptr)) & SAMPLED ) unsample_block(ptr);
+    LIFE_DIED(ptr);
+
+    //Set the alloc bit to zero on the header and footer
+    SET_TAG(HDRP(ptr), MK_INFO(sz, 0));
+    SET_TAG(FTRP(ptr), MK_INFO(sz, 0));
+    STAT_BLOCKS(0, 1);
+    g_freedBytes += sz;
+
+#ifdef MM_DEFERRED_COALESCE
+    //Leave the merging to the next search that walks past, counting the
+    //  free blocks on either side toward the bound as if it had merged them
+    if( GET_SIZE(HDRP(NEXT_BLKP(ptr))) != 0 ) {
+
+        if( !GET_ALLOC(PREV_FTRP(ptr)) ) sz += GET_SIZE(PREV_FTRP(ptr));
+        if( !GET_ALLOC(HDRP(NEXT_BLKP(ptr))) ) sz += GET_SIZE(HDRP(NEXT_BLKP(ptr)));
+        g_maxFree = MAX(g_maxFree, sz);
+
+    }
+    release_note( ptr );
+#else
+    // coalesce adjacent free blocks together
+    release_note( coalesce(ptr) );
+#endif
+
+}
+
+static void * coalesce( void * bp )
+{
+
+    uint8_t pAlloc = GET_ALLOC(PREV_FTRP(bp));
+    uint8_t nAlloc = GET_ALLOC(HDRP(NEXT_BLKP(bp)));
+    size_t sz = GET_SIZE(HDRP(bp));
+
+    //Following elif blocks perform necessary resizing and mutation on the headers and footers
+    //  depending on which adjacent blocks are free
+
+    if( pAlloc && nAlloc ) {
+
+        STAT(coalesce[0]++);
+
+    } else if ( !pAlloc && nAlloc ) { // Prev is free
+
+        STAT(coalesce[1]++);
+        STAT_BLOCKS(-1, -1);
+        sz += GET_SIZE(PREV_FTRP(bp));
+        SET_TAG(FTRP(bp), MK_INFO(sz, 0));
+        SET_TAG(HDRP(PREV_BLKP(bp)), MK_INFO(sz, 0));
+        bp = PREV_BLKP(bp); // set bp back to appropriate start
+
+    } else if ( pAlloc && !nAlloc ) { // Next is free
+
+        STAT(coalesce[2]++);
+        STAT_BLOCKS(-1, -1);
+        sz += GET_SIZE(HDRP(NEXT_BLKP(bp)));
+        SET_TAG(HDRP(bp), MK_INFO(sz, 0));
+        SET_TAG(FTRP(bp), MK_INFO(sz, 0));
+    
+    } else { // both are free
+
+        STAT(coalesce[3]++);
+        STAT_BLOCKS(-2, -2);
+        sz += GET_SIZE(PREV_FTRP(bp)) +
+              GET_SIZE(HDRP(NEXT_BLKP(bp)));
+
+        SET_TAG(HDRP(PREV_BLKP(bp)), MK_INFO(sz, 0));
+        SET_TAG(FTRP(NEXT_BLKP(bp)), MK_INFO(sz, 0));
+
+        bp = PREV_BLKP(bp);
+
+    }
+
+    merged( bp, sz );
+
+    return bp;
+
+}
+
+/*
+ * merged - bp is now a free block of sz bytes
+ */
+static void merged( void * bp, size_t sz )
+{
+
+    //Don't leave mm_check_incr's cursor, the block waiting to be released
+    //  or the next fit rover inside the merged block
+    if( g_checkCur > bp && g_checkCur < bp + sz ) g_checkCur = bp;
+    if( g_releaseBlk > bp && g_releaseBlk < bp + sz ) g_releaseBlk = bp;
+#ifdef MM_NEXT_FIT
+    if( g_rover > bp && g_rover < bp + sz ) g_rover = bp;
+#endif
+
+    //The top block is left out of the bound, so malloc_block goes
+    //  straight to it when nothing else fits
+    if( GET_SIZE(HDRP(bp + sz)) != 0 ) g_maxFree = MAX(g_maxFree, sz);
+
+}
+
+#ifdef MM_DEFERRED_COALESCE
+/*
+ * merge_run - merge the free blocks that follow the free block bp into
+ *   it and return its size; the blocks in front of it were merged before
+ *   a search got to it
+ */
+static size_t merge_run( void * bp )
+{
+
+    size_t sz = GET_SIZE(HDRP(bp)), whole = sz;
+
+    //The epilogue is allocated, so this stops at the end of the heap
+    while( !GET_ALLOC(HDRP(bp + sz)) ) {
+
+        STAT(coalesce[2]++);
+        STAT_BLOCKS(-1, -1);
+        sz += GET_SIZE(HDRP(bp + sz));
+
+    }
+
+    if( sz != whole ) {
+
+        SET_TAG(HDRP(bp), MK_INFO(sz, 0));
+        SET_TAG(FTRP(bp), MK_INFO(sz, 0));
+        merged( bp, sz );
+
+    }
+
+    return sz;
+
+}
+#endif
+
+/*
+ * mm_realloc
+ */
+void *mm_realloc(void *ptr, size_t size)
+{
+    void *newptr;
+    size_t copySize;
+
+    STAT(reallocs++);
+
+    //acts like free if size is null, acts like malloc if ptr is null
+    if( size == 0 ) {
+
+        free_block(ptr);
+        return NULL;
+
+    } else if( ptr == NULL ) {
+
+        if( (newptr = malloc_block(size, MM_LIFE_AUTO)) != NULL ) {
+
+            STAT_GRANT(size, newptr);
+            SAMPLE(size, newptr);
+            LIFE_BORN(newptr);
+
+        }
+        return newptr;
+
+    }
+
+#ifdef MM_PAGEMAP
+    //An object stays put if its class is big enough, else it moves to a
+    //  bigger object or a block
+    span_t * sp = span_of(ptr);
+    if( sp != NULL ) {
+
+        copySize = g_objSize[sp->cls - 1];
+        if( size <= copySize ) return ptr;
+
+        if( size <= SPAN_MAX_OBJ ) {
+
+            if( (newptr = span_malloc(size)) == NULL ) return NULL;
+
+        } else {
+
+            if( (newptr = malloc_block(size, MM_LIFE_AUTO)) == NULL ) return NULL;
+            STAT_GRANT(size, newptr);
+            SAMPLE(size, newptr);
+            LIFE_BORN(newptr);
+
+        }
+
+        memcpy(newptr, ptr, copySize);
+        span_free(ptr);
+        return newptr;
+
+    }
+#endif
+
+    //Voodoo to figure out how much memory we need for overhead and to preserve alignment.
+    size_t adj_size = CLASS_ROUND((size <= DWORD_SIZE)?(2*DWORD_SIZE):DMULT(size));
+
+    size_t cur_size = GET_SIZE(HDRP(ptr));
+
+    if( adj_size == cur_size ) { //Pointer is exactly the right size.
+
+        STAT_GRANT(size, ptr);
+        return ptr;
+
+    } else if( adj_size < GET_SIZE(HDRP(ptr)) ) {  //Free block might be split,
+                                                    //so free and place at same loc
+
+        //Free is inlined here so that I can use the poitner returned by coalesce()
+        size_t sz = GET_SIZE(HDRP(ptr));
+
+        if( GET_TAG(HDRP(ptr)) & SAMPLED ) unsample_block(ptr);
+
+        //Set the alloc bit to zero on the header and footer
+        SET_TAG(HDRP(ptr), MK_INFO(sz, 0));
+        SET_TAG(FTRP(ptr), MK_INFO(sz, 0));
+        STAT_BLOCKS(0, 1);
+
+        newptr = coalesce(ptr);
+
+        if(newptr != ptr) memmove(newptr, ptr, size);   //copy to beginning of free
+                                                        //  block if ptr changes;
+                                                        //  the two may overlap
+
+        place( newptr, adj_size ); //split if necessary
+        if( GET_SIZE(HDRP(newptr)) < sz ) g_freedBytes += sz - GET_SIZE(HDRP(newptr));
+        STAT_GRANT(size, newptr);
+        SAMPLE(size, newptr);
+        LIFE_MOVED(sz, newptr);
+        return newptr;
+
+    } else { //We need more space.
+
+        if( (newptr = malloc_block( size, MM_LIFE_AUTO )) == NULL) return NULL; //oom
+
+        //If the new size is less than the buffer between the headers, only copy that,
+        //  otherwise copy the whole existing buffer.
+        copySize = ( size < (cur_size - DWORD_SIZE) )?size:(cur_size - DWORD_SIZE);
+
+        memcpy(newptr, ptr, copySize);
+        free_block(ptr);
+        STAT_GRANT(size, newptr);
+        SAMPLE(size, newptr);
+        LIFE_BORN(newptr);
+        return newptr;
+
+    }
+
+}
+
+/*
+ * mm_memalign - allocate size bytes aligned to alignment, a power of two
+ */
+void * mm_memalign( size_t alignment, size_t size )
+{
+
+    void * bp, * abp;
+
+    STAT(memaligns++);
+
+    if( alignment <= ALIGNMENT ) {
+
+        if( (bp = malloc_block(size, MM_LIFE_AUTO)) != NULL ) {
+
+            STAT_GRANT(size, bp);
+            SAMPLE(size, bp);
+            LIFE_BORN(bp);
+
+        }
+        return bp;
+
+    }
+    if( (abp = align_block(alignment, 0, size)) != NULL ) {
+
+        STAT_GRANT(size, abp);
+        SAMPLE(size, abp);
+        LIFE_BORN(abp);
+
+    }
+    return abp;
+
+}
+
+/*
+ * align_block - the work of mm_memalign for alignments above ALIGNMENT
+ */
+static void * align_block( size_t alignment, size_t skew, size_t size )
+{
+
+    void * bp, * abp;
+    size_t wholesz, lead, adj_size;
+
+    if( size == 0 ) return NULL;
+
+    adj_size = CLASS_ROUND((size <= DWORD_SIZE)?(2*DWORD_SIZE):DMULT(size));
+
+    //Get a block with enough slack to slide the payload up to an aligned
+    //  address and still have room for a free block in front of it
+    if( (bp = malloc_block(adj_size + alignment + MIN_BLK_SZ, MM_LIFE_AUTO)) == NULL ) return NULL;
+
+    abp = (void *)((((uintptr_t)bp - skew + alignment - 1) & ~(uintptr_t)(alignment - 1)) + skew);
+    if( abp != bp && (size_t)(abp - bp) < MIN_BLK_SZ ) abp += alignment;
+    lead = abp - bp;
+
+    //Give the lead back as a free block of its own
+    if( lead > 0 ) {
+
+        wholesz = GET_SIZE(HDRP(bp));
+        SET_TAG(HDRP(bp), MK_INFO(lead, 0));
+        SET_TAG(FTRP(bp), MK_INFO(lead, 0));
+        SET_TAG(HDRP(abp), MK_INFO(wholesz - lead, 1));
+        SET_TAG(FTRP(abp), MK_INFO(wholesz - lead, 1));
+        STAT_BLOCKS(1, 1);
+        coalesce(bp);
+
+    }
+
+    //Split off and free whatever is left at the tail
+    wholesz = GET_SIZE(HDRP(abp));
+    if( wholesz - adj_size >= MIN_BLK_SZ ) {
+
+        STAT(splits++);
+        STAT_BLOCKS(1, 1);
+        SET_TAG(HDRP(abp), MK_INFO(adj_size, 1));
+        SET_TAG(FTRP(abp), MK_INFO(adj_size, 1));
+        SET_TAG(HDRP(NEXT_BLKP(abp)), MK_INFO(wholesz - adj_size, 0));
+        SET_TAG(FTRP(NEXT_BLKP(abp)), MK_INFO(wholesz - adj_size, 0));
+        coalesce(NEXT_BLKP(abp));
+
+    }
+
+    return abp;
+
+}
+
+/*
+ * mm_usable_size - number of payload bytes actually available at ptr
+ */
+size_t mm_usable_size( void * ptr )
+{
+#ifdef MM_PAGEMAP
+    span_t * sp = span_of(ptr);
+    if( sp != NULL ) return g_objSize[sp->cls - 1];
+#endif
+    return GET_SIZE(HDRP(ptr)) - DWORD_SIZE;
+}
+
+/*
+ * mm_halloc - allocate a movable block of size bytes and return its
+ *   handle, or 0. The block is always a tagged one, never from a span,
+ *   and is never sampled, since the profiler finds its samples by address.
+ */
+mm_handle_t mm_halloc( size_t size )
+{
+
+    void * bp;
+    uint32_t h;
+
+    if( size == 0 || (h = handle_new()) == 0 ) return 0;
+
+    if( (bp = malloc_block(size + ALIGNMENT, MM_LIFE_AUTO)) == NULL ) {
+
+        HSLOT(h)->next = g_handleFree;
+        g_handleFree = h;
+        return 0;
+
+    }
+
+    STAT(mallocs++);
+    STAT_GRANT(size, bp);
+    LIFE_BORN(bp);
+
+    handle_set( h, bp );
+    HSLOT(h)->locks = 0;
+    g_handleLive++;
+
+    return h;
+
+}
+
+/*
+ * mm_hlock - pin h's block where it is and return its payload. Locks
+ *   nest; the block can move again once each has been undone.
+ */
+void * mm_hlock( mm_handle_t h )
+{
+
+    if( h == 0 ) return NULL;
+
+    HSLOT(h)->locks++;
+    return HSLOT(h)->bp + ALIGNMENT;
+
+}
+
+/*
+ * mm_hunlock - undo one mm_hlock
+ */
+void mm_hunlock( mm_handle_t h )
+{
+
+    if( h == 0 ) return;
+
+    HSLOT(h)->locks--;
+
+}
+
+/*
+ * mm_hfree - free h's block, locked or not, and the handle with it
+ */
+void mm_hfree( mm_handle_t h )
+{
+
+    if( h == 0 ) return;
+
+    STAT(frees++);
+    free_block( HSLOT(h)->bp );
+
+    HSLOT(h)->next = g_handleFree;
+    g_handleFree = h;
+    g_handleLive--;
+
+}
+
+/*
+ * mm_hrealloc - give h a block of size bytes with the contents of the
+ *   old one, as far as they fit. Returns -1, leaving h as it was, if
+ *   there is no room. The block shrinks in place, and unlike mm_realloc
+ *   it grows in place when the block after it is free and big enough,
+ *   or is free and the last in the heap, which then grows under it:
+ *   after a compaction, that is where the free space is. Otherwise the
+ *   block moves, so a locked one, whose address the caller holds, can't
+ *   grow that way and gets -1.
+ */
+int mm_hrealloc( mm_handle_t h, size_t size )
+{
+
+    void * bp, * next, * old;
+    size_t cur, avail, copySize;
+
+    STAT(reallocs++);
+
+    if( h == 0 || size == 0 ) return -1;
+
+    bp = HSLOT(h)->bp;
+    cur = avail = GET_SIZE(HDRP(bp));
+
+    //Voodoo to figure out how much memory we need, handle included
+    size += ALIGNMENT;
+    size_t adj_size = CLASS_ROUND((size <= DWORD_SIZE)?(2*DWORD_SIZE):DMULT(size));
+
+    next = NEXT_BLKP(bp);
+    if( !GET_ALLOC(HDRP(next)) ) {
+
+        if( cur + GET_SIZE(HDRP(next)) < adj_size && GET_SIZE(HDRP(NEXT_BLKP(next))) == 0 )
+            extend_heap( MAX(adj_size - cur - GET_SIZE(HDRP(next)), PAGE_SIZE)/WORD_SIZE );
+        if( cur + GET_SIZE(HDRP(next)) >= adj_size ) avail = cur + GET_SIZE(HDRP(next));
+
+    }
+
+    //Resize in place: make it a free block of everything we can use, and
+    //  place the new size in it, which splits off and frees the rest
+    if( adj_size <= avail ) {
+
+        SET_TAG(HDRP(bp), MK_INFO(avail, 0));
+        SET_TAG(FTRP(bp), MK_INFO(avail, 0));
+        if( avail != cur ) {
+
+            STAT_BLOCKS(-1, 0);
+            merged( bp, avail );
+
+        } else STAT_BLOCKS(0, 1);
+
+        place( bp, adj_size );
+        if( !GET_ALLOC(HDRP(NEXT_BLKP(bp))) ) coalesce( NEXT_BLKP(bp) );
+
+        //A shrink gives space back as a free does, which counts towards
+        //  the next compaction
+        if( GET_SIZE(HDRP(bp)) < cur ) g_freedBytes += cur - GET_SIZE(HDRP(bp));
+
+        STAT_GRANT(size - ALIGNMENT, bp);
+        LIFE_MOVED(cur, bp);
+        handle_set( h, bp );
+        return 0;
+
+    }
+
+    if( HSLOT(h)->locks != 0 ) return -1;
+
+    //Finding room may compact, so the old block is only looked up after
+    //  that; left unlocked, it can move out of the way like any other
+    if( (bp = malloc_block(size, MM_LIFE_AUTO)) == NULL ) return -1;
+
+    //The handle comes along in the first ALIGNMENT bytes
+    old = HSLOT(h)->bp;
+    copySize = MIN(size, GET_SIZE(HDRP(old)) - DWORD_SIZE);
+    memcpy(bp, old, copySize);
+    free_block(old);
+
+    STAT_GRANT(size - ALIGNMENT, bp);
+    LIFE_BORN(bp);
+    handle_set( h, bp );
+
+    return 0;
+
+}
+
+/*
+ * compact - slide every unlocked movable block down over the free space
+ *   below it, so that the free space ends up in one block at the top of
+ *   the heap, or just under the blocks that can't move. One pass in
+ *   address order does it: hole is where the free space we have
+ *   collected so far starts, and each block we can move goes there, with
+ *   its handle updated. Any other allocated block closes the hole as one
+ *   free block. The pages of the top block then go back to the OS, since
+ *   mem_sbrk can't give the heap itself back. Returns the bytes moved.
+ */
+static size_t compact( void )
+{
+
+    void * bp, * next, * hole = NULL;
+    size_t sz, moved = 0, largest = 0;
+    tag_t tag;
+
+    for( bp = NEXT_BLKP(g_heapPtr); (sz = GET_SIZE(HDRP(bp))) != 0; bp = next ) {
+
+        next = bp + sz;
+        tag = GET_TAG(HDRP(bp));
+
+        if( !GET_ALLOC(HDRP(bp)) ) {
+
+            STAT_BLOCKS(-1, -1);
+            if( hole == NULL ) hole = bp;
+
+        } else if( hole != NULL && (tag & MOVABLE) &&
+                   HSLOT(*(uint32_t *)bp)->locks == 0 ) {
+
+            //The two may overlap, and the header goes where the hole was
+            memmove(hole, bp, sz - DWORD_SIZE);
+            SET_TAG(HDRP(hole), tag);
+            SET_TAG(FTRP(hole), tag);
+            HSLOT(*(uint32_t *)hole)->bp = hole;
+
+            moved += sz;
+            hole += sz;
+
+        } else if( hole != NULL ) {
+
+            STAT_BLOCKS(1, 1);
+            SET_TAG(HDRP(hole), MK_INFO(bp - hole, 0));
+            SET_TAG(FTRP(hole), MK_INFO(bp - hole, 0));
+            largest = MAX(largest, (size_t)(bp - hole));
+            hole = NULL;
+
+        }
+
+    }
+
+    //What is left is the top block, which the bound leaves out
+    if( hole != NULL ) {
+
+        STAT_BLOCKS(1, 1);
+        SET_TAG(HDRP(hole), MK_INFO(bp - hole, 0));
+        SET_TAG(FTRP(hole), MK_INFO(bp - hole, 0));
+        mem_release( hole, FTRP(hole) );
+
+    }
+
+    //Every cursor may be pointing into the middle of a block now
+    g_maxFree = largest;
+    g_checkCur = g_heapPtr;
+#ifdef MM_NEXT_FIT
+    g_rover = g_heapPtr;
+#endif
+    g_releaseBlk = NULL;
+
+    g_freedBytes = 0;
+    g_compactions++;
+    g_movedBytes += moved;
+
+    return moved;
+
+}
+
+/*
+ * mm_compact - compact the heap now; returns the bytes moved
+ */
+size_t mm_compact( void )
+{
+
+    return compact();
+
+}
+
+/*
+ * mm_hinfo - how many compactions there have been since mm_init, and
+ *   how many bytes they moved
+ */
+void mm_hinfo( size_t * compactions, size_t * moved )
+{
+
+    *compactions = g_compactions;
+    *moved = g_movedBytes;
+
+}
+
+/*
+ * check_block - checks one block for the heap checkers and prints what
+ * is wrong with it. The tags must agree, the size must keep the payload
+ * aligned, the block must end inside the heap, and a free block must not
+ * follow another free block (it would have been coalesced, unless we
+ * were built with MM_DEFERRED_COALESCE), and a movable block must be
+ * the one its handle points to. The previous block's footer
+ * tells us whether it is free, so no state is carried from block to
+ * block and the incremental checker can start anywhere.
+ * Built with MM_PAGEMAP, the free bitmap of a span's block is checked too.
+ */
+static int check_block(void * bp) {
+    size_t size = GET_SIZE(HDRP(bp));
+    int isValid = 1;
+
+    if (GET_TAG(HDRP(bp)) != GET_TAG(FTRP(bp))) {
+        printf("Header and footer disagree at %p.\n", bp);
+        isValid = 0;
+    }
+    if (bp != g_heapPtr && (size < MIN_BLK_SZ || size % ALIGNMENT != 0 ||
+                            (uintptr_t)bp % ALIGNMENT != 0)) {
+        printf("Bad size %u or misaligned block at %p.\n", (unsigned)size, bp);
+        return 0; //can't trust the footer or the next block
+    }
+    if ((char *)bp + size > (char *)mem_heap_hi() + 1) {
+        printf("Block at %p runs past the end of the heap.\n", bp);
+        return 0;
+    }
+#ifndef MM_DEFERRED_COALESCE
+    if (!GET_ALLOC(HDRP(bp)) && !GET_ALLOC(PREV_FTRP(bp))) {
+        printf("Contigious free block at %p.\n", bp);
+        isValid = 0;
+    }
+#endif
+    if (!GET_ALLOC(HDRP(bp)) && GET_SIZE(HDRP(NEXT_BLKP(bp))) != 0 &&
+        size > g_maxFree) {
+        printf("Free block at %p is bigger than the bound of %u.\n", bp,
+               (unsigned)g_maxFree);
+        isValid = 0;
+    }
+#ifdef MM_PAGEMAP
+    if (GET_ALLOC(HDRP(bp)) && !check_span(bp))
+        isValid = 0;
+#endif
+    if (GET_ALLOC(HDRP(bp)) && (GET_TAG(HDRP(bp)) & MOVABLE) && !check_handle(bp))
+        isValid = 0;
+    return isValid;
+}
+
+/*
+ * check_end - checks that a walk of the blocks ended on the epilogue at
+ * the very end of the heap. There is no explicit free list: the list the
+ * allocator searches is the chain of all blocks, so this is what makes
+ * every free byte of the heap a member of it.
+ */
+static int check_end(void * bp) {
+    if (HDRP(bp) != (char *)mem_heap_hi() + 1 - WORD_SIZE || !GET_ALLOC(HDRP(bp))) {
+        printf("Walk ended at %p, not on the epilogue.\n", bp);
+        return 0;
+    }
+    return 1;
+}
+
+/*
+ * mm_check checks the whole heap for consistency, block by block (see
+ * check_block and check_end), and prints each problem it finds. It is
+ * quiet if there are none. We do not use pointers in our headers, and it
+ * is impossible to check if blocks overlap in our implementation because
+ * we cannot tell the difference between header and payload data. Built
+ * with MM_STATS, the free blocks found must match the running count.
+ */
+int mm_check(void) {
+    void * bp = g_heapPtr;
+    int isValid = 1;
+    size_t nfree = 0;
+
+    while (GET_SIZE(HDRP(bp)) != 0) {
+        if (!check_block(bp))
+            return 0;
+        if (!GET_ALLOC(HDRP(bp)))
+            nfree++;
+        bp = NEXT_BLKP(bp);
+    }
+    isValid = check_end(bp);
+
+#ifdef MM_STATS
+    if (nfree != g_stats.free_blocks) {
+        printf("Found %u free blocks, expected %u.\n", (unsigned)nfree,
+               (unsigned)g_stats.free_blocks);
+        isValid = 0;
+    }
+#else
+    (void)nfree;
+#endif
+    return isValid;
+}
+
+/*
+ * mm_check_incr is mm_check spread over many calls: each call checks the
+ * next budget blocks, starting where the last call stopped and wrapping
+ * around at the end of the heap. g_checkCur is kept on a block boundary
+ * by coalesce. Returns 0 if it found a problem.
+ */
+int mm_check_incr(size_t budget) {
+    void * bp = g_checkCur;
+    int isValid = 1;
+
+    while (budget-- > 0) {
+        if (GET_SIZE(HDRP(bp)) == 0) {
+            isValid = check_end(bp);
+            bp = g_heapPtr;
+            break;
+        }
+        if (!check_block(bp)) {
+            isValid = 0;
+            bp = g_heapPtr;
+            break;
+        }
+        bp = NEXT_BLKP(bp);
+    }
+    g_checkCur = bp;
+    return isValid;
+}
+
+/*
+ * mm_freeinfo - count the free blocks in the heap and find the largest one.
+ *   Used by the driver to sample fragmentation while a trace is replayed.
+ */
+void mm_freeinfo( size_t * nfree, size_t * maxfree )
+{
+
+    void * bp = g_heapPtr;
+    size_t sz = GET_SIZE(HDRP(bp));
+    size_t count = 0, largest = 0;
+
+    while( sz != 0 ) {
+
+        if( !GET_ALLOC(HDRP(bp)) ) {
+            count++;
+            largest = MAX(largest, sz);
+        }
+
+        bp = NEXT_BLKP(bp);
+        sz = GET_SIZE(HDRP(bp));
+
+    }
+
+    *nfree = count;
+    *maxfree = largest;
+
+}
+
+/*
+ * mm_get_stats - copy out the counters and count the blocks in the heap.
+ *   Returns 1 if we were built with MM_STATS, 0 if the counters are all 0.
+ */
+int mm_get_stats( mm_stats_t * st )
+{
+
+    void * bp = g_heapPtr;
+    size_t sz = GET_SIZE(HDRP(bp));
+
+#ifdef MM_STATS
+    *st = g_stats;
+#else
+    memset(st, 0, sizeof(*st));
+#endif
+    st->heap_blocks = st->free_blocks = 0;
+
+    while( sz != 0 ) {
+
+        st->heap_blocks++;
+        if( !GET_ALLOC(HDRP(bp)) ) st->free_blocks++;
+
+        bp = NEXT_BLKP(bp);
+        sz = GET_SIZE(HDRP(bp));
+
+    }
+
+#ifdef MM_STATS
+    return 1;
+#else
+    return 0;
+#endif
+
+}
+
+/*
+ * mm_snapshot - dump every block header to fp, for heapanalyze. Much
+ *   cheaper than prnHeap: four bytes per block through stdio's buffer.
+ */
+int mm_snapshot( FILE * fp, int trace, int opnum, size_t live )
+{
+
+    mm_snaphdr_t hdr;
+    void * bp;
+    uint32_t tag;
+
+    //Count the blocks first, the header says how many follow
+    hdr.nblocks = 0;
+    for( bp = g_heapPtr; GET_SIZE(HDRP(bp)) != 0; bp = NEXT_BLKP(bp) ) hdr.nblocks++;
+
+    hdr.magic = MM_SNAP_MAGIC;
+    hdr.trace = trace;
+    hdr.opnum = opnum;
+    hdr.heap_size = mem_heapsize();
+    hdr.live = live;
+    hdr.first = HDRP(g_heapPtr) - mem_heap_lo();
+
+    if( fwrite(&hdr, sizeof(hdr), 1, fp) != 1 ) return -1;
+
+    for( bp = g_heapPtr; GET_SIZE(HDRP(bp)) != 0; bp = NEXT_BLKP(bp) ) {
+
+        tag = GET_TAG(HDRP(bp)); //MM_WIDE_TAGS too: no heap here reaches 4GB
+        if( fwrite(&tag, sizeof(tag), 1, fp) != 1 ) return -1;
+
+    }
+
+    return 0;
+
+}
+
+/*
+ * mm_prof_rate - sample about one allocation per rate bytes from now
+ *   on, or none if rate is 0. The samples taken so far are forgotten.
+ */
+void mm_prof_rate( size_t rate )
+{
+
+    g_profRate = MIN(rate, (size_t)1 << 30);
+    prof_reset();
+
+}
+
+/*
+ * mm_life_predict - place the blocks of mm_malloc (and of mm_malloc_hint
+ *   with MM_LIFE_AUTO) by their predicted lifetime, or first-fit if on
+ *   is 0. The history kept so far is forgotten.
+ */
+void mm_life_predict( int on )
+{
+
+    g_lifePredict = on;
+    life_reset();
+
+}
+
+//Heapsort n elements of size bytes at base in place. mm_prof_dump runs
+//under malloc's lock, and qsort may malloc scratch space for big arrays
+static void sift_down( char * base, int root, int n, size_t size,
+                       int (* cmp)( const void *, const void * ) )
+{
+
+    int child;
+    size_t k;
+    char * a, * b, t;
+
+    while( (child = 2 * root + 1) < n ) {
+
+        if( child + 1 < n && cmp(base + child * size, base + (child + 1) * size) < 0 )
+            child++;
+        a = base + root * size;
+        b = base + child * size;
+        if( cmp(a, b) >= 0 ) return;
+        for( k = 0; k < size; k++ ) {
+
+            t = a[k];
+            a[k] = b[k];
+            b[k] = t;
+
+        }
+        root = child;
+
+    }
+
+}
+
+static void heap_sort( void * base, int n, size_t size,
+                       int (* cmp)( const void *, const void * ) )
+{
+
+    char * a = base, t;
+    int i;
+    size_t k;
+
+    for( i = n / 2 - 1; i >= 0; i-- )
+        sift_down(a, i, n, size, cmp);
+    for( i = n - 1; i > 0; i-- ) {
+
+        for( k = 0; k < size; k++ ) {
+
+            t = a[k];
+            a[k] = a[i * size + k];
+            a[i * size + k] = t;
+
+        }
+        sift_down(a, 0, i, size, cmp);
+
+    }
+
+}
+
+//Sort g_prof indices by stack, and sites by estimated bytes, largest first
+static int cmp_stack( const void * a, const void * b )
+{
+    return memcmp(g_prof[*(const int *)a].stack, g_prof[*(const int *)b].stack,
+                  sizeof(g_prof[0].stack));
+}
+
+typedef struct {
+    int first;               //g_prof index of one of its samples
+    size_t samples;
+    uint64_t bytes, blocks;  //estimated live bytes and blocks
+    uint64_t oldest;         //bytes allocated since its oldest sample
+} site_t;
+
+static int cmp_site( const void * a, const void * b )
+{
+    const site_t * x = a, * y = b;
+    return (x->bytes < y->bytes) - (x->bytes > y->bytes);
+}
+
+/*
+ * mm_prof_dump - write the sampled blocks that are still live to fp,
+ *   summed by the stack that allocated them. Each site is one line:
+ *   estimated live bytes and blocks, samples, how many bytes have been
+ *   allocated since the oldest of them (large for leaks), and the return
+ *   addresses, innermost first, for addr2line. Sorts in place rather
+ *   than with qsort, which may malloc. If fp has a buffer of its own
+ *   (setvbuf), it is safe to call from inside malloc's lock.
+ */
+int mm_prof_dump( FILE * fp )
+{
+
+    static int order[PROF_MAX];
+    static site_t sites[PROF_MAX];
+    uint64_t now = g_profDrawn - g_sampleLeft;
+    int i, n = 0, nsites = 0, d;
+    prof_t * p;
+
+    for( i = 0; i < PROF_MAX; i++ )
+        if( g_prof[i].bp != NULL ) order[n++] = i;
+    heap_sort(order, n, sizeof(int), cmp_stack);
+
+    //Runs of equal stacks are one site
+    for( i = 0; i < n; i++ ) {
+
+        p = &g_prof[order[i]];
+        if( i == 0 || cmp_stack(&order[i - 1], &order[i]) != 0 ) {
+
+            memset(&sites[nsites], 0, sizeof(site_t));
+            sites[nsites++].first = order[i];
+
+        }
+        sites[nsites - 1].samples++;
+        sites[nsites - 1].bytes += p->weight;
+        sites[nsites - 1].blocks += p->weight / MAX(p->size, 1);
+        sites[nsites - 1].oldest = MAX(sites[nsites - 1].oldest, now - p->birth);
+
+    }
+    heap_sort(sites, nsites, sizeof(site_t), cmp_site);
+
+    fprintf(fp, "# mm heap profile: 1 sample per %lu bytes, %lu live samples "
+            "(%lu freed, %lu dropped)\n", (unsigned long)g_profRate,
+            (unsigned long)g_profLive, (unsigned long)g_profFreed,
+            (unsigned long)g_profDropped);
+    fprintf(fp, "# %12s %10s %8s %12s  stack\n", "bytes", "blocks", "samples", "age");
+    for( i = 0; i < nsites; i++ ) {
+
+        fprintf(fp, "  %12llu %10llu %8lu %12llu ", 
+                (unsigned long long)sites[i].bytes, (unsigned long long)sites[i].blocks,
+                (unsigned long)sites[i].samples, (unsigned long long)sites[i].oldest);
+        p = &g_prof[sites[i].first];
+        for( d = 0; d < PROF_DEPTH && p->stack[d] != NULL; d++ )
+            fprintf(fp, " %p", p->stack[d]);
+        fprintf(fp, "\n");
+
+    }
+
+    return ferror(fp) ? -1 : 0;
+
+}
+
+/*
+ * prnHeap
+ */
+void prnHeap()
+{
+
+    void * bp = g_heapPtr;
+    size_t sz = GET_SIZE(HDRP(bp));
+
+    do {
+
+        printf("%p:%09lu, %d\n", bp, (unsigned long)sz, (int)GET_ALLOC(HDRP(bp)));
+        bp = NEXT_BLKP(bp);
+        sz = GET_SIZE(HDRP(bp));
+
+    } while ( sz != 0 );
+
+    printf("Reached sentinel! %p:%lu\n", bp, (unsigned long)sz);
+
+}
+
+/*
+ * mm_allocator - this build of mm.c as seen by the drivers (allocator.h).
+ *   Under MM_PREFIX both the object and its name follow the prefix.
+ */
+#ifdef MM_PREFIX
+#define MM_STR2(x) #x
+#define MM_STR(x) MM_STR2(x)
+#define MM_NAME MM_STR(MM_PREFIX)
+#else
+#define MM_NAME "mm"
+#endif
+
+allocator_t mm_allocator = {
+    MM_NAME, mm_init, mm_malloc, mm_free, mm_realloc, mm_malloc_hint,
+    mm_check, mm_check_incr, mm_freeinfo, 1
+};
@@ -1,11 +1,169 @@
 #include <stdio.h>
+#include <stdint.h>
+
+/*
+ * Built with -DMM_PREFIX=name (see VARIANTS in the Makefile), every 
+ * public symbol of mm.c becomes name_*, so that several builds of mm.c
+ * can be linked into one driver and told apart through allocator.h
+ */
+#ifdef MM_PREFIX
+#define MM_PASTE2(a, b) a ## b
+#define MM_PASTE(a, b) MM_PASTE2(a, b)
+#define mm_init        MM_PASTE(MM_PREFIX, _init)
+#define mm_malloc      MM_PASTE(MM_PREFIX, _malloc)
+#define mm_malloc_hint MM_PASTE(MM_PREFIX, _malloc_hint)
+#define mm_free        MM_PASTE(MM_PREFIX, _free)
+#define mm_realloc     MM_PASTE(MM_PREFIX, _realloc)
+#define mm_memalign    MM_PASTE(MM_PREFIX, _memalign)
+#define mm_usable_size MM_PASTE(MM_PREFIX, _usable_size)
+#define mm_check       MM_PASTE(MM_PREFIX, _check)
+#define mm_check_incr  MM_PASTE(MM_PREFIX, _check_incr)
+#define mm_freeinfo    MM_PASTE(MM_PREFIX, _freeinfo)
+#define mm_get_stats   MM_PASTE(MM_PREFIX, _get_stats)
+#define mm_snapshot    MM_PASTE(MM_PREFIX, _snapshot)
+#define mm_prof_rate   MM_PASTE(MM_PREFIX, _prof_rate)
+#define mm_prof_dump   MM_PASTE(MM_PREFIX, _prof_dump)
+#define mm_life_predict MM_PASTE(MM_PREFIX, _life_predict)
+#define mm_halloc      MM_PASTE(MM_PREFIX, _halloc)
+#define mm_hlock       MM_PASTE(MM_PREFIX, _hlock)
+#define mm_hunlock     MM_PASTE(MM_PREFIX, _hunlock)
+#define mm_hfree       MM_PASTE(MM_PREFIX, _hfree)
+#define mm_hrealloc    MM_PASTE(MM_PREFIX, _hrealloc)
+#define mm_compact     MM_PASTE(MM_PREFIX, _compact)
+#define mm_hinfo       MM_PASTE(MM_PREFIX, _hinfo)
+#define mm_allocator   MM_PASTE(MM_PREFIX, _allocator)
+#define prnHeap        MM_PASTE(MM_PREFIX, _prnHeap)
+#define team           MM_PASTE(MM_PREFIX, _team)
+#endif
 
 extern int mm_init (void);
 extern void *mm_malloc (size_t size);
 extern void mm_free (void *ptr);
 extern void *mm_realloc(void *ptr, size_t size);
+extern void *mm_memalign(size_t alignment, size_t size);
+extern size_t mm_usable_size(void *ptr);
+
+/*
+ * Lifetime-segregated placement: short lived blocks are put at the top
+ * of the heap and long lived ones first-fit from the bottom, so that
+ * neither pins down holes the other could have used. mm_malloc_hint
+ * takes the caller's word for the lifetime; MM_LIFE_AUTO, like plain
+ * mm_malloc, means long lived unless mm_life_predict has turned on the
+ * predictor, which guesses from the recent history of the size class.
+ */
+#define MM_LIFE_AUTO  0
+#define MM_LIFE_SHORT 1
+#define MM_LIFE_LONG  2
+
+extern void *mm_malloc_hint(size_t size, int life);
+extern void mm_life_predict(int on);
 
+/*
+ * Movable blocks, for callers that can live with an indirection: a block
+ * from mm_halloc is named by its handle, and its address is only good
+ * between mm_hlock and mm_hunlock. While no lock is held, mm may move
+ * the block to slide free space to the top of the heap, and it does so
+ * on its own when the heap would otherwise grow. mm_compact does it
+ * right away and returns the bytes moved. mm_hrealloc returns -1 if
+ * there is no room, or if the block is locked and can't be resized
+ * where it is, and mm_hinfo counts the compactions and the bytes they
+ * moved since mm_init. Handle 0 means no block.
+ */
+typedef uint32_t mm_handle_t;
+
+extern mm_handle_t mm_halloc(size_t size);
+extern void *mm_hlock(mm_handle_t h);
+extern void mm_hunlock(mm_handle_t h);
+extern void mm_hfree(mm_handle_t h);
+extern int mm_hrealloc(mm_handle_t h, size_t size);
+extern size_t mm_compact(void);
+extern void mm_hinfo(size_t *compactions, size_t *moved);
+
+extern int mm_check(void);
+extern int mm_check_incr(size_t budget);
 extern void prnHeap();
+extern void mm_freeinfo(size_t *nfree, size_t *maxfree);
+
+/*
+ * What mm.c has done since the last mm_init. The counters are only kept
+ * when mm.c is compiled with -DMM_STATS (make MMFLAGS=-DMM_STATS), so
+ * the builds that are timed don't pay for them; otherwise they read 0.
+ * The block counts come from walking the heap and are always filled in.
+ */
+/*
+ * Searches are also broken down by the size of the block asked for:
+ * class c holds sizes 2^(c+4) to 2^(c+5)-1 bytes (the last class takes
+ * everything bigger), and bucket b of its histogram counts searches that
+ * visited 2^b to 2^(b+1)-1 blocks (the last bucket takes the rest)
+ */
+#define MM_STATS_CLASSES 16
+#define MM_STATS_BUCKETS 20
+
+typedef struct {
+    size_t mallocs;         /* calls to mm_malloc */
+    size_t frees;           /* calls to mm_free */
+    size_t reallocs;        /* calls to mm_realloc */
+    size_t memaligns;       /* calls to mm_memalign */
+    size_t bytes_requested; /* payload bytes asked for by those calls */
+    size_t bytes_granted;   /* size of the blocks handed back, tags and all */
+    size_t splits;          /* free blocks split to place a request */
+    size_t coalesce[4];     /* coalesce cases: neither neighbour free, 
+			       previous free, next free, both free */
+    size_t extends;         /* calls to extend_heap */
+    size_t extend_bytes;    /* bytes added to the heap by extend_heap */
+    size_t searches;        /* free block searches */
+    size_t search_steps;    /* blocks visited by those searches */
+    size_t wild_allocs;     /* blocks cut from the top of the heap with no 
+			       search, or after a failed one */
+    size_t class_searches[MM_STATS_CLASSES];  /* searches per size class */
+    size_t class_steps[MM_STATS_CLASSES];     /* blocks they visited */
+    size_t class_max_steps[MM_STATS_CLASSES]; /* longest of them */
+    size_t class_hdr_bytes[MM_STATS_CLASSES]; /* header bytes they read */
+    size_t class_span[MM_STATS_CLASSES];      /* heap bytes they walked */
+    size_t search_hist[MM_STATS_CLASSES][MM_STATS_BUCKETS];
+    size_t max_free_blocks; /* most free blocks in the heap at any time */
+    size_t max_heap_blocks; /* most blocks of any kind at any time */
+    size_t free_blocks;     /* free blocks in the heap right now */
+    size_t heap_blocks;     /* all blocks, i.e. the length of the list a 
+			       search walks */
+} mm_stats_t;
+
+/* Fill in *st; returns 1 if the counters were compiled in, else 0 */
+extern int mm_get_stats(mm_stats_t *st);
+
+/*
+ * A heap snapshot, as written by mm_snapshot and read by heapanalyze: a
+ * mm_snaphdr_t, then nblocks 32-bit block headers (size | allocated
+ * bit) in address order, the first at offset first from mem_heap_lo().
+ * A file holds any number of snapshots back to back. The fields are all
+ * naturally aligned, so -m32 and 64-bit builds agree on the layout.
+ */
+#define MM_SNAP_MAGIC 0x50414e53  /* "SNAP" */
+
+typedef struct {
+    uint32_t magic;      /* MM_SNAP_MAGIC */
+    uint32_t trace;      /* trace number, from the caller */
+    uint32_t opnum;      /* last request replayed, from the caller */
+    uint32_t nblocks;    /* block headers that follow */
+    uint64_t heap_size;  /* mem_heapsize() */
+    uint64_t live;       /* payload bytes in use, from the caller */
+    uint64_t first;      /* offset of the first block header */
+} mm_snaphdr_t;
+
+/* Append a snapshot of the heap to fp; returns -1 if a write fails */
+extern int mm_snapshot(FILE *fp, int trace, int opnum, size_t live);
+
+/*
+ * Heap profiling, always on: mm samples about one allocation in every
+ * MM_PROF_RATE bytes allocated and remembers its size and call stack
+ * until it is freed. mm_prof_rate changes the rate (0 turns sampling
+ * off) and mm_prof_dump writes the live samples, summed by call stack,
+ * as text. mm_init forgets all samples but keeps the rate.
+ */
+#define MM_PROF_RATE (512 * 1024)
+
+extern void mm_prof_rate(size_t rate);
+extern int mm_prof_dump(FILE *fp);
 
 
 /* 
@@ -0,0 +1,392 @@
+/*
+ * mmbench.c - Microbenchmarks for the allocator primitives, mm against
+ *     libc malloc
+ *
+ * The trace replays in mdriver mix every kind of request together. The
+ * benchmarks here each exercise one pattern, so a regression can be
+ * pinned to it:
+ *
+ *     pingpong-<n>   malloc(n) immediately followed by free, per size class
+ *     lifo-<n>       allocate a batch of n-byte blocks, free newest first
+ *     fifo-<n>       allocate a batch of n-byte blocks, free oldest first
+ *     realloc-x2     grow a block from 16 bytes to 64 KB by doubling
+ *     realloc-+64    grow a block from 64 bytes to 16 KB in 64-byte steps
+ *     frag-<n>       malloc past n small holes that can't satisfy it
+ *     churn-large    replace random 64-512 KB blocks among a few live ones
+ *
+ * Every package in the allocator.h registry is measured: mm, any
+ * VARIANTS built into this binary, and libc. Each benchmark is run
+ * REPS times per package and the fastest run is kept. Setup that is
+ * not part of the pattern (e.g. punching the holes for frag-<n>) is not
+ * timed. Times are reported in ns per op and in cycles (ticks of the
+ * clock.c counter) per op, followed by mm's time relative to libc.
+ *
+ * Usage: mmbench [-h] [-n <scale>] [-r <reps>] [-b <name>]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "allocator.h"
+#include "memlib.h"
+#include "clock.h"
+
+/**********************
+ * Constants and macros
+ **********************/
+
+#define REPS        5        /* default runs per benchmark and allocator */
+#define MAXBENCH    64       /* max number of benchmarks */
+#define MAXALLOCS   16       /* max number of packages measured */
+#define PINGPONG_N  200000   /* malloc/free pairs per pingpong run */
+#define BATCH       2000     /* blocks per lifo/fifo batch */
+#define BATCH_N     50       /* batches per lifo/fifo run */
+#define CHAIN_N     200      /* growth chains per realloc run */
+#define FRAG_N      2000     /* timed mallocs per frag run */
+#define FRAG_HOLE   16       /* payload size of the blocks between holes */
+#define CHURN_SLOTS 4        /* live blocks in churn-large */
+#define CHURN_N     2000     /* replacements per churn-large run */
+
+/**********************
+ * Data types
+ **********************/
+
+/* One benchmark. run returns the number of ops it timed. */
+typedef struct {
+    char name[32];
+    long (*run)(allocator_t *a, long arg, long scale);
+    long arg;                     /* size or count the benchmark is about */
+} micro_t;
+
+/********************
+ * Global variables
+ *******************/
+
+static double cycles;            /* counter ticks of the last timed region */
+static unsigned long long rng_state = 1; /* xorshift64* state */
+
+/* Function prototypes */
+static void usage(void);
+static void app_error(char *msg);
+
+/*
+ * rng_next - Next 64 random bits (xorshift64*), so runs are repeatable
+ */
+static unsigned long long rng_next(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+/*
+ * reset - Give a an empty heap. Packages on the memlib heap start over
+ *     from nothing; libc keeps its heap.
+ */
+static void reset(allocator_t *a)
+{
+    if (a->uses_memlib)
+	mem_reset_brk();
+    if (a->init() < 0)
+	app_error("init failed");
+}
+
+/*
+ * xmalloc - Allocate through a, treating failure as fatal. Every block
+ *     gets its first byte written so that libc can't hand out untouched
+ *     pages for free.
+ */
+static void *xmalloc(allocator_t *a, size_t size)
+{
+    char *p;
+
+    if ((p = a->malloc(size)) == NULL)
+	app_error("malloc failed");
+    *p = 1;
+    return p;
+}
+
+static void *xrealloc(allocator_t *a, void *ptr, size_t size)
+{
+    char *p;
+
+    if ((p = a->realloc(ptr, size)) == NULL)
+	app_error("realloc failed");
+    p[size - 1] = 1;
+    return p;
+}
+
+/* Scratch array of block pointers, outside the heap under test */
+static void **slots(long n)
+{
+    static void **buf = NULL;
+    static long max = 0;
+
+    if (n > max) {
+	if ((buf = realloc(buf, n * sizeof(void *))) == NULL)
+	    app_error("out of memory for block pointers");
+	max = n;
+    }
+    return buf;
+}
+
+/*********************************
+ * The benchmarks. Each one times
+ * its own critical section.
+ *********************************/
+
+static long run_pingpong(allocator_t *a, long size, long scale)
+{
+    long i, n = PINGPONG_N * scale;
+
+    start_counter();
+    for (i = 0; i < n; i++)
+	a->free(xmalloc(a, size));
+    cycles = get_counter();
+    return 2 * n;
+}
+
+static long run_batch(allocator_t *a, long size, long scale, int lifo)
+{
+    void **p = slots(BATCH);
+    long i, b, n = BATCH_N * scale;
+
+    start_counter();
+    for (b = 0; b < n; b++) {
+	for (i = 0; i < BATCH; i++)
+	    p[i] = xmalloc(a, size);
+	if (lifo)
+	    for (i = BATCH - 1; i >= 0; i--)
+		a->free(p[i]);
+	else
+	    for (i = 0; i < BATCH; i++)
+		a->free(p[i]);
+    }
+    cycles = get_counter();
+    return 2 * BATCH * n;
+}
+
+static long run_lifo(allocator_t *a, long size, long scale)
+{
+    return run_batch(a, size, scale, 1);
+}
+
+static long run_fifo(allocator_t *a, long size, long scale)
+{
+    return run_batch(a, size, scale, 0);
+}
+
+static long run_realloc_double(allocator_t *a, long max, long scale)
+{
+    long c, size, ops = 0, n = CHAIN_N * scale;
+    void *p;
+
+    start_counter();
+    for (c = 0; c < n; c++) {
+	p = xmalloc(a, 16);
+	for (size = 32; size <= max; size *= 2, ops++)
+	    p = xrealloc(a, p, size);
+	a->free(p);
+	ops += 2;
+    }
+    cycles = get_counter();
+    return ops;
+}
+
+static long run_realloc_step(allocator_t *a, long max, long scale)
+{
+    long c, size, ops = 0, n = CHAIN_N * scale;
+    void *p;
+
+    start_counter();
+    for (c = 0; c < n; c++) {
+	p = xmalloc(a, 64);
+	for (size = 128; size <= max; size += 64, ops++)
+	    p = xrealloc(a, p, size);
+	a->free(p);
+	ops += 2;
+    }
+    cycles = get_counter();
+    return ops;
+}
+
+/*
+ * run_frag - Build holes blocks of FRAG_HOLE bytes separated by live
+ *     blocks of the same size, so no two holes coalesce, then time
+ *     mallocs that are too big for any hole. A first-fit search walks
+ *     past every hole each time.
+ */
+static long run_frag(allocator_t *a, long holes, long scale)
+{
+    void **p = slots(2 * holes + FRAG_N * scale);
+    void **big = p + 2 * holes;
+    long i, n = FRAG_N * scale;
+
+    for (i = 0; i < 2 * holes; i++)
+	p[i] = xmalloc(a, FRAG_HOLE);
+    for (i = 0; i < 2 * holes; i += 2)
+	a->free(p[i]);
+
+    start_counter();
+    for (i = 0; i < n; i++)
+	big[i] = xmalloc(a, 4 * FRAG_HOLE);
+    cycles = get_counter();
+
+    for (i = 0; i < n; i++)
+	a->free(big[i]);
+    for (i = 1; i < 2 * holes; i += 2)
+	a->free(p[i]);
+    return n;
+}
+
+static long run_churn(allocator_t *a, long unused, long scale)
+{
+    void **p = slots(CHURN_SLOTS);
+    long i, k, n = CHURN_N * scale;
+
+    rng_state = 1;
+    for (k = 0; k < CHURN_SLOTS; k++)
+	p[k] = NULL;
+
+    start_counter();
+    for (i = 0; i < n; i++) {
+	k = rng_next() % CHURN_SLOTS;
+	if (p[k] != NULL)
+	    a->free(p[k]);
+	p[k] = xmalloc(a, (64 << 10) + rng_next() % (448 << 10));
+    }
+    cycles = get_counter();
+
+    for (k = 0; k < CHURN_SLOTS; k++)
+	if (p[k] != NULL)
+	    a->free(p[k]);
+    return 2 * n;
+}
+
+/*
+ * add_micro - Append a benchmark to the list
+ */
+static int add_micro(micro_t *list, int n, char *name, long arg,
+		     long (*run)(allocator_t *, long, long))
+{
+    if (n == MAXBENCH)
+	app_error("too many benchmarks");
+    strncpy(list[n].name, name, sizeof(list[n].name) - 1);
+    list[n].name[sizeof(list[n].name) - 1] = '\0';
+    list[n].arg = arg;
+    list[n].run = run;
+    return n + 1;
+}
+
+int main(int argc, char **argv)
+{
+    static long classes[] = {8, 16, 24, 32, 48, 64, 128, 256, 512,
+			     1024, 4096, 16384};
+    static long batch_sizes[] = {16, 64, 256};
+    static long frag_holes[] = {100, 1000, 4000};
+    micro_t list[MAXBENCH];
+    char name[32], *filter = NULL;
+    double rate, best[MAXALLOCS], ops, c;
+    long scale = 1;
+    int reps = REPS;
+    int i, n = 0, r, ch, nallocs, k;
+    unsigned j;
+
+    while ((ch = getopt(argc, argv, "n:r:b:h")) != EOF) {
+	switch (ch) {
+	case 'n': /* Scale the number of ops in every benchmark */
+	    scale = atol(optarg);
+	    break;
+	case 'r': /* Runs per benchmark and allocator */
+	    reps = atoi(optarg);
+	    break;
+	case 'b': /* Only run benchmarks whose name contains this */
+	    filter = optarg;
+	    break;
+	case 'h':
+	    usage();
+	    exit(0);
+	default:
+	    usage();
+	    exit(1);
+	}
+    }
+    if (scale <= 0 || reps <= 0)
+	app_error("-n and -r must be positive");
+
+    for (j = 0; j < sizeof(classes) / sizeof(long); j++) {
+	sprintf(name, "pingpong-%ld", classes[j]);
+	n = add_micro(list, n, name, classes[j], run_pingpong);
+    }
+    for (j = 0; j < sizeof(batch_sizes) / sizeof(long); j++) {
+	sprintf(name, "lifo-%ld", batch_sizes[j]);
+	n = add_micro(list, n, name, batch_sizes[j], run_lifo);
+	sprintf(name, "fifo-%ld", batch_sizes[j]);
+	n = add_micro(list, n, name, batch_sizes[j], run_fifo);
+    }
+    n = add_micro(list, n, "realloc-x2", 1 << 16, run_realloc_double);
+    n = add_micro(list, n, "realloc-+64", 1 << 14, run_realloc_step);
+    for (j = 0; j < sizeof(frag_holes) / sizeof(long); j++) {
+	sprintf(name, "frag-%ld", frag_holes[j]);
+	n = add_micro(list, n, name, frag_holes[j], run_frag);
+    }
+    n = add_micro(list, n, "churn-large", 0, run_churn);
+
+    for (nallocs = 0; allocators[nallocs] != NULL; nallocs++)
+	if (nallocs == MAXALLOCS)
+	    app_error("too many packages");
+
+    mem_init();
+    rate = mhz(0);
+
+    printf("%-16s", "benchmark");
+    for (k = 0; k < nallocs; k++)
+	printf("%8s ns/op%7s cyc", allocators[k]->name, "");
+    printf("%10s\n", "mm/libc");
+
+    for (i = 0; i < n; i++) {
+	if (filter != NULL && strstr(list[i].name, filter) == NULL)
+	    continue;
+	for (k = 0; k < nallocs; k++) {
+	    best[k] = -1;
+	    for (r = 0; r < reps; r++) {
+		reset(allocators[k]);
+		ops = list[i].run(allocators[k], list[i].arg, scale);
+		c = cycles / ops;
+		if (best[k] < 0 || c < best[k])
+		    best[k] = c;
+	    }
+	}
+	printf("%-16s", list[i].name);
+	for (k = 0; k < nallocs; k++)
+	    printf("%14.1f%11.1f", best[k] * 1e3 / rate, best[k]);
+	printf("%10.2f\n", best[0] / best[nallocs - 1]);
+    }
+
+    mem_deinit();
+    exit(0);
+}
+
+/*
+ * app_error - Report an arbitrary application error
+ */
+static void app_error(char *msg)
+{
+    fprintf(stderr, "mmbench: %s\n", msg);
+    exit(1);
+}
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(void)
+{
+    fprintf(stderr, "Usage: mmbench [-h] [-n <scale>] [-r <reps>] [-b <name>]\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-b <name>   Only run benchmarks whose name contains <name>.\n");
+    fprintf(stderr, "\t-h          Print this message.\n");
+    fprintf(stderr, "\t-n <scale>  Multiply the ops in every benchmark by <scale>.\n");
+    fprintf(stderr, "\t-r <reps>   Runs per benchmark, keeping the fastest (default %d).\n", REPS);
+}
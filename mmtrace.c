@@ -0,0 +1,596 @@
+/*
+ * mmtrace.c - LD_PRELOAD shim that records the malloc, calloc, realloc
+ *     and free calls of an unmodified program into a .rep trace that
+ *     mdriver can replay.
+ *
+ *     LD_PRELOAD=./libmmtrace.so MMTRACE_FILE=prog.rep prog args...
+ *     ./mdriver -f prog.rep
+ *
+ * Recording is lock free. Each thread appends fixed size records to its
+ * own buffer and stamps them from a global atomic sequence counter, so
+ * that the calls of all threads can be put back in order later. A full
+ * buffer is appended to a raw file (<file>.raw) with a single write().
+ * Buffers are linked into a global list with compare-and-swap so that
+ * they can all be flushed at exit, and a buffer whose thread has exited
+ * is reused by the next new thread.
+ *
+ * When the process exits, the raw records are sorted by sequence
+ * number, live pointers are mapped to the dense ids that read_trace
+ * expects (a pointer that is freed and handed out again gets a new id),
+ * and the trace is written with its header. Frees of blocks that were
+ * not allocated through the shim (for instance memalign'd blocks, or
+ * blocks allocated before it was loaded) are dropped. Blocks still live
+ * at exit are left live, so the trace may not be balanced.
+ *
+ * A "%p" in MMTRACE_FILE is replaced by the process id, which keeps
+ * the traces of children that exec apart. Forked children that do not
+ * exec are not traced.
+ *
+ * Only glibc is supported: calls are forwarded to __libc_malloc and
+ * friends, which avoids the dlsym() bootstrap problem.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/**********************
+ * Constants and macros
+ **********************/
+
+#define DEFAULT_FILE "mmtrace.rep"  /* trace file if MMTRACE_FILE is unset */
+#define MAXPATH      4096           /* max length of the file names */
+#define BUFRECS      4096           /* records per thread buffer */
+#define HDRWIDTH     20             /* width of each trace header field */
+
+#define TLS __thread __attribute__((tls_model("initial-exec")))
+
+/* The libc entry points we forward to */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+/**********************
+ * Data types
+ **********************/
+
+enum {OP_ALLOC, OP_FREE, OP_REALLOC};
+
+/* One recorded call, as stored in the raw file */
+typedef struct {
+    uint64_t seq;    /* position in the global order */
+    uint64_t seq2;   /* realloc only: position once the call returned */
+    uint64_t ptr;    /* block returned (alloc/realloc) or freed (free) */
+    uint64_t old;    /* realloc only: block passed in */
+    uint64_t size;   /* requested size (alloc/realloc) */
+    uint32_t op;     /* OP_ALLOC, OP_FREE or OP_REALLOC */
+    uint32_t pad;
+} rec_t;
+
+/* A per-thread record buffer */
+typedef struct tbuf {
+    struct tbuf *next;   /* next buffer in the global list */
+    int owned;           /* set while a live thread owns the buffer */
+    int count;           /* number of records in recs */
+    rec_t recs[BUFRECS];
+} tbuf_t;
+
+/* Replay events used when the trace is written. A realloc gives two
+   events: the old block goes away when the call starts (seq), and the
+   new block appears when the call returns (seq2). */
+typedef struct {
+    uint64_t seq;
+    uint32_t rec;    /* index of the record */
+    uint32_t end;    /* realloc: 0 for the start, 1 for the return */
+} event_t;
+
+/********************
+ * Global variables
+ *******************/
+
+static volatile int tracing = 0;     /* set while calls are being recorded */
+static int init_state = 0;           /* 0 = not started, 1 = busy, 2 = done */
+static pid_t owner_pid;              /* process that writes the trace */
+static int rawfd = -1;               /* raw record file */
+static char tracefile[MAXPATH];      /* final .rep trace */
+static char rawfile[MAXPATH+4];      /* raw records, removed at exit */
+static uint64_t next_seq = 0;        /* global sequence counter */
+static tbuf_t *buffers = NULL;       /* all thread buffers */
+static pthread_key_t buf_key;        /* releases a buffer at thread exit */
+
+static TLS tbuf_t *mybuf = NULL;     /* this thread's buffer */
+static TLS int busy = 0;             /* set while inside the shim */
+
+/*********************
+ * Function prototypes
+ *********************/
+static void init_trace(void);
+static void write_trace(void);
+
+/*********************************************
+ * Recording
+ *********************************************/
+
+/*
+ * flush_buf - Append the records in b to the raw file
+ */
+static void flush_buf(tbuf_t *b)
+{
+    char *p = (char *)b->recs;
+    size_t left = b->count * sizeof(rec_t);
+    ssize_t n;
+
+    while (left > 0) {
+	if ((n = write(rawfd, p, left)) < 0) {
+	    if (errno == EINTR)
+		continue;
+	    break;
+	}
+	p += n;
+	left -= n;
+    }
+    b->count = 0;
+}
+
+/*
+ * release_buf - Thread exit destructor: flush the thread's buffer and
+ *     let a later thread reuse it. A later destructor that allocates
+ *     claims a buffer afresh instead of writing to this one.
+ */
+static void release_buf(void *arg)
+{
+    tbuf_t *b = (tbuf_t *)arg;
+
+    flush_buf(b);
+    mybuf = NULL;
+    __atomic_store_n(&b->owned, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * get_buf - Return this thread's buffer, claiming an unowned one or
+ *     mapping and publishing a new one on first use
+ */
+static tbuf_t *get_buf(void)
+{
+    tbuf_t *b;
+    int unowned;
+
+    if (mybuf)
+	return mybuf;
+
+    for (b = __atomic_load_n(&buffers, __ATOMIC_ACQUIRE); b; b = b->next) {
+	unowned = 0;
+	if (__atomic_compare_exchange_n(&b->owned, &unowned, 1, 0,
+					__ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+	    break;
+    }
+
+    if (b == NULL) {
+	b = mmap(NULL, sizeof(tbuf_t), PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (b == MAP_FAILED)
+	    return NULL;
+	b->owned = 1;
+	b->count = 0;
+	b->next = __atomic_load_n(&buffers, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&buffers, &b->next, b, 0,
+					    __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+	    ;
+    }
+
+    mybuf = b;
+    pthread_setspecific(buf_key, b);
+    return b;
+}
+
+/*
+ * new_rec - Return a fresh record in this thread's buffer, or NULL
+ */
+static rec_t *new_rec(void)
+{
+    tbuf_t *b;
+
+    if (init_state != 2)
+	init_trace();
+    if (!tracing || (b = get_buf()) == NULL)
+	return NULL;
+    if (b->count == BUFRECS)
+	flush_buf(b);
+    return &b->recs[b->count];
+}
+
+/*
+ * commit_rec - Fill in and publish the record returned by new_rec
+ */
+static void commit_rec(rec_t *r, int op, void *ptr, void *old, size_t size)
+{
+    r->op = op;
+    r->ptr = (uintptr_t)ptr;
+    r->old = (uintptr_t)old;
+    r->size = size;
+    mybuf->count++;
+}
+
+/*
+ * stamp - Take the next position in the global order
+ */
+static uint64_t stamp(void)
+{
+    return __atomic_fetch_add(&next_seq, 1, __ATOMIC_SEQ_CST);
+}
+
+/*********************************************
+ * The intercepted entry points. An allocation
+ * is stamped after libc returns the block and a
+ * free before libc gets it back, so a block is
+ * never seen to be reused before it is freed.
+ *********************************************/
+
+void *malloc(size_t size)
+{
+    void *p = __libc_malloc(size);
+    rec_t *r;
+
+    if (p && !busy) {
+	busy = 1;
+	if ((r = new_rec()) != NULL) {
+	    r->seq = stamp();
+	    commit_rec(r, OP_ALLOC, p, NULL, size);
+	}
+	busy = 0;
+    }
+    return p;
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    void *p = __libc_calloc(nmemb, size);
+    rec_t *r;
+
+    if (p && !busy) {
+	busy = 1;
+	if ((r = new_rec()) != NULL) {
+	    r->seq = stamp();
+	    commit_rec(r, OP_ALLOC, p, NULL, nmemb * size);
+	}
+	busy = 0;
+    }
+    return p;
+}
+
+void free(void *ptr)
+{
+    rec_t *r;
+
+    if (ptr && !busy) {
+	busy = 1;
+	if ((r = new_rec()) != NULL) {
+	    r->seq = stamp();
+	    commit_rec(r, OP_FREE, ptr, NULL, 0);
+	}
+	busy = 0;
+    }
+    __libc_free(ptr);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    rec_t *r = NULL;
+    uint64_t seq = 0;
+    void *p;
+
+    if (ptr == NULL)
+	return malloc(size);
+    if (size == 0) {
+	free(ptr);
+	return NULL;
+    }
+
+    if (!busy) {
+	busy = 1;
+	if ((r = new_rec()) != NULL)
+	    seq = stamp();
+	busy = 0;
+    }
+    p = __libc_realloc(ptr, size);
+    if (r) {
+	r->seq = seq;
+	r->seq2 = stamp();
+	commit_rec(r, OP_REALLOC, p, ptr, size);
+    }
+    return p;
+}
+
+/*********************************************
+ * Starting and finishing the trace
+ *********************************************/
+
+/*
+ * stop_child - fork handler: the child must not touch the parent's trace
+ */
+static void stop_child(void)
+{
+    tracing = 0;
+}
+
+/*
+ * init_trace - Open the raw file and start recording. Runs on the first
+ *     intercepted call or from the constructor, whichever comes first.
+ */
+static void init_trace(void)
+{
+    int state = 0;
+    char *name, *pct;
+
+    if (!__atomic_compare_exchange_n(&init_state, &state, 1, 0,
+				     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+	/* Someone else is initializing; their calls go unrecorded */
+	return;
+    }
+
+    owner_pid = getpid();
+    if ((name = getenv("MMTRACE_FILE")) == NULL || *name == '\0')
+	name = DEFAULT_FILE;
+    if ((pct = strstr(name, "%p")) != NULL)
+	snprintf(tracefile, MAXPATH, "%.*s%d%s", (int)(pct - name), name,
+		 (int)owner_pid, pct + 2);
+    else
+	snprintf(tracefile, MAXPATH, "%s", name);
+    snprintf(rawfile, sizeof(rawfile), "%s.raw", tracefile);
+
+    rawfd = open(rawfile, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    if (rawfd >= 0 && pthread_key_create(&buf_key, release_buf) == 0) {
+	pthread_atfork(NULL, NULL, stop_child);
+	tracing = 1;
+    }
+    __atomic_store_n(&init_state, 2, __ATOMIC_RELEASE);
+}
+
+static void __attribute__((constructor)) mmtrace_start(void)
+{
+    busy = 1;
+    init_trace();
+    busy = 0;
+}
+
+static void __attribute__((destructor)) mmtrace_finish(void)
+{
+    tbuf_t *b;
+
+    if (!tracing || getpid() != owner_pid)
+	return;
+    busy = 1;
+    tracing = 0;
+    for (b = buffers; b; b = b->next)
+	flush_buf(b);
+    close(rawfd);
+    write_trace();
+    unlink(rawfile);
+    busy = 0;
+}
+
+/*********************************************
+ * Writing the .rep trace from the raw records
+ *********************************************/
+
+/* Open addressing hash table mapping live block addresses to ids */
+static uint64_t *map_keys = NULL;
+static int *map_ids = NULL;
+static size_t map_size = 0, map_used = 0;
+
+static size_t map_slot(uint64_t key)
+{
+    return (size_t)((key >> 4) * 0x9E3779B97F4A7C15ULL) & (map_size - 1);
+}
+
+static void map_put(uint64_t key, int id);
+
+/*
+ * map_grow - Double the table and rehash every entry
+ */
+static void map_grow(void)
+{
+    uint64_t *keys = map_keys;
+    int *ids = map_ids;
+    size_t i, n = map_size;
+
+    map_size = n ? 2*n : 1024;
+    map_used = 0;
+    map_keys = calloc(map_size, sizeof(uint64_t));
+    map_ids = calloc(map_size, sizeof(int));
+    if (map_keys == NULL || map_ids == NULL) {
+	fprintf(stderr, "mmtrace: out of memory\n");
+	exit(1);
+    }
+    for (i = 0; i < n; i++)
+	if (keys[i])
+	    map_put(keys[i], ids[i]);
+    free(keys);
+    free(ids);
+}
+
+static void map_put(uint64_t key, int id)
+{
+    size_t i;
+
+    if (2*(map_used+1) > map_size)
+	map_grow();
+    for (i = map_slot(key); map_keys[i] && map_keys[i] != key;
+	 i = (i+1) & (map_size-1))
+	;
+    if (!map_keys[i])
+	map_used++;
+    map_keys[i] = key;
+    map_ids[i] = id;
+}
+
+/*
+ * map_take - Remove key from the table and return its id, or -1
+ */
+static int map_take(uint64_t key)
+{
+    size_t i, j, home;
+    int id;
+
+    if (map_size == 0)
+	return -1;
+    for (i = map_slot(key); map_keys[i] != key; i = (i+1) & (map_size-1))
+	if (!map_keys[i])
+	    return -1;
+    id = map_ids[i];
+
+    /* Backward shift deletion keeps the probe sequences intact */
+    for (j = (i+1) & (map_size-1); map_keys[j]; j = (j+1) & (map_size-1)) {
+	home = map_slot(map_keys[j]);
+	if (((j - home) & (map_size-1)) >= ((j - i) & (map_size-1))) {
+	    map_keys[i] = map_keys[j];
+	    map_ids[i] = map_ids[j];
+	    i = j;
+	}
+    }
+    map_keys[i] = 0;
+    map_used--;
+    return id;
+}
+
+static int cmp_event(const void *a, const void *b)
+{
+    uint64_t x = ((const event_t *)a)->seq;
+    uint64_t y = ((const event_t *)b)->seq;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * trace_size - Clamp a request to what read_trace can hold. mdriver
+ *     rejects zero byte requests, so malloc(0) is recorded as 1 byte.
+ */
+static unsigned trace_size(uint64_t size)
+{
+    if (size == 0)
+	return 1;
+    return (size > 0x7fffffff) ? 0x7fffffff : (unsigned)size;
+}
+
+/*
+ * write_trace - Turn the raw file into the final .rep trace
+ */
+static void write_trace(void)
+{
+    int fd;
+    struct stat st;
+    rec_t *recs, *r;
+    event_t *events;
+    int *pending;
+    size_t nrecs, nevents = 0, i;
+    int id, num_ids = 0, max_ids = 0;
+    long num_ops = 0;
+    uint64_t live = 0, peak = 0, *sizes = NULL;
+    FILE *out;
+
+    if ((fd = open(rawfile, O_RDONLY)) < 0 || fstat(fd, &st) < 0)
+	return;
+    nrecs = st.st_size / sizeof(rec_t);
+    recs = (nrecs > 0) ?
+	mmap(NULL, nrecs * sizeof(rec_t), PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+    close(fd);
+    if (recs == MAP_FAILED)
+	return;
+
+    /* Order every event by its sequence number */
+    events = malloc((2*nrecs + 1) * sizeof(event_t));
+    pending = malloc((nrecs + 1) * sizeof(int));
+    if (events == NULL || pending == NULL) {
+	fprintf(stderr, "mmtrace: out of memory\n");
+	return;
+    }
+    for (i = 0; i < nrecs; i++) {
+	events[nevents].seq = recs[i].seq;
+	events[nevents].rec = i;
+	events[nevents++].end = 0;
+	if (recs[i].op == OP_REALLOC) {
+	    events[nevents].seq = recs[i].seq2;
+	    events[nevents].rec = i;
+	    events[nevents++].end = 1;
+	}
+    }
+    qsort(events, nevents, sizeof(event_t), cmp_event);
+
+    if ((out = fopen(tracefile, "w")) == NULL) {
+	perror(tracefile);
+	return;
+    }
+    fprintf(out, "%-*d\n%-*d\n%-*d\n%-*d\n", HDRWIDTH, 0, HDRWIDTH, 0,
+	    HDRWIDTH, 0, HDRWIDTH, 1);
+
+    for (i = 0; i < nevents; i++) {
+	r = &recs[events[i].rec];
+	id = -1;
+
+	if (r->op == OP_ALLOC || (r->op == OP_REALLOC && events[i].end &&
+				  pending[events[i].rec] < 0)) {
+	    /* A new block; a realloc of an unknown block counts as one */
+	    if (r->ptr == 0)
+		continue;
+	    if (num_ids == max_ids) {
+		max_ids = max_ids ? 2*max_ids : 1024;
+		if ((sizes = realloc(sizes, max_ids * sizeof(uint64_t))) == NULL) {
+		    fprintf(stderr, "mmtrace: out of memory\n");
+		    exit(1);
+		}
+	    }
+	    id = num_ids++;
+	    map_put(r->ptr, id);
+	    sizes[id] = trace_size(r->size);
+	    live += sizes[id];
+	    fprintf(out, "a %d %u\n", id, trace_size(r->size));
+	}
+	else if (r->op == OP_FREE) {
+	    if ((id = map_take(r->ptr)) < 0)
+		continue;
+	    live -= sizes[id];
+	    fprintf(out, "f %d\n", id);
+	}
+	else if (!events[i].end) {
+	    /* The realloc starts: the old address is no longer ours */
+	    pending[events[i].rec] = map_take(r->old);
+	    continue;
+	}
+	else {
+	    /* The realloc returns. On failure the old block stays put. */
+	    id = pending[events[i].rec];
+	    if (r->ptr == 0) {
+		map_put(r->old, id);
+		continue;
+	    }
+	    map_put(r->ptr, id);
+	    live += trace_size(r->size) - sizes[id];
+	    sizes[id] = trace_size(r->size);
+	    fprintf(out, "r %d %u\n", id, trace_size(r->size));
+	}
+	num_ops++;
+	if (live > peak)
+	    peak = live;
+    }
+
+    /* Now that the counts are known, fill in the header */
+    fseek(out, 0, SEEK_SET);
+    fprintf(out, "%-*lu\n%-*d\n%-*ld\n%-*d\n", HDRWIDTH, (unsigned long)peak,
+	    HDRWIDTH, num_ids, HDRWIDTH, num_ops, HDRWIDTH, 1);
+    fclose(out);
+
+    if (recs)
+	munmap(recs, nrecs * sizeof(rec_t));
+    free(events);
+    free(pending);
+    free(sizes);
+    free(map_keys);
+    free(map_ids);
+}
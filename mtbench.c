@@ -0,0 +1,215 @@
+/*
+ * mtbench.c - Producer/consumer benchmark for cross-thread frees
+ *
+ * Each of p pairs of threads runs a pipeline: the producer mallocs
+ * messages, writes them and passes them through a ring to its consumer,
+ * which reads and frees them. Every free is a free of a block another
+ * thread allocated, which is the case libmm's remote free list is for.
+ * We report messages per second over all the pairs.
+ *
+ * It uses the malloc it is linked with, so compare allocators with
+ * LD_PRELOAD:
+ *
+ *     ./mtbench -p 4
+ *     LD_PRELOAD=./libmm.so ./mtbench -p 4
+ *     MM_REMOTE_FREE=0 LD_PRELOAD=./libmm.so ./mtbench -p 4
+ *
+ * Usage: mtbench [-h] [-p <pairs>] [-n <msgs>] [-s <bytes>] [-r <ring>]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+/**********************
+ * Constants and macros
+ **********************/
+
+#define MAX_PAIRS    64        /* most producer/consumer pairs */
+#define MAX_RING     (1<<16)   /* largest ring between a pair */
+
+/**********************
+ * Data types
+ **********************/
+
+/* A single producer, single consumer ring of message pointers */
+typedef struct {
+    void **slot;               /* ring_size entries */
+    unsigned long head;        /* next slot the consumer reads */
+    char pad[64];              /* keep head and tail in different lines */
+    unsigned long tail;        /* next slot the producer writes */
+} ring_t;
+
+/* One pipeline */
+typedef struct {
+    ring_t ring;
+    long msgs;                 /* messages to send */
+    size_t size;               /* bytes per message */
+    long bad;                  /* messages that arrived damaged */
+} pair_t;
+
+/********************
+ * Global variables
+ ********************/
+static unsigned long ring_size = 1024;   /* power of two */
+
+/*********************
+ * Function prototypes
+ *********************/
+static void usage(void);
+static void app_error(char *msg);
+
+/*
+ * producer - malloc, fill and send pair->msgs messages
+ */
+static void *producer(void *arg)
+{
+    pair_t *pair = arg;
+    ring_t *r = &pair->ring;
+    unsigned long tail = 0;
+    long i;
+    char *msg;
+
+    for (i = 0; i < pair->msgs; i++) {
+	if ((msg = malloc(pair->size)) == NULL)
+	    app_error("malloc failed in producer");
+	memset(msg, (int)(i & 0xff), pair->size);
+
+	/* Wait for room */
+	while (tail - __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) == ring_size)
+	    sched_yield();
+	r->slot[tail & (ring_size - 1)] = msg;
+	__atomic_store_n(&r->tail, ++tail, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+/*
+ * consumer - receive, check and free pair->msgs messages
+ */
+static void *consumer(void *arg)
+{
+    pair_t *pair = arg;
+    ring_t *r = &pair->ring;
+    unsigned long head = 0;
+    long i;
+    char *msg;
+
+    for (i = 0; i < pair->msgs; i++) {
+	/* Wait for a message */
+	while (__atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) == head)
+	    sched_yield();
+	msg = r->slot[head & (ring_size - 1)];
+	__atomic_store_n(&r->head, ++head, __ATOMIC_RELEASE);
+
+	if (msg[0] != (char)(i & 0xff) ||
+	    msg[pair->size - 1] != (char)(i & 0xff))
+	    pair->bad++;
+	free(msg);
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    int c, i, npairs = 1;
+    long msgs = 1000000, bad = 0;
+    size_t size = 64;
+    pair_t *pairs;
+    pthread_t *threads;
+    struct timespec start, end;
+    double secs;
+
+    while ((c = getopt(argc, argv, "p:n:s:r:h")) != EOF) {
+	switch (c) {
+	case 'p': /* Producer/consumer pairs */
+	    npairs = atoi(optarg);
+	    break;
+	case 'n': /* Messages per pair */
+	    msgs = atol(optarg);
+	    break;
+	case 's': /* Bytes per message */
+	    size = strtoul(optarg, NULL, 0);
+	    break;
+	case 'r': /* Ring entries between each pair */
+	    ring_size = strtoul(optarg, NULL, 0);
+	    break;
+	case 'h':
+	    usage();
+	    exit(0);
+	default:
+	    usage();
+	    exit(1);
+	}
+    }
+    if (npairs < 1 || npairs > MAX_PAIRS)
+	app_error("-p must be between 1 and 64");
+    if (msgs < 1 || size < 1)
+	app_error("-n and -s must be positive");
+    if (ring_size < 1 || ring_size > MAX_RING ||
+	(ring_size & (ring_size - 1)))
+	app_error("-r must be a power of two up to 65536");
+
+    if ((pairs = calloc(npairs, sizeof(pair_t))) == NULL ||
+	(threads = calloc(2 * npairs, sizeof(pthread_t))) == NULL)
+	app_error("calloc failed in main");
+    for (i = 0; i < npairs; i++) {
+	if ((pairs[i].ring.slot = calloc(ring_size, sizeof(void *))) == NULL)
+	    app_error("calloc failed in main");
+	pairs[i].msgs = msgs;
+	pairs[i].size = size;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < npairs; i++) {
+	if (pthread_create(&threads[2 * i], NULL, consumer, &pairs[i]) != 0 ||
+	    pthread_create(&threads[2 * i + 1], NULL, producer, &pairs[i]) != 0)
+	    app_error("pthread_create failed");
+    }
+    for (i = 0; i < 2 * npairs; i++)
+	pthread_join(threads[i], NULL);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    for (i = 0; i < npairs; i++) {
+	bad += pairs[i].bad;
+	free(pairs[i].ring.slot);
+    }
+    printf("%d pairs, %ld messages of %lu bytes each: %.3f secs, "
+	   "%.0f Kmsgs/sec\n", npairs, msgs, (unsigned long)size, secs,
+	   npairs * msgs / secs / 1e3);
+    if (bad > 0) {
+	printf("%ld messages arrived damaged\n", bad);
+	exit(1);
+    }
+    free(pairs);
+    free(threads);
+    exit(0);
+}
+
+/*
+ * app_error - Report an arbitrary application error
+ */
+static void app_error(char *msg)
+{
+    fprintf(stderr, "mtbench: %s\n", msg);
+    exit(1);
+}
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(void)
+{
+    fprintf(stderr, "Usage: mtbench [-h] [-p <pairs>] [-n <msgs>] "
+	    "[-s <bytes>] [-r <ring>]\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-h          Print this message.\n");
+    fprintf(stderr, "\t-n <msgs>   Messages each producer sends (default 1000000).\n");
+    fprintf(stderr, "\t-p <pairs>  Producer/consumer thread pairs (default 1).\n");
+    fprintf(stderr, "\t-r <ring>   Ring entries between a pair, a power of two (default 1024).\n");
+    fprintf(stderr, "\t-s <bytes>  Bytes per message (default 64).\n");
+}
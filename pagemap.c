@@ -0,0 +1,57 @@
+/*
+ * pagemap.c - A two level radix tree keyed by page number
+ *
+ * The high PM_ROOT_BITS of the page number pick a leaf from the root
+ * array and the low PM_LEAF_BITS pick the entry in it, so a lookup is
+ * two loads whatever the size of the heap. The leaves come straight
+ * from mmap, since the map belongs to the allocator and must not be
+ * kept in (or allocated from) the heap it describes.
+ */
+#include <string.h>
+#include <sys/mman.h>
+
+#include "pagemap.h"
+
+#define PM_LEAF_ENTRIES ((size_t)1 << PM_LEAF_BITS)
+
+void pagemap_init(pagemap_t *pm, size_t entry_size)
+{
+    size_t i;
+
+    if (pm->entry_size != entry_size) {
+	memset(pm->root, 0, sizeof(pm->root));
+	pm->entry_size = entry_size;
+	return;
+    }
+    for (i = 0; i < (1 << PM_ROOT_BITS); i++)
+	if (pm->root[i] != NULL)
+	    memset(pm->root[i], 0, PM_LEAF_ENTRIES * entry_size);
+}
+
+void *pagemap_get(pagemap_t *pm, size_t page)
+{
+    char *leaf;
+
+    if (page >= PM_PAGES || 
+	(leaf = pm->root[page >> PM_LEAF_BITS]) == NULL)
+	return NULL;
+    return leaf + (page & (PM_LEAF_ENTRIES - 1)) * pm->entry_size;
+}
+
+void *pagemap_make(pagemap_t *pm, size_t page)
+{
+    char **leafp, *leaf;
+
+    if (page >= PM_PAGES)
+	return NULL;
+    leafp = &pm->root[page >> PM_LEAF_BITS];
+    if (*leafp == NULL) {
+	/* Anonymous mappings come zero filled */
+	leaf = mmap(NULL, PM_LEAF_ENTRIES * pm->entry_size, 
+		    PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (leaf == MAP_FAILED)
+	    return NULL;
+	*leafp = leaf;
+    }
+    return *leafp + (page & (PM_LEAF_ENTRIES - 1)) * pm->entry_size;
+}
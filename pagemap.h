@@ -0,0 +1,32 @@
+/*
+ * pagemap.h - A two level radix tree from heap page numbers to fixed
+ *     size entries, like tcmalloc's page map. The leaves are mapped from
+ *     the OS on first use, outside the heap, and are zero until set.
+ */
+#ifndef __PAGEMAP_H_
+#define __PAGEMAP_H_
+
+#include <stddef.h>
+
+#define PM_LEAF_BITS 10  /* pages per leaf: 2^10 */
+#define PM_ROOT_BITS 14  /* leaves: 2^14, so 2^24 pages (64 GB) in all */
+#define PM_PAGES     ((size_t)1 << (PM_ROOT_BITS + PM_LEAF_BITS))
+
+typedef struct {
+    size_t entry_size;                  /* bytes per entry */
+    char *root[1 << PM_ROOT_BITS];      /* leaves, NULL until needed */
+} pagemap_t;
+
+/* Set up pm for entries of entry_size bytes. On a map that is already
+   set up, zero every entry but keep the leaves for reuse. */
+void pagemap_init(pagemap_t *pm, size_t entry_size);
+
+/* The entry for page, or NULL if its leaf was never made (the entry 
+   would be all zero) */
+void *pagemap_get(pagemap_t *pm, size_t page);
+
+/* The entry for page, making its leaf if need be. NULL if page is out 
+   of range or the leaf could not be mapped. */
+void *pagemap_make(pagemap_t *pm, size_t page);
+
+#endif /* __PAGEMAP_H_ */
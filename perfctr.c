@@ -0,0 +1,186 @@
+/*
+ * perfctr.c - Count hardware events (cycles, instructions, branch 
+ *     misses, L1D/LLC/dTLB misses) while a test function runs
+ *
+ * The events are opened as two perf_event_open groups, so that each
+ * group is scheduled onto the PMU as a unit and its counts describe the
+ * same stretch of execution: the core events (cycles, instructions and
+ * branch misses) and the memory events (L1D, LLC and dTLB read misses).
+ * When there are not enough hardware counters for both, the kernel
+ * multiplexes the groups and the counts are scaled by the fraction of
+ * time each group was running.
+ *
+ * Only user-mode events of the calling thread are counted, which is
+ * what an unprivileged process may do with perf_event_paranoid <= 2.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include "perfctr.h"
+
+char *perfctr_names[PERFCTR_NEVENTS] = {
+    "cycles", "instructions", "branch_misses", 
+    "l1d_misses", "llc_misses", "dtlb_misses"
+};
+
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#define CACHE_EVENT(cache) \
+    ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | \
+     (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+/* What to open for each event, and which group it belongs to */
+static struct {
+    uint32_t type;
+    uint64_t config;
+    int group;
+} events[PERFCTR_NEVENTS] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, 0},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, 0},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, 0},
+    {PERF_TYPE_HW_CACHE, CACHE_EVENT(PERF_COUNT_HW_CACHE_L1D), 1},
+    {PERF_TYPE_HW_CACHE, CACHE_EVENT(PERF_COUNT_HW_CACHE_LL), 1},
+    {PERF_TYPE_HW_CACHE, CACHE_EVENT(PERF_COUNT_HW_CACHE_DTLB), 1},
+};
+
+#define NGROUPS 2
+
+static int fds[PERFCTR_NEVENTS];   /* -1 if the event is not counted */
+static int leaders[NGROUPS];       /* group leader fd, or -1 */
+
+/*
+ * Group read format: {nr, time_enabled, time_running, {value, id}[nr]},
+ * with the values in the order the members were opened
+ */
+struct group_read {
+    uint64_t nr;
+    uint64_t time_enabled;
+    uint64_t time_running;
+    struct {
+	uint64_t value;
+	uint64_t id;
+    } values[PERFCTR_NEVENTS];
+};
+
+static int open_event(int e, int group_fd)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = events[e].type;
+    attr.config = events[e].config;
+    attr.disabled = (group_fd == -1);  /* the leader starts the group */
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_ID |
+	PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+int perfctr_open(int verbose)
+{
+    int e, g, n = 0, err = 0;
+
+    for (g = 0; g < NGROUPS; g++)
+	leaders[g] = -1;
+    for (e = 0; e < PERFCTR_NEVENTS; e++) {
+	g = events[e].group;
+	if ((fds[e] = open_event(e, leaders[g])) < 0) {
+	    err = errno;
+	    continue;
+	}
+	if (leaders[g] == -1)
+	    leaders[g] = fds[e];
+	n++;
+    }
+    if (verbose && n < PERFCTR_NEVENTS) {
+	if (n == 0)
+	    printf("Hardware counters unavailable: %s", strerror(err));
+	else
+	    printf("Only %d of %d hardware counters available: %s", 
+		   n, PERFCTR_NEVENTS, strerror(err));
+	if (err == EACCES || err == EPERM)
+	    printf(" (see /proc/sys/kernel/perf_event_paranoid)");
+	printf("\n");
+    }
+    return n;
+}
+
+void perfctr_close(void)
+{
+    int e;
+
+    for (e = 0; e < PERFCTR_NEVENTS; e++)
+	if (fds[e] >= 0) {
+	    close(fds[e]);
+	    fds[e] = -1;
+	}
+    for (e = 0; e < NGROUPS; e++)
+	leaders[e] = -1;
+}
+
+void perfctr_measure(perfctr_test_funct f, void *argp, double *counts)
+{
+    struct group_read buf;
+    double scale;
+    int e, g, k;
+
+    for (e = 0; e < PERFCTR_NEVENTS; e++)
+	counts[e] = -1;
+
+    for (g = 0; g < NGROUPS; g++)
+	if (leaders[g] >= 0) {
+	    ioctl(leaders[g], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+	    ioctl(leaders[g], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+	}
+    f(argp);
+    for (g = 0; g < NGROUPS; g++)
+	if (leaders[g] >= 0)
+	    ioctl(leaders[g], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+    for (g = 0; g < NGROUPS; g++) {
+	if (leaders[g] < 0 || read(leaders[g], &buf, sizeof(buf)) <= 0)
+	    continue;
+	/* A group that never got onto the PMU has nothing to report */
+	if (buf.time_running == 0)
+	    continue;
+	scale = (double)buf.time_enabled / buf.time_running;
+	for (e = 0, k = 0; e < PERFCTR_NEVENTS; e++) {
+	    if (events[e].group != g || fds[e] < 0)
+		continue;
+	    if (k < (int)buf.nr)
+		counts[e] = buf.values[k].value * scale;
+	    k++;
+	}
+    }
+}
+
+#else /* !__linux__ */
+
+int perfctr_open(int verbose)
+{
+    if (verbose)
+	printf("Hardware counters are only supported on Linux\n");
+    return 0;
+}
+
+void perfctr_close(void)
+{
+}
+
+void perfctr_measure(perfctr_test_funct f, void *argp, double *counts)
+{
+    int e;
+
+    for (e = 0; e < PERFCTR_NEVENTS; e++)
+	counts[e] = -1;
+    f(argp);
+}
+
+#endif /* __linux__ */
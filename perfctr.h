@@ -0,0 +1,34 @@
+/*
+ * perfctr.h - Hardware performance counters around a test function
+ *     (Linux perf_event_open)
+ */
+typedef void (*perfctr_test_funct)(void *);
+
+/* Events counted by perfctr_measure, in the order of its result array */
+#define PERFCTR_CYCLES       0
+#define PERFCTR_INSTRUCTIONS 1
+#define PERFCTR_BRANCH_MISS  2
+#define PERFCTR_L1D_MISS     3
+#define PERFCTR_LLC_MISS     4
+#define PERFCTR_DTLB_MISS    5
+#define PERFCTR_NEVENTS      6
+
+/* Short names of the events, e.g. "cycles" */
+extern char *perfctr_names[PERFCTR_NEVENTS];
+
+/* 
+ * Open the counters. Returns the number of events that can be counted,
+ * or 0 (after printing why, if verbose) when perf events are not 
+ * permitted or not supported on this machine.
+ */
+int perfctr_open(int verbose);
+
+/* Release the counters */
+void perfctr_close(void);
+
+/*
+ * Run f(argp) once with the counters enabled and store the count of
+ * each event in counts, scaled up if the kernel had to multiplex the
+ * counters. Events that could not be counted are set to -1.
+ */
+void perfctr_measure(perfctr_test_funct f, void *argp, double *counts);
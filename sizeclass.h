@@ -0,0 +1,108 @@
+/*
+ * sizeclass.h - Size classes for mm.c, generated by gensizeclass. Don't
+ * edit it: rerun "make sizeclasses" with the traces of the workload.
+ *
+ * Traces:
+ *   traces/amptjp-bal.rep traces/binary-bal.rep
+ *   traces/binary2-bal.rep traces/cccp-bal.rep
+ *   traces/coalescing-bal.rep traces/cp-decl-bal.rep
+ *   traces/expr-bal.rep traces/random-bal.rep
+ *   traces/random2-bal.rep traces/realloc-bal.rep
+ *   traces/realloc2-bal.rep traces/short1-bal.rep
+ *   traces/short2-bal.rep
+ *
+ * class     size     requests       wasted
+ *     0       24         9339           16
+ *     1       32           62            0
+ *     2       72         2056         1160
+ *     3       80         1069            0
+ *     4      120         4012          240
+ *     5      136         8859          464
+ *     6      168         1033           88
+ *     7      304           27         1496
+ *     8      456         2018         1344
+ *     9      464          162            0
+ *    10      520         2015          384
+ *    11      656           18          944
+ *    12      824           23         1512
+ *    13     1016           37         2232
+ *    14     1200           30         2712
+ *    15     1384           35         2704
+ *    16     1552           36         2200
+ *    17     1696           25         1504
+ *    18     1888           31         2256
+ *    19     2056           39         2256
+ *    20     2216           42         2752
+ *    21     2416           24         2064
+ *    22     2584           26         1704
+ *    23     2768           31         2368
+ *    24     2952           28         2088
+ *    25     3088           21          944
+ *    26     3296           24         1880
+ *    27     3488           28         2360
+ *    28     3680           28         2280
+ *    29     3904           36         3432
+ *    30     4080         8730         2256
+ *    31     4096            1            0
+ *
+ * 39945 requests up to 4096 bytes, 0.12% of their block bytes wasted
+ */
+#ifndef __SIZECLASS_H_
+#define __SIZECLASS_H_
+
+#include <stdint.h>
+
+#define SIZE_CLASSES     32
+#define SIZE_CLASS_ALIGN 8  /* block sizes are multiples of this */
+#define SIZE_CLASS_MAX   4096  /* the largest block with a class */
+#define SIZE_CLASS_TAG   4  /* bytes per tag the sizes allow for */
+
+/* The block size of each class */
+static const uint32_t size_class_size[SIZE_CLASSES] = {
+    24, 32, 72, 80, 120, 136, 168, 304,
+    456, 464, 520, 656, 824, 1016, 1200, 1384,
+    1552, 1696, 1888, 2056, 2216, 2416, 2584, 2768,
+    2952, 3088, 3296, 3488, 3680, 3904, 4080, 4096
+};
+
+/* The class of each block size, by size / SIZE_CLASS_ALIGN */
+static const uint8_t size_class_lut[SIZE_CLASS_MAX / SIZE_CLASS_ALIGN + 1] = {
+    0, 0, 0, 0, 1, 2, 2, 2, 2, 2, 3, 4, 4, 4, 4, 4,
+    5, 5, 6, 6, 6, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 8, 8, 8, 8, 8, 8, 8, 8, 8,
+    8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 9, 10, 10, 10, 10, 10,
+    10, 10, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11,
+    11, 11, 11, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+    12, 12, 12, 12, 12, 12, 12, 12, 13, 13, 13, 13, 13, 13, 13, 13,
+    13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13,
+    14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14,
+    14, 14, 14, 14, 14, 14, 14, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+    15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 16, 16,
+    16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16,
+    16, 16, 16, 17, 17, 17, 17, 17, 17, 17, 17, 17, 17, 17, 17, 17,
+    17, 17, 17, 17, 17, 18, 18, 18, 18, 18, 18, 18, 18, 18, 18, 18,
+    18, 18, 18, 18, 18, 18, 18, 18, 18, 18, 18, 18, 18, 19, 19, 19,
+    19, 19, 19, 19, 19, 19, 19, 19, 19, 19, 19, 19, 19, 19, 19, 19,
+    19, 19, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20,
+    20, 20, 20, 20, 20, 20, 21, 21, 21, 21, 21, 21, 21, 21, 21, 21,
+    21, 21, 21, 21, 21, 21, 21, 21, 21, 21, 21, 21, 21, 21, 21, 22,
+    22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22,
+    22, 22, 22, 22, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23,
+    23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 24, 24, 24, 24, 24,
+    24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24,
+    24, 24, 25, 25, 25, 25, 25, 25, 25, 25, 25, 25, 25, 25, 25, 25,
+    25, 25, 25, 26, 26, 26, 26, 26, 26, 26, 26, 26, 26, 26, 26, 26,
+    26, 26, 26, 26, 26, 26, 26, 26, 26, 26, 26, 26, 26, 27, 27, 27,
+    27, 27, 27, 27, 27, 27, 27, 27, 27, 27, 27, 27, 27, 27, 27, 27,
+    27, 27, 27, 27, 27, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+    28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 29, 29, 29,
+    29, 29, 29, 29, 29, 29, 29, 29, 29, 29, 29, 29, 29, 29, 29, 29,
+    29, 29, 29, 29, 29, 29, 29, 29, 29, 30, 30, 30, 30, 30, 30, 30,
+    30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 31,
+    31
+};
+
+/* The class of a block of sz bytes, sz <= SIZE_CLASS_MAX */
+#define SIZE_CLASS(sz) (size_class_lut[((sz) + SIZE_CLASS_ALIGN - 1) / SIZE_CLASS_ALIGN])
+
+#endif /* __SIZECLASS_H_ */